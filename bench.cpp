@@ -0,0 +1,61 @@
+// Copyright (c) 2021 Thomas Kaldahl
+
+// Times both convolution paths over a range of filter sizes, to choose the
+// crossover passed to FinLin::setConvCrossover for a device.
+
+#include "finlin.hpp"
+#include <time.h>
+
+const int CHANNELS = 8;
+const int FILTERS = 8;
+const int SIZE = 256;
+const int REPEATS = 5;
+
+double seconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Fastest of REPEATS convolutions, in seconds
+double timeConv(Mat *in, Mat *filters, int crossover) {
+	FinLin::setConvCrossover(crossover);
+	double best = INFINITY;
+	for(int i = 0; i < REPEATS; i++) {
+		double start = seconds();
+		Mat *out = Mat::conv2d(CHANNELS, in, FILTERS, filters, 1, 0);
+		double time = seconds() - start;
+		if(time < best) best = time;
+		free(out);
+	}
+	return best;
+}
+
+int main(int argc, char **argv) {
+	int platform = argc > 1 ? atoi(argv[1]) : 0;
+	int device = argc > 2 ? atoi(argv[2]) : 0;
+	FinLin::init(platform, device);
+
+	Mat *in = (Mat*)malloc(CHANNELS * sizeof(Mat));
+	for(int c = 0; c < CHANNELS; c++) {
+		in[c] = Mat::randomUniform(SIZE, SIZE, -1, 1);
+	}
+
+	printf("%d channels of %d by %d, %d filters\n", CHANNELS, SIZE, SIZE, FILTERS);
+	printf("filter\tdirect\t\tim2col + GEMM\n");
+	int crossover = 0;
+	for(int k = 1; k <= 15; k += 2) {
+		Mat *filters = (Mat*)malloc(FILTERS*CHANNELS * sizeof(Mat));
+		for(int f = 0; f < FILTERS*CHANNELS; f++) {
+			filters[f] = Mat::randomUniform(k, k, -1, 1);
+		}
+
+		double direct = timeConv(in, filters, k*k);
+		double gemm = timeConv(in, filters, 0);
+		printf("%d by %d\t%f s\t%f s\n", k, k, direct, gemm);
+		if(direct <= gemm) crossover = k*k;
+
+		free(filters);
+	}
+	printf("Crossover: FinLin::setConvCrossover(%d)\n", crossover);
+}
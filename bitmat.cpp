@@ -0,0 +1,299 @@
+// Copyright (c) 2021 Thomas Kaldahl
+
+#include "finlin.hpp"
+
+// Helper functions
+void ensureSameBitMatDim(int h1, int w1, int h2, int w2, const char *operation) {
+	if(h1 != h2 || w1 != w2) {
+		fprintf(
+			stderr,
+			"Dimension mismatch. Cannot %s %d by %d and %d by %d bit matrices.\n",
+			operation,
+			h1,
+			w1,
+			h2,
+			w2
+		);
+		exit(1);
+	}
+}
+void ensureMulBitMatDims(int w1, int h2) {
+	if(w1 != h2) {
+		fprintf(
+			stderr,
+			"Dimension mismatch. "
+			"Cannot multiply bit matrix of width %d with height %d.\n",
+			w1,
+			h2
+		);
+		exit(1);
+	}
+}
+
+// Technical methods
+void BitMat::createMem() {
+	clmem = clCreateBuffer(
+		FinLin::context,
+		CL_MEM_READ_WRITE,
+		h*rowWords * sizeof(uint64_t),
+		NULL,
+		&FinLin::err
+	);
+	FinLin::checkErr();
+	dirty = true;
+}
+
+BitMat BitMat::copy() const {
+	BitMat res = BitMat(h, w);
+	memcpy(res.data, data, h*rowWords * sizeof(uint64_t));
+	// Copied on the GPU too rather than uploading again, and always while
+	// capturing, so that replays copy inputs that have been rebound
+	if(!dirty || FinLin::capturing != NULL) {
+		sync();
+		FinLin::copyBuffer(
+			clmem,
+			res.clmem,
+			0,
+			0,
+			h*rowWords * sizeof(uint64_t)
+		);
+		res.dirty = false;
+	}
+	return res;
+}
+void BitMat::sync() const {
+	if(!dirty) return;
+	FinLin::writeBuffer(clmem, 0, h*rowWords * sizeof(uint64_t), data);
+	dirty = false;
+}
+bool BitMat::update() {
+	if(!dirty) return false;
+	sync();
+	return true;
+}
+
+// Constructors
+BitMat::BitMat(int height, int width) {
+	h = height;
+	w = width;
+	rowWords = (w + 63) / 64;
+	data = (uint64_t*)FinLin::allocHost(h*rowWords * sizeof(uint64_t));
+	memset(data, 0, h*rowWords * sizeof(uint64_t));
+	createMem();
+}
+BitMat::BitMat(int size) : BitMat(size, size) {
+	for(int i = 0; i < size; i++) {
+		data[i*rowWords + i/64] |= (uint64_t)1 << i % 64;
+	}
+}
+BitMat::BitMat(Mati mat) : BitMat(mat.h, mat.w) {
+	for(int r = 0; r < h; r++) {
+		for(int c = 0; c < w; c++) {
+			if(mat.data[r*w + c] == 0) continue;
+			data[r*rowWords + c/64] |= (uint64_t)1 << c % 64;
+		}
+	}
+}
+
+// Accessors
+int BitMat::height() const {
+	return h;
+}
+int BitMat::width() const {
+	return w;
+}
+
+bool BitMat::comp(int r, int c) const {
+	return data[r*rowWords + c/64] >> c % 64 & 1;
+}
+
+char *BitMat::string() const {
+	char *res = (char*)malloc(h * (w + 2) + 4);
+	snprintf(res, 3, "(\n");
+	char *resp = res + 2;
+	for(int r = 0; r < h; r++) {
+		*resp++ = '\t';
+		for(int c = 0; c < w; c++) {
+			*resp++ = comp(r, c) ? '1' : '0';
+		}
+		*resp++ = '\n';
+	}
+	snprintf(resp, 2, ")");
+	return res;
+}
+
+// In-place operations
+BitMat BitMat::operator&=(BitMat mask) {
+	ensureSameBitMatDim(h, w, mask.h, mask.w, "AND");
+	update();
+	mask.update();
+
+	FinLin::setArg(FinLin::andBits, 0, clmem);
+	FinLin::setArg(FinLin::andBits, 1, mask.clmem);
+	FinLin::execKernel(FinLin::andBits, 0, h*rowWords, 0);
+	FinLin::readBuffer(clmem, 0, h*rowWords * sizeof(uint64_t), data);
+
+	return *this;
+}
+BitMat BitMat::operator|=(BitMat mask) {
+	ensureSameBitMatDim(h, w, mask.h, mask.w, "OR");
+	update();
+	mask.update();
+
+	FinLin::setArg(FinLin::orBits, 0, clmem);
+	FinLin::setArg(FinLin::orBits, 1, mask.clmem);
+	FinLin::execKernel(FinLin::orBits, 0, h*rowWords, 0);
+	FinLin::readBuffer(clmem, 0, h*rowWords * sizeof(uint64_t), data);
+
+	return *this;
+}
+BitMat BitMat::operator^=(BitMat mask) {
+	ensureSameBitMatDim(h, w, mask.h, mask.w, "XOR");
+	update();
+	mask.update();
+
+	FinLin::setArg(FinLin::xorBits, 0, clmem);
+	FinLin::setArg(FinLin::xorBits, 1, mask.clmem);
+	FinLin::execKernel(FinLin::xorBits, 0, h*rowWords, 0);
+	FinLin::readBuffer(clmem, 0, h*rowWords * sizeof(uint64_t), data);
+
+	return *this;
+}
+
+// Binary operations
+BitMat BitMat::operator&(BitMat mask) const {
+	BitMat res = copy();
+	res &= mask;
+	return res;
+}
+BitMat BitMat::operator|(BitMat mask) const {
+	BitMat res = copy();
+	res |= mask;
+	return res;
+}
+BitMat BitMat::operator^(BitMat mask) const {
+	BitMat res = copy();
+	res ^= mask;
+	return res;
+}
+
+BitVec BitMat::operator*(BitVec vector) {
+	ensureMulBitMatDims(w, vector.d);
+	update();
+	vector.update();
+
+	BitVec res = BitVec(h);
+	if(h == 0) return res;
+
+	FinLin::setArg(FinLin::bitMatVec, 0, clmem);
+	FinLin::setArg(FinLin::bitMatVec, 1, vector.clmem);
+	FinLin::setArg(FinLin::bitMatVec, 2, res.clmem);
+	FinLin::setArg(FinLin::bitMatVec, 3, rowWords);
+	FinLin::setArg(FinLin::bitMatVec, 4, h);
+	FinLin::execKernel(FinLin::bitMatVec, 0, res.words, 0);
+
+	FinLin::readBuffer(res.clmem, 0, res.words * sizeof(uint64_t), res.data);
+	res.dirty = false;
+
+	return res;
+}
+
+BitMat BitMat::operator*(BitMat multiplier) {
+	ensureMulBitMatDims(w, multiplier.h);
+	update();
+
+	BitMat res = BitMat(h, multiplier.w);
+	if(h == 0 || multiplier.w == 0) return res;
+
+	// Rows of the transpose are the columns to AND with
+	BitMat columns = multiplier.T();
+
+	FinLin::setArg(FinLin::bitMatMul, 0, clmem);
+	FinLin::setArg(FinLin::bitMatMul, 1, columns.clmem);
+	FinLin::setArg(FinLin::bitMatMul, 2, res.clmem);
+	FinLin::setArg(FinLin::bitMatMul, 3, rowWords);
+	FinLin::setArg(FinLin::bitMatMul, 4, multiplier.w);
+	FinLin::execKernel(FinLin::bitMatMul, 0, h, res.rowWords, 0);
+
+	FinLin::readBuffer(
+		res.clmem,
+		0,
+		h*res.rowWords * sizeof(uint64_t),
+		res.data
+	);
+	res.dirty = false;
+
+	clReleaseMemObject(columns.clmem);
+	free(columns.data);
+
+	return res;
+}
+
+// Unary operations
+int64_t BitMat::count() const {
+	if(h*rowWords == 0) return 0;
+
+	sync();
+
+	return FinLin::totall(FinLin::popcountPartial, clmem, NULL, h*rowWords);
+}
+BitMat BitMat::operator~() const {
+	BitMat res = copy();
+	if(h*rowWords == 0) return res;
+	res.update();
+
+	uint64_t lastMask = w % 64 == 0 ? ~(uint64_t)0 : ((uint64_t)1 << w % 64) - 1;
+	FinLin::setArg(FinLin::notBits, 0, res.clmem);
+	FinLin::setArg(FinLin::notBits, 1, rowWords);
+	FinLin::setArg(FinLin::notBits, 2, (int64_t)lastMask);
+	FinLin::execKernel(FinLin::notBits, 0, h*rowWords, 0);
+	FinLin::readBuffer(res.clmem, 0, h*rowWords * sizeof(uint64_t), res.data);
+
+	return res;
+}
+BitMat BitMat::T() const {
+	BitMat res = BitMat(w, h);
+	if(w*res.rowWords == 0) return res;
+
+	sync();
+
+	FinLin::setArg(FinLin::bitTranspose, 0, clmem);
+	FinLin::setArg(FinLin::bitTranspose, 1, res.clmem);
+	FinLin::setArg(FinLin::bitTranspose, 2, h);
+	FinLin::setArg(FinLin::bitTranspose, 3, w);
+	FinLin::execKernel(FinLin::bitTranspose, 0, w, res.rowWords, 0);
+
+	FinLin::readBuffer(
+		res.clmem,
+		0,
+		w*res.rowWords * sizeof(uint64_t),
+		res.data
+	);
+	res.dirty = false;
+
+	return res;
+}
+BitMat BitMat::closure() const {
+	ensureMulBitMatDims(w, h);
+
+	// Squaring doubles the length of the paths covered, until nothing changes
+	BitMat reach = copy();
+	int64_t edges = reach.count();
+	while(true) {
+		BitMat longer = reach | reach * reach;
+		int64_t count = longer.count();
+		if(count == edges) break;
+		reach = longer;
+		edges = count;
+	}
+	return reach;
+}
+
+// Mutators
+bool BitMat::setComp(int r, int c, bool value) {
+	bool prev = comp(r, c);
+	if(value) data[r*rowWords + c/64] |= (uint64_t)1 << c % 64;
+	else data[r*rowWords + c/64] &= ~((uint64_t)1 << c % 64);
+	dirty = true;
+	return prev;
+}
@@ -0,0 +1,188 @@
+// Copyright (c) 2021 Thomas Kaldahl
+
+#include "finlin.hpp"
+
+// Helper functions
+void ensureSameBitVecDim(int d1, int d2, const char *operation) {
+	if(d1 != d2) {
+		fprintf(
+			stderr,
+			"Dimension mismatch. Cannot %s bit vectors of length %d and %d.\n",
+			operation,
+			d1,
+			d2
+		);
+		exit(1);
+	}
+}
+
+// Technical methods
+void BitVec::createMem() {
+	clmem = clCreateBuffer(
+		FinLin::context,
+		CL_MEM_READ_WRITE,
+		words * sizeof(uint64_t),
+		NULL,
+		&FinLin::err
+	);
+	FinLin::checkErr();
+	dirty = true;
+}
+
+BitVec BitVec::copy() const {
+	BitVec res = BitVec(d);
+	memcpy(res.data, data, words * sizeof(uint64_t));
+	// Copied on the GPU too rather than uploading again, and always while
+	// capturing, so that replays copy inputs that have been rebound
+	if(!dirty || FinLin::capturing != NULL) {
+		sync();
+		FinLin::copyBuffer(clmem, res.clmem, 0, 0, words * sizeof(uint64_t));
+		res.dirty = false;
+	}
+	return res;
+}
+void BitVec::sync() const {
+	if(!dirty) return;
+	FinLin::writeBuffer(clmem, 0, words * sizeof(uint64_t), data);
+	dirty = false;
+}
+bool BitVec::update() {
+	if(!dirty) return false;
+	sync();
+	return true;
+}
+
+// Constructors
+BitVec::BitVec(int dimension) {
+	d = dimension;
+	words = (d + 63) / 64;
+	data = (uint64_t*)FinLin::allocHost(words * sizeof(uint64_t));
+	memset(data, 0, words * sizeof(uint64_t));
+	createMem();
+}
+BitVec::BitVec(int dimension, bool value) : BitVec(dimension) {
+	if(!value) return;
+	for(int i = 0; i < d; i++) {
+		data[i / 64] |= (uint64_t)1 << i % 64;
+	}
+}
+BitVec::BitVec(Veci vec) : BitVec(vec.d) {
+	for(int i = 0; i < d; i++) {
+		if(vec.data[i] != 0) data[i / 64] |= (uint64_t)1 << i % 64;
+	}
+}
+
+// Accessors
+int BitVec::dim() const {
+	return d;
+}
+
+bool BitVec::comp(int index) const {
+	return data[index / 64] >> index % 64 & 1;
+}
+
+char *BitVec::string() const {
+	char *res = (char*)malloc(d + 5);
+	snprintf(res, 3, "< ");
+	for(int i = 0; i < d; i++) {
+		res[2 + i] = comp(i) ? '1' : '0';
+	}
+	snprintf(res + 2 + d, 3, " >");
+	return res;
+}
+
+// In-place operations
+BitVec BitVec::operator&=(BitVec mask) {
+	ensureSameBitVecDim(d, mask.d, "AND");
+	update();
+	mask.update();
+
+	FinLin::setArg(FinLin::andBits, 0, clmem);
+	FinLin::setArg(FinLin::andBits, 1, mask.clmem);
+	FinLin::execKernel(FinLin::andBits, 0, words, 0);
+	FinLin::readBuffer(clmem, 0, words * sizeof(uint64_t), data);
+
+	return *this;
+}
+BitVec BitVec::operator|=(BitVec mask) {
+	ensureSameBitVecDim(d, mask.d, "OR");
+	update();
+	mask.update();
+
+	FinLin::setArg(FinLin::orBits, 0, clmem);
+	FinLin::setArg(FinLin::orBits, 1, mask.clmem);
+	FinLin::execKernel(FinLin::orBits, 0, words, 0);
+	FinLin::readBuffer(clmem, 0, words * sizeof(uint64_t), data);
+
+	return *this;
+}
+BitVec BitVec::operator^=(BitVec mask) {
+	ensureSameBitVecDim(d, mask.d, "XOR");
+	update();
+	mask.update();
+
+	FinLin::setArg(FinLin::xorBits, 0, clmem);
+	FinLin::setArg(FinLin::xorBits, 1, mask.clmem);
+	FinLin::execKernel(FinLin::xorBits, 0, words, 0);
+	FinLin::readBuffer(clmem, 0, words * sizeof(uint64_t), data);
+
+	return *this;
+}
+
+// Binary operations
+BitVec BitVec::operator&(BitVec mask) const {
+	BitVec res = copy();
+	res &= mask;
+	return res;
+}
+BitVec BitVec::operator|(BitVec mask) const {
+	BitVec res = copy();
+	res |= mask;
+	return res;
+}
+BitVec BitVec::operator^(BitVec mask) const {
+	BitVec res = copy();
+	res ^= mask;
+	return res;
+}
+int64_t BitVec::operator*(BitVec mask) const {
+	ensureSameBitVecDim(d, mask.d, "multiply");
+	if(d == 0) return 0;
+
+	sync();
+	mask.update();
+
+	return FinLin::totall(FinLin::popcountAndPartial, clmem, mask.clmem, words);
+}
+
+// Unary operations
+int64_t BitVec::count() const {
+	if(d == 0) return 0;
+
+	sync();
+
+	return FinLin::totall(FinLin::popcountPartial, clmem, NULL, words);
+}
+BitVec BitVec::operator~() const {
+	BitVec res = copy();
+	if(d == 0) return res;
+	res.update();
+
+	uint64_t lastMask = d % 64 == 0 ? ~(uint64_t)0 : ((uint64_t)1 << d % 64) - 1;
+	FinLin::setArg(FinLin::notBits, 0, res.clmem);
+	FinLin::setArg(FinLin::notBits, 1, words);
+	FinLin::setArg(FinLin::notBits, 2, (int64_t)lastMask);
+	FinLin::execKernel(FinLin::notBits, 0, words, 0);
+	FinLin::readBuffer(res.clmem, 0, words * sizeof(uint64_t), res.data);
+
+	return res;
+}
+
+// Mutators
+bool BitVec::setComp(int index, bool value) {
+	bool prev = comp(index);
+	if(value) data[index / 64] |= (uint64_t)1 << index % 64;
+	else data[index / 64] &= ~((uint64_t)1 << index % 64);
+	dirty = true;
+	return prev;
+}
@@ -0,0 +1,273 @@
+// Copyright (c) 2021 Thomas Kaldahl
+
+#include "finlin.hpp"
+
+// Helper functions
+int convOutput(int size, int filter, int stride, int padding) {
+	if(filter < 1 || stride < 1 || padding < 0 || size + 2*padding < filter) {
+		fprintf(
+			stderr,
+			"Cannot convolve %d components with a filter of %d, "
+			"stride %d and padding %d.\n",
+			size,
+			filter,
+			stride,
+			padding
+		);
+		exit(1);
+	}
+	return (size + 2*padding - filter) / stride + 1;
+}
+void ensureSameConvDims(int h1, int w1, int h2, int w2, const char *what) {
+	if(h1 != h2 || w1 != w2) {
+		fprintf(
+			stderr,
+			"Dimension mismatch. "
+			"Cannot convolve %s of %d by %d and %d by %d.\n",
+			what,
+			h1,
+			w1,
+			h2,
+			w2
+		);
+		exit(1);
+	}
+}
+
+// Engine
+void FinLin::conv(
+	cl_mem in, int channels, int height, int width,
+	cl_mem filters, int outChannels, int kh, int kw,
+	int stride, int padY, int padX,
+	cl_mem out
+) {
+	int outH = (height + 2*padY - kh) / stride + 1;
+	int outW = (width + 2*padX - kw) / stride + 1;
+
+	// Tiles of 8 by 8 outputs, or a single row of them for signals
+	int tileH = outH == 1 ? 1 : 8;
+	int tileW = GROUP_SIZE / tileH;
+	int patch = ((tileH - 1)*stride + kh) * ((tileW - 1)*stride + kw);
+
+	if(kh*kw <= convCrossover && patch <= CONV_PATCH) {
+		int tiles = (outH + tileH - 1) / tileH * ((outW + tileW - 1) / tileW);
+		FinLin::setArg(FinLin::convDirect, 0, in);
+		FinLin::setArg(FinLin::convDirect, 1, filters);
+		FinLin::setArg(FinLin::convDirect, 2, out);
+		FinLin::setArg(FinLin::convDirect, 3, channels);
+		FinLin::setArg(FinLin::convDirect, 4, height);
+		FinLin::setArg(FinLin::convDirect, 5, width);
+		FinLin::setArg(FinLin::convDirect, 6, kh);
+		FinLin::setArg(FinLin::convDirect, 7, kw);
+		FinLin::setArg(FinLin::convDirect, 8, stride);
+		FinLin::setArg(FinLin::convDirect, 9, padY);
+		FinLin::setArg(FinLin::convDirect, 10, padX);
+		FinLin::setArg(FinLin::convDirect, 11, outH);
+		FinLin::setArg(FinLin::convDirect, 12, outW);
+		FinLin::setArg(FinLin::convDirect, 13, tileH);
+		FinLin::setArg(FinLin::convDirect, 14, tileW);
+		FinLin::execKernel(
+			FinLin::convDirect,
+			0,
+			outChannels * tiles * GROUP_SIZE,
+			GROUP_SIZE
+		);
+		return;
+	}
+
+	// Large filters are multiplied by the matrix of windows instead, where
+	// the GEMM kernel reuses each loaded component across many outputs
+	int depth = channels * kh*kw;
+	cl_mem cols = createBuffer((size_t)depth * outH*outW * sizeof(double));
+	FinLin::setArg(FinLin::im2col, 0, in);
+	FinLin::setArg(FinLin::im2col, 1, cols);
+	FinLin::setArg(FinLin::im2col, 2, height);
+	FinLin::setArg(FinLin::im2col, 3, width);
+	FinLin::setArg(FinLin::im2col, 4, kh);
+	FinLin::setArg(FinLin::im2col, 5, kw);
+	FinLin::setArg(FinLin::im2col, 6, stride);
+	FinLin::setArg(FinLin::im2col, 7, padY);
+	FinLin::setArg(FinLin::im2col, 8, padX);
+	FinLin::setArg(FinLin::im2col, 9, outW);
+	FinLin::execKernel(FinLin::im2col, 0, outH*outW, depth, 0);
+
+	gemm(
+		outChannels,
+		outH*outW,
+		depth,
+		1,
+		filters, 0, depth, false,
+		cols, 0, outH*outW, false,
+		0,
+		out, 0, outH*outW
+	);
+
+	clReleaseMemObject(cols);
+}
+void FinLin::setConvCrossover(int area) {
+	convCrossover = area;
+}
+
+// Vector convolution
+Vec Vec::conv1d(Vec filter, int stride, int padding) const {
+	int len = convOutput(d, filter.d, stride, padding);
+
+	sync();
+	filter.update();
+
+	Vec res = Vec(len);
+	FinLin::conv(
+		mem(), 1, 1, d,
+		filter.mem(), 1, 1, filter.d,
+		stride, 0, padding,
+		res.mem()
+	);
+	FinLin::readBuffer(res.mem(), 0, len * sizeof(double), res.data);
+	res.dirty = false;
+
+	return res;
+}
+
+// Matrix convolution
+Mat Mat::conv1d(int filterCount, const Mat *filters, int stride, int padding)
+	const {
+	if(filterCount < 1) {
+		fprintf(stderr, "Cannot convolve with no filters.\n");
+		exit(1);
+	}
+	int kw = filters[0].w;
+	int len = convOutput(w, kw, stride, padding);
+
+	sync();
+
+	// Filters side by side in one buffer, each h by kw
+	cl_mem packed = FinLin::createBuffer(filterCount * h*kw * sizeof(double));
+	for(int o = 0; o < filterCount; o++) {
+		ensureSameConvDims(h, kw, filters[o].h, filters[o].w, "filters");
+		filters[o].sync();
+		FinLin::copyBuffer(
+			filters[o].mem(),
+			packed,
+			0,
+			o * h*kw * sizeof(double),
+			h*kw * sizeof(double)
+		);
+	}
+
+	Mat res = Mat(filterCount, len);
+	FinLin::conv(
+		mem(), h, 1, w,
+		packed, filterCount, 1, kw,
+		stride, 0, padding,
+		res.mem()
+	);
+	FinLin::readBuffer(
+		res.mem(),
+		0,
+		filterCount*len * sizeof(double),
+		res.data
+	);
+	res.dirty = false;
+
+	clReleaseMemObject(packed);
+
+	return res;
+}
+Mat Mat::conv2d(Mat filter, int stride, int padding) const {
+	int outH = convOutput(h, filter.h, stride, padding);
+	int outW = convOutput(w, filter.w, stride, padding);
+
+	sync();
+	filter.update();
+
+	Mat res = Mat(outH, outW);
+	FinLin::conv(
+		mem(), 1, h, w,
+		filter.mem(), 1, filter.h, filter.w,
+		stride, padding, padding,
+		res.mem()
+	);
+	FinLin::readBuffer(res.mem(), 0, outH*outW * sizeof(double), res.data);
+	res.dirty = false;
+
+	return res;
+}
+Mat *Mat::conv2d(
+	int channels,
+	const Mat *in,
+	int filterCount,
+	const Mat *filters,
+	int stride,
+	int padding
+) {
+	if(channels < 1 || filterCount < 1) {
+		fprintf(stderr, "Cannot convolve with no channels or no filters.\n");
+		exit(1);
+	}
+	int h = in[0].h;
+	int w = in[0].w;
+	int kh = filters[0].h;
+	int kw = filters[0].w;
+	int outH = convOutput(h, kh, stride, padding);
+	int outW = convOutput(w, kw, stride, padding);
+
+	// Channels and filters each in one buffer
+	cl_mem images = FinLin::createBuffer(channels * h*w * sizeof(double));
+	for(int c = 0; c < channels; c++) {
+		ensureSameConvDims(h, w, in[c].h, in[c].w, "images");
+		in[c].sync();
+		FinLin::copyBuffer(
+			in[c].mem(),
+			images,
+			0,
+			c * h*w * sizeof(double),
+			h*w * sizeof(double)
+		);
+	}
+	int count = filterCount * channels;
+	cl_mem packed = FinLin::createBuffer(count * kh*kw * sizeof(double));
+	for(int f = 0; f < count; f++) {
+		ensureSameConvDims(kh, kw, filters[f].h, filters[f].w, "filters");
+		filters[f].sync();
+		FinLin::copyBuffer(
+			filters[f].mem(),
+			packed,
+			0,
+			f * kh*kw * sizeof(double),
+			kh*kw * sizeof(double)
+		);
+	}
+	cl_mem out = FinLin::createBuffer(filterCount * outH*outW * sizeof(double));
+
+	FinLin::conv(
+		images, channels, h, w,
+		packed, filterCount, kh, kw,
+		stride, padding, padding,
+		out
+	);
+
+	Mat *res = (Mat*)malloc(filterCount * sizeof(Mat));
+	for(int o = 0; o < filterCount; o++) {
+		res[o] = Mat(outH, outW);
+		FinLin::copyBuffer(
+			out,
+			res[o].mem(),
+			o * outH*outW * sizeof(double),
+			0,
+			outH*outW * sizeof(double)
+		);
+		FinLin::readBuffer(
+			res[o].mem(),
+			0,
+			outH*outW * sizeof(double),
+			res[o].data
+		);
+		res[o].dirty = false;
+	}
+
+	clReleaseMemObject(images);
+	clReleaseMemObject(packed);
+	clReleaseMemObject(out);
+
+	return res;
+}
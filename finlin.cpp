@@ -1,6 +1,10 @@
 // Copyright (c) 2021 Thomas Kaldahl
 
 #include "finlin.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
 
 const char *FinLin::SRC = R"(
 // DOUBLE KERNELS
@@ -45,6 +49,70 @@ __kernel void dsigmoid(__global double *arr) {
 	int i = get_global_id(0);
 	arr[i] = pown(1.0 + fabs(2.0 * arr[i]), -2);
 }
+__kernel void relu(__global double *arr, const double slope) {
+	int i = get_global_id(0);
+	if(arr[i] < 0) arr[i] *= slope;
+}
+__kernel void tanhActivation(__global double *arr) {
+	int i = get_global_id(0);
+	arr[i] = tanh(arr[i]);
+}
+__kernel void gelu(__global double *arr) {
+	int i = get_global_id(0);
+	arr[i] = 0.5 * arr[i] * (1.0 + erf(arr[i] * M_SQRT1_2));
+}
+__kernel void logistic(__global double *arr) {
+	int i = get_global_id(0);
+	arr[i] = 1.0 / (1.0 + exp(-arr[i]));
+}
+
+// One work group of GROUP_SIZE per row. The maximum is subtracted before
+// exponentiating, so that nothing overflows.
+__kernel void softmaxRows(
+	__global double *matrix,
+	const int width,
+	const int logarithm
+) {
+	__local double shared[GROUP_SIZE];
+	int l = get_local_id(0);
+	__global double *row = matrix + get_group_id(0) * width;
+
+	double max = -INFINITY;
+	for(int c = l; c < width; c += GROUP_SIZE) {
+		max = fmax(max, row[c]);
+	}
+	shared[l] = max;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int half = GROUP_SIZE / 2; half > 0; half /= 2) {
+		if(l < half) shared[l] = fmax(shared[l], shared[l + half]);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	max = shared[0];
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	double sum = 0;
+	for(int c = l; c < width; c += GROUP_SIZE) {
+		sum += exp(row[c] - max);
+	}
+	shared[l] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int half = GROUP_SIZE / 2; half > 0; half /= 2) {
+		if(l < half) shared[l] += shared[l + half];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	sum = shared[0];
+
+	if(logarithm) {
+		double logSum = max + log(sum);
+		for(int c = l; c < width; c += GROUP_SIZE) {
+			row[c] -= logSum;
+		}
+	} else {
+		for(int c = l; c < width; c += GROUP_SIZE) {
+			row[c] = exp(row[c] - max) / sum;
+		}
+	}
+}
 
 __kernel void matVec(
 	__global const double *matrix,
@@ -85,8 +153,965 @@ __kernel void compNot(__global double *vector) {
 	else vector[i] = 0.0;
 }
 
+__kernel void matMulGeneral(
+	__global const double *a,
+	__global const double *b,
+	__global double *c,
+	const int offA,
+	const int lda,
+	const int transA,
+	const int offB,
+	const int ldb,
+	const int transB,
+	const int offC,
+	const int ldc,
+	const int depth,
+	const double alpha,
+	const double beta
+) {
+	int r = get_global_id(0);
+	int col = get_global_id(1);
+
+	double sum = 0;
+	for(int i = 0; i < depth; i++) {
+		double x = transA ? a[offA + i*lda + r] : a[offA + r*lda + i];
+		double y = transB ? b[offB + col*ldb + i] : b[offB + i*ldb + col];
+		sum += x * y;
+	}
+
+	int idx = offC + r*ldc + col;
+	if(beta == 0.0) c[idx] = alpha * sum;
+	else c[idx] = alpha * sum + beta * c[idx];
+}
+
+// Run as a single work group. Turns column col of a, from the diagonal down,
+// into (beta, 0, ..., 0), storing the reflector (1, v) in column col of v.
+__kernel void householder(
+	__global double *a,
+	__global double *v,
+	__global double *tau,
+	const int lda,
+	const int ldv,
+	const int height,
+	const int col
+) {
+	__local double partial[GROUP_SIZE];
+	int l = get_local_id(0);
+
+	double sqrSum = 0;
+	for(int i = col + 1 + l; i < height; i += GROUP_SIZE) {
+		sqrSum += a[i*lda + col] * a[i*lda + col];
+	}
+	partial[l] = sqrSum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int len = GROUP_SIZE / 2; len > 0; len /= 2) {
+		if(l < len) partial[l] += partial[l + len];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	double alpha = a[col*lda + col];
+	double beta = alpha;
+	double coeff = 0;
+	double scalar = 0;
+	if(partial[0] != 0) {
+		beta = -copysign(hypot(alpha, sqrt(partial[0])), alpha);
+		coeff = (beta - alpha) / beta;
+		scalar = 1.0 / (alpha - beta);
+	}
+	barrier(CLK_GLOBAL_MEM_FENCE);
+
+	for(int i = l; i < height; i += GROUP_SIZE) {
+		if(i < col) {
+			v[i*ldv + col] = 0;
+		} else if(i == col) {
+			v[i*ldv + col] = 1;
+			a[i*lda + col] = beta;
+			tau[col] = coeff;
+		} else {
+			v[i*ldv + col] = scalar * a[i*lda + col];
+			a[i*lda + col] = 0;
+		}
+	}
+}
+
+__kernel void applyHouseholder(
+	__global double *a,
+	__global const double *v,
+	__global const double *tau,
+	const int lda,
+	const int ldv,
+	const int height,
+	const int col
+) {
+	int c = get_global_id(0);
+
+	double dot = 0;
+	for(int i = col; i < height; i++) {
+		dot += v[i*ldv + col] * a[i*lda + c];
+	}
+	dot *= tau[col];
+	for(int i = col; i < height; i++) {
+		a[i*lda + c] -= dot * v[i*ldv + col];
+	}
+}
+
+// Run as a single work item. The size by size block of t at row holds V^T V
+// for the panel's reflectors and is replaced with the upper triangular T
+// such that H_1 H_2 ... H_size = I - V T V^T.
+__kernel void householderT(
+	__global double *t,
+	__global const double *tau,
+	const int ldt,
+	const int row,
+	const int size
+) {
+	__global double *blk = t + row*ldt;
+	for(int i = 0; i < size; i++) {
+		double coeff = tau[row + i];
+		for(int s = 0; s < i; s++) {
+			blk[i*ldt + s] *= -coeff;
+		}
+		for(int r = 0; r < i; r++) {
+			double sum = 0;
+			for(int s = r; s < i; s++) {
+				sum += blk[r*ldt + s] * blk[i*ldt + s];
+			}
+			blk[r*ldt + i] = sum;
+		}
+		for(int s = 0; s < i; s++) {
+			blk[i*ldt + s] = 0;
+		}
+		blk[i*ldt + i] = coeff;
+	}
+}
+
+// Solves op(T) x = b in place for every column of b, where T is the size by
+// size triangle at offA, with ones on its diagonal if unit. Element (i, c) of
+// b is at offB + i*rowStride + c*colStride, so rows of a matrix can be solved
+// for as well.
+__kernel void triSolve(
+	__global const double *a,
+	__global double *b,
+	const int offA,
+	const int lda,
+	const int offB,
+	const int rowStride,
+	const int colStride,
+	const int size,
+	const int upper,
+	const int trans,
+	const int unit
+) {
+	int c = get_global_id(0);
+	int forward = upper == trans;
+
+	__global double *x = b + offB + c*colStride;
+	for(int n = 0; n < size; n++) {
+		int i = forward ? n : size - 1 - n;
+		int lo = forward ? 0 : i + 1;
+		int hi = forward ? i : size;
+
+		double sum = x[i*rowStride];
+		for(int j = lo; j < hi; j++) {
+			double t = trans ? a[offA + j*lda + i] : a[offA + i*lda + j];
+			sum -= t * x[j*rowStride];
+		}
+		x[i*rowStride] = unit ? sum : sum / a[offA + i*lda + i];
+	}
+}
+
+// Run as a single work group. Factors the size by size diagonal block at row
+// of the n by n matrix a into its lower Cholesky factor and zeroes the rest of
+// the block's rows right of the diagonal. Records the first bad pivot, plus
+// one, in status.
+__kernel void choleskyBlock(
+	__global double *a,
+	__global int *status,
+	const int n,
+	const int row,
+	const int size
+) {
+	__local double diag;
+	int l = get_local_id(0);
+
+	__global double *blk = a + row*n + row;
+	for(int j = 0; j < size; j++) {
+		if(l == 0) {
+			double d = blk[j*n + j];
+			for(int k = 0; k < j; k++) {
+				d -= blk[j*n + k] * blk[j*n + k];
+			}
+			if(!(d > 0)) {
+				if(status[0] == 0) status[0] = row + j + 1;
+				d = 1;
+			}
+			diag = sqrt(d);
+			blk[j*n + j] = diag;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+
+		for(int i = j + 1 + l; i < size; i += GROUP_SIZE) {
+			double x = blk[i*n + j];
+			for(int k = 0; k < j; k++) {
+				x -= blk[i*n + k] * blk[j*n + k];
+			}
+			blk[i*n + j] = x / diag;
+		}
+		barrier(CLK_GLOBAL_MEM_FENCE);
+	}
+
+	for(int i = 0; i < size; i++) {
+		for(int c = row + i + 1 + l; c < n; c += GROUP_SIZE) {
+			a[(row + i)*n + c] = 0;
+		}
+	}
+}
+
+__kernel void dotPartial(
+	__global const double *a,
+	__global const double *b,
+	__global double *partial,
+	const int len
+) {
+	__local double sums[GROUP_SIZE];
+	int l = get_local_id(0);
+
+	double sum = 0;
+	for(int i = get_global_id(0); i < len; i += get_global_size(0)) {
+		sum += a[i] * b[i];
+	}
+	sums[l] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int half = GROUP_SIZE / 2; half > 0; half /= 2) {
+		if(l < half) sums[l] += sums[l + half];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if(l == 0) partial[get_group_id(0)] = sums[0];
+}
+
+__kernel void sumPartial(
+	__global const double *a,
+	__global double *partial,
+	const int len
+) {
+	__local double sums[GROUP_SIZE];
+	int l = get_local_id(0);
+
+	double sum = 0;
+	for(int i = get_global_id(0); i < len; i += get_global_size(0)) {
+		sum += a[i];
+	}
+	sums[l] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int half = GROUP_SIZE / 2; half > 0; half /= 2) {
+		if(l < half) sums[l] += sums[l + half];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if(l == 0) partial[get_group_id(0)] = sums[0];
+}
+
+// Run as a single work group over the GROUP_SIZE sums from dotPartial
+__kernel void dotFinish(
+	__global const double *partial,
+	__global double *out,
+	const int index,
+	const int root
+) {
+	__local double sums[GROUP_SIZE];
+	int l = get_local_id(0);
+
+	sums[l] = partial[l];
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int half = GROUP_SIZE / 2; half > 0; half /= 2) {
+		if(l < half) sums[l] += sums[l + half];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if(l == 0) out[index] = root ? sqrt(sums[0]) : sums[0];
+}
+
+// Iterative solvers keep their scalars in a small GPU array s, so that the
+// coefficients below never have to be read back to the host.
+__kernel void axpyRatio(
+	__global double *y,
+	__global const double *x,
+	__global const double *s,
+	const int num,
+	const int den,
+	const double sign
+) {
+	int i = get_global_id(0);
+	double coeff = s[den] == 0.0 ? 0.0 : sign * s[num] / s[den];
+	y[i] += coeff * x[i];
+}
+
+__kernel void xpayRatio(
+	__global double *y,
+	__global const double *x,
+	__global const double *s,
+	const int num,
+	const int den
+) {
+	int i = get_global_id(0);
+	double coeff = s[den] == 0.0 ? 0.0 : s[num] / s[den];
+	y[i] = x[i] + coeff * y[i];
+}
+
+__kernel void hadamardOut(
+	__global double *prod,
+	__global const double *multiplicand,
+	__global const double *multiplier
+) {
+	int i = get_global_id(0);
+	prod[i] = multiplicand[i] * multiplier[i];
+}
+
+__kernel void invDiagonal(
+	__global const double *matrix,
+	__global double *diag,
+	const int size
+) {
+	int i = get_global_id(0);
+	double d = matrix[i*size + i];
+	diag[i] = d == 0.0 ? 1.0 : 1.0 / d;
+}
+
+__kernel void divideBySlot(
+	__global double *quot,
+	__global const double *dividend,
+	__global const double *s,
+	const int slot,
+	const int offQuot
+) {
+	int i = get_global_id(0);
+	quot[offQuot + i] = s[slot] == 0.0 ? 0.0 : dividend[i] / s[slot];
+}
+
+// BiCGSTAB scalars: s = {rho, rhoNew, alpha, omega, rhat.v, t.s, t.t}
+__kernel void bicgstabDirection(
+	__global double *p,
+	__global const double *r,
+	__global const double *v,
+	__global const double *s
+) {
+	int i = get_global_id(0);
+	double beta = 0;
+	if(s[0] != 0.0 && s[3] != 0.0) beta = s[1] / s[0] * (s[2] / s[3]);
+	p[i] = r[i] + beta * (p[i] - s[3] * v[i]);
+}
+
+__kernel void bicgstabHalf(
+	__global double *half,
+	__global const double *r,
+	__global const double *v,
+	__global double *s
+) {
+	int i = get_global_id(0);
+	double alpha = s[4] == 0.0 ? 0.0 : s[1] / s[4];
+	half[i] = r[i] - alpha * v[i];
+	if(i == 0) s[2] = alpha;
+}
+
+__kernel void bicgstabUpdate(
+	__global double *x,
+	__global double *r,
+	__global const double *phat,
+	__global const double *shat,
+	__global const double *half,
+	__global const double *t,
+	__global double *s
+) {
+	int i = get_global_id(0);
+	double omega = s[6] == 0.0 ? 0.0 : s[5] / s[6];
+	x[i] += s[2] * phat[i] + omega * shat[i];
+	r[i] = half[i] - omega * t[i];
+	if(i == 0) {
+		s[3] = omega;
+		s[0] = s[1];
+	}
+}
+
+// Run as a single work item. Applies the previous Givens rotations to column
+// col of the column-major Hessenberg matrix h, then the rotation that zeroes
+// its subdiagonal, also to the residual vector g.
+__kernel void gmresGivens(
+	__global double *h,
+	__global double *rot,
+	__global double *g,
+	__global int *breakdown,
+	const int col,
+	const int ldh
+) {
+	__global double *hc = h + col*ldh;
+
+	// A vanishing subdiagonal means the subspace contains the solution.
+	// The first column where it happens, plus one, is kept for the host.
+	double norm = 0;
+	for(int i = 0; i <= col + 1; i++) norm += hc[i] * hc[i];
+	if(col == 0) *breakdown = 0;
+	if(*breakdown == 0 && fabs(hc[col + 1]) <= DBL_EPSILON * sqrt(norm)) {
+		*breakdown = col + 1;
+	}
+
+	for(int i = 0; i < col; i++) {
+		double a = hc[i];
+		double b = hc[i + 1];
+		hc[i] = rot[2*i] * a + rot[2*i + 1] * b;
+		hc[i + 1] = -rot[2*i + 1] * a + rot[2*i] * b;
+	}
+
+	double a = hc[col];
+	double b = hc[col + 1];
+	double r = hypot(a, b);
+	double c = r == 0.0 ? 1.0 : a / r;
+	double sn = r == 0.0 ? 0.0 : b / r;
+	rot[2*col] = c;
+	rot[2*col + 1] = sn;
+	hc[col] = r;
+	hc[col + 1] = 0;
+	g[col + 1] = -sn * g[col];
+	g[col] = c * g[col];
+}
+
+// Philox4x32-10 counter-based generator. Replaces the four words of ctr with
+// random bits, a pure function of the counter and the key.
+void philox(uint *ctr, uint key0, uint key1) {
+	for(int round = 0; round < 10; round++) {
+		uint hi0 = mul_hi(0xD2511F53u, ctr[0]);
+		uint lo0 = 0xD2511F53u * ctr[0];
+		uint hi1 = mul_hi(0xCD9E8D57u, ctr[2]);
+		uint lo1 = 0xCD9E8D57u * ctr[2];
+		ctr[0] = hi1 ^ ctr[1] ^ key0;
+		ctr[1] = lo1;
+		ctr[2] = hi0 ^ ctr[3] ^ key1;
+		ctr[3] = lo0;
+		key0 += 0x9E3779B9u;
+		key1 += 0xBB67AE85u;
+	}
+}
+
+// Counter of work item i, from a 64-bit block offset and a stream
+void philoxBlock(
+	uint *ctr,
+	int i,
+	uint offLo,
+	uint offHi,
+	uint stream,
+	uint key0,
+	uint key1
+) {
+	ulong block = ((ulong)offHi << 32 | offLo) + i;
+	ctr[0] = (uint)block;
+	ctr[1] = (uint)(block >> 32);
+	ctr[2] = stream;
+	ctr[3] = 0;
+	philox(ctr, key0, key1);
+}
+
+// Uniform double in [0, 1) from 64 random bits, keeping 53
+double bitsToUnit(uint hi, uint lo) {
+	return (((ulong)hi << 21) ^ (lo >> 11)) * 0x1.0p-53;
+}
+
+// Each work item fills two components
+__kernel void randomUniform(
+	__global double *out,
+	const int len,
+	const uint key0,
+	const uint key1,
+	const uint offLo,
+	const uint offHi,
+	const uint stream,
+	const double min,
+	const double max
+) {
+	int i = get_global_id(0);
+	uint ctr[4];
+	philoxBlock(ctr, i, offLo, offHi, stream, key0, key1);
+	out[2*i] = min + (max - min) * bitsToUnit(ctr[0], ctr[1]);
+	if(2*i + 1 < len) {
+		out[2*i + 1] = min + (max - min) * bitsToUnit(ctr[2], ctr[3]);
+	}
+}
+
+// Box-Muller transform, two normal components per work item
+__kernel void randomNormal(
+	__global double *out,
+	const int len,
+	const uint key0,
+	const uint key1,
+	const uint offLo,
+	const uint offHi,
+	const uint stream,
+	const double mean,
+	const double stddev
+) {
+	int i = get_global_id(0);
+	uint ctr[4];
+	philoxBlock(ctr, i, offLo, offHi, stream, key0, key1);
+	double radius = sqrt(-2.0 * log(1.0 - bitsToUnit(ctr[0], ctr[1])));
+	double angle = 2.0 * M_PI * bitsToUnit(ctr[2], ctr[3]);
+	out[2*i] = mean + stddev * radius * cos(angle);
+	if(2*i + 1 < len) {
+		out[2*i + 1] = mean + stddev * radius * sin(angle);
+	}
+}
+
+// matrix += alpha * u v^T, 2D over the components of matrix
+__kernel void ger(
+	__global double *matrix,
+	__global const double *u,
+	__global const double *v,
+	const double alpha
+) {
+	int r = get_global_id(0);
+	int c = get_global_id(1);
+	int w = get_global_size(1);
+	matrix[r*w + c] += alpha * u[r] * v[c];
+}
+
+// matrix += a a^T for n by n matrix and n by depth a. One work item per
+// component of the lower triangle, numbered row by row, which is mirrored to
+// the upper triangle.
+__kernel void syrkUpdate(
+	__global double *matrix,
+	__global const double *a,
+	const int n,
+	const int depth
+) {
+	int k = get_global_id(0);
+	int r = (int)((sqrt(8.0 * k + 1) - 1) / 2);
+	while(r * (r + 1) / 2 > k) r--;
+	while((r + 1) * (r + 2) / 2 <= k) r++;
+	int c = k - r * (r + 1) / 2;
+
+	double sum = 0;
+	for(int i = 0; i < depth; i++) {
+		sum += a[r*depth + i] * a[c*depth + i];
+	}
+	matrix[r*n + c] += sum;
+	if(r != c) matrix[c*n + r] += sum;
+}
+
+// Kronecker product of a and b, 2D over the components of out
+__kernel void kron(
+	__global const double *a,
+	__global const double *b,
+	__global double *out,
+	const int aWidth,
+	const int bHeight,
+	const int bWidth
+) {
+	int r = get_global_id(0);
+	int c = get_global_id(1);
+	int w = get_global_size(1);
+
+	double x = a[r / bHeight * aWidth + c / bWidth];
+	out[r*w + c] = x * b[r % bHeight * bWidth + c % bWidth];
+}
+
+// One step of Gauss-Jordan elimination with partial pivoting, from src to
+// dst. Each group handles one column; every group finds the same pivot.
+__kernel void rrefStep(
+	__global const double *src,
+	__global double *dst,
+	__global int *pivots,
+	const int height,
+	const int width,
+	const int col,
+	const double tolerance
+) {
+	__local double best[GROUP_SIZE];
+	__local int bestRow[GROUP_SIZE];
+	int l = get_local_id(0);
+	int c = get_group_id(0);
+
+	// Rows above this one already hold pivots
+	int row = 0;
+	for(int i = 0; i < col; i++) {
+		if(pivots[i] >= 0) row++;
+	}
+
+	double max = -1;
+	int q = height;
+	for(int r = row + l; r < height; r += GROUP_SIZE) {
+		double x = fabs(src[r*width + col]);
+		if(x > max) {
+			max = x;
+			q = r;
+		}
+	}
+	best[l] = max;
+	bestRow[l] = q;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int half = GROUP_SIZE / 2; half > 0; half /= 2) {
+		if(l < half && (
+			best[l + half] > best[l] ||
+			(best[l + half] == best[l] && bestRow[l + half] < bestRow[l])
+		)) {
+			best[l] = best[l + half];
+			bestRow[l] = bestRow[l + half];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	bool found = best[0] > tolerance;
+	q = bestRow[0];
+	if(c == 0 && l == 0) pivots[col] = found ? row : -1;
+
+	for(int r = l; r < height; r += GROUP_SIZE) {
+		double x;
+		if(!found) {
+			// What remains of the column is rounding error
+			x = c == col && r >= row ? 0 : src[r*width + c];
+		} else if(r == row) {
+			x = c == col ? 1 : src[q*width + c] / src[q*width + col];
+		} else if(c == col) {
+			x = 0;
+		} else {
+			int s = r == q ? row : r; // Rows row and q are swapped
+			double factor = src[s*width + col] / src[q*width + col];
+			x = src[s*width + c] - factor * src[q*width + c];
+		}
+		dst[r*width + c] = x;
+	}
+}
+
+// Multiply or divide each row of a matrix by a component of diag, 2D
+__kernel void scaleRows(
+	__global double *matrix,
+	__global const double *diag,
+	const int divide
+) {
+	int r = get_global_id(0);
+	int c = get_global_id(1);
+	int w = get_global_size(1);
+
+	if(divide) matrix[r*w + c] /= diag[r];
+	else matrix[r*w + c] *= diag[r];
+}
+
+// Multiply each column of a matrix by a component of diag, 2D
+__kernel void scaleCols(
+	__global double *matrix,
+	__global const double *diag
+) {
+	int r = get_global_id(0);
+	int c = get_global_id(1);
+	int w = get_global_size(1);
+
+	matrix[r*w + c] *= diag[c];
+}
+
+__kernel void addDiagonal(
+	__global double *matrix,
+	__global const double *diag,
+	const int ld
+) {
+	int i = get_global_id(0);
+	matrix[i*ld + i] += diag[i];
+}
+
+__kernel void shiftDiagonal(
+	__global double *matrix,
+	const int ld,
+	const double x
+) {
+	int i = get_global_id(0);
+	matrix[i*ld + i] += x;
+}
+
+// Product of a and b where one is triangular, 2D over out. The sum skips
+// the zero triangle: shape 1 and 2 are a lower and upper, 3 and 4 are b.
+__kernel void triMul(
+	__global const double *a,
+	__global const double *b,
+	__global double *out,
+	const int depth,
+	const int shape
+) {
+	int r = get_global_id(0);
+	int c = get_global_id(1);
+	int w = get_global_size(1);
+
+	int first = 0;
+	int last = depth;
+	if(shape == 1) last = r + 1;
+	if(shape == 2) first = r;
+	if(shape == 3) first = c;
+	if(shape == 4) last = c + 1;
+
+	double sum = 0;
+	for(int k = first; k < last; k++) {
+		sum += a[r*depth + k] * b[k*w + c];
+	}
+	out[r*w + c] = sum;
+}
+
+// Lower triangle of a square matrix, row by row, 2D
+__kernel void packSym(
+	__global const double *matrix,
+	__global double *packed
+) {
+	int r = get_global_id(0);
+	int c = get_global_id(1);
+	int n = get_global_size(1);
+
+	if(c <= r) packed[r*(r + 1)/2 + c] = matrix[r*n + c];
+}
+
+// Component of a symmetric matrix from its packed lower triangle
+double symComp(__global const double *packed, int r, int c) {
+	return c <= r ? packed[r*(r + 1)/2 + c] : packed[c*(c + 1)/2 + r];
+}
+
+// Square matrix from a packed lower triangle, mirrored, or added to it, 2D
+__kernel void unpackSym(
+	__global const double *packed,
+	__global double *matrix,
+	const int add
+) {
+	int r = get_global_id(0);
+	int c = get_global_id(1);
+	int n = get_global_size(1);
+
+	double x = symComp(packed, r, c);
+	if(add) matrix[r*n + c] += x;
+	else matrix[r*n + c] = x;
+}
+
+// Product of a packed symmetric n by n matrix s with b, as s b, or b s when
+// right is set, 2D over out
+__kernel void symMul(
+	__global const double *packed,
+	__global const double *b,
+	__global double *out,
+	const int n,
+	const int right
+) {
+	int r = get_global_id(0);
+	int c = get_global_id(1);
+	int w = get_global_size(1);
+
+	double sum = 0;
+	if(right) {
+		for(int k = 0; k < n; k++) {
+			sum += b[r*n + k] * symComp(packed, k, c);
+		}
+	} else {
+		for(int k = 0; k < n; k++) {
+			sum += symComp(packed, r, k) * b[k*w + c];
+		}
+	}
+	out[r*w + c] = sum;
+}
+
+__kernel void fillDiagonal(
+	__global double *matrix,
+	const int off,
+	const int ld,
+	const double x
+) {
+	int i = get_global_id(0);
+	matrix[off + i*ld + i] = x;
+}
+
+__kernel void gather(
+	__global double *out,
+	__global const double *in,
+	__global const int *index
+) {
+	int i = get_global_id(0);
+	out[i] = in[index[i]];
+}
+
+__kernel void toDouble(__global double *out, __global const float *in) {
+	int i = get_global_id(0);
+	out[i] = in[i];
+}
+
+// Lays out every filter-sized window of the channels of in as a column of
+// cols, so that convolution becomes a matrix multiplication. 2D over
+// (output position, channel * kh * kw).
+__kernel void im2col(
+	__global const double *in,
+	__global double *cols,
+	const int height,
+	const int width,
+	const int kh,
+	const int kw,
+	const int stride,
+	const int padY,
+	const int padX,
+	const int outW
+) {
+	int p = get_global_id(0);
+	int n = get_global_size(0);
+	int k = get_global_id(1);
+
+	int c = k / (kh * kw);
+	int y = p / outW * stride + k / kw % kh - padY;
+	int x = p % outW * stride + k % kw - padX;
+	bool inside = y >= 0 && y < height && x >= 0 && x < width;
+	cols[k*n + p] = inside ? in[(c*height + y)*width + x] : 0;
+}
+
+// Each work group of GROUP_SIZE computes a tileH by tileW tile of one output
+// channel, staging the input under the tile in local memory one channel at a
+// time. The patch must fit in CONV_PATCH doubles.
+__kernel void convDirect(
+	__global const double *in,
+	__global const double *filters,
+	__global double *out,
+	const int channels,
+	const int height,
+	const int width,
+	const int kh,
+	const int kw,
+	const int stride,
+	const int padY,
+	const int padX,
+	const int outH,
+	const int outW,
+	const int tileH,
+	const int tileW
+) {
+	__local double patch[CONV_PATCH];
+	int l = get_local_id(0);
+	int g = get_group_id(0);
+	int tilesX = (outW + tileW - 1) / tileW;
+	int tilesY = (outH + tileH - 1) / tileH;
+	int tx = g % tilesX;
+	int ty = g / tilesX % tilesY;
+	int o = g / (tilesX * tilesY);
+	int lx = l % tileW;
+	int ly = l / tileW;
+
+	int patchW = (tileW - 1) * stride + kw;
+	int patchH = (tileH - 1) * stride + kh;
+	int x0 = tx * tileW * stride - padX;
+	int y0 = ty * tileH * stride - padY;
+
+	double sum = 0;
+	for(int c = 0; c < channels; c++) {
+		for(int i = l; i < patchH * patchW; i += GROUP_SIZE) {
+			int y = y0 + i / patchW;
+			int x = x0 + i % patchW;
+			bool inside = y >= 0 && y < height && x >= 0 && x < width;
+			patch[i] = inside ? in[(c*height + y)*width + x] : 0;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		__global const double *filter = filters + (o*channels + c) * kh*kw;
+		for(int fy = 0; fy < kh; fy++) {
+			for(int fx = 0; fx < kw; fx++) {
+				sum += filter[fy*kw + fx]
+					* patch[(ly*stride + fy)*patchW + lx*stride + fx];
+			}
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	int ox = tx * tileW + lx;
+	int oy = ty * tileH + ly;
+	if(ox < outW && oy < outH) out[(o*outH + oy)*outW + ox] = sum;
+}
+
+// SINGLE KERNELS
+
+__kernel void toSingle(__global float *out, __global const double *in) {
+	int i = get_global_id(0);
+	out[i] = (float)in[i];
+}
+
+// Run as a single work group, before eliminating column k of the n by n
+// matrix a. Swaps the row with the largest entry in the column into row k,
+// and the same entries of perm. Records k + 1 in status if the column is zero
+// or not finite.
+__kernel void luPivot(
+	__global float *a,
+	__global int *perm,
+	__global int *status,
+	const int n,
+	const int k
+) {
+	__local float best[GROUP_SIZE];
+	__local int at[GROUP_SIZE];
+	int l = get_local_id(0);
+
+	float max = -1;
+	int p = k;
+	for(int i = k + l; i < n; i += GROUP_SIZE) {
+		float x = fabs(a[i*n + k]);
+		if(x > max) {
+			max = x;
+			p = i;
+		}
+	}
+	best[l] = max;
+	at[l] = p;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int half = GROUP_SIZE / 2; half > 0; half /= 2) {
+		if(l < half && best[l + half] > best[l]) {
+			best[l] = best[l + half];
+			at[l] = at[l + half];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	p = at[0];
+	if(l == 0) {
+		if(!(best[0] > 0 && best[0] < INFINITY) && status[0] == 0) {
+			status[0] = k + 1;
+		}
+		int t = perm[k];
+		perm[k] = perm[p];
+		perm[p] = t;
+	}
+	if(p == k) return;
+	for(int c = l; c < n; c += GROUP_SIZE) {
+		float t = a[k*n + c];
+		a[k*n + c] = a[p*n + c];
+		a[p*n + c] = t;
+	}
+}
+
+// Subtracts multiples of pivot row k from the rows below it, right of column
+// k. Run over the trailing n - k - 1 by n - k - 1 block, before luScale.
+__kernel void luEliminate(__global float *a, const int n, const int k) {
+	int i = k + 1 + get_global_id(0);
+	int j = k + 1 + get_global_id(1);
+	a[i*n + j] -= a[i*n + k] / a[k*n + k] * a[k*n + j];
+}
+__kernel void luScale(__global float *a, const int n, const int k) {
+	int i = k + 1 + get_global_id(0);
+	a[i*n + k] /= a[k*n + k];
+}
+
 // INTEGER KERNELS
 
+// Uniform integers in [min, min + range), each from 64 random bits, so the
+// bias is below range / 2^64. Each work item fills two components.
+__kernel void randomInt(
+	__global int *out,
+	const int len,
+	const uint key0,
+	const uint key1,
+	const uint offLo,
+	const uint offHi,
+	const uint stream,
+	const int min,
+	const uint range
+) {
+	int i = get_global_id(0);
+	uint ctr[4];
+	philoxBlock(ctr, i, offLo, offHi, stream, key0, key1);
+	ulong bits0 = (ulong)ctr[0] << 32 | ctr[1];
+	ulong bits1 = (ulong)ctr[2] << 32 | ctr[3];
+	out[2*i] = min + (int)mul_hi(bits0, (ulong)range);
+	if(2*i + 1 < len) {
+		out[2*i + 1] = min + (int)mul_hi(bits1, (ulong)range);
+	}
+}
+
 __kernel void scalei(__global int *vector, const int scalar) {
 	int i = get_global_id(0);
 	vector[i] *= scalar;
@@ -161,10 +1186,429 @@ __kernel void matMuli(
 	}
 }
 
-__kernel void compNoti(__global int *vector) {
-	int i = get_global_id(0);
-	if(vector[i] == 0) vector[i] = 1;
-	else vector[i] = 0;
+__kernel void compNoti(__global int *vector) {
+	int i = get_global_id(0);
+	if(vector[i] == 0) vector[i] = 1;
+	else vector[i] = 0;
+}
+
+// Per work group sums of a or of a . b, accumulated in 64 bits so that they
+// cannot overflow
+__kernel void sumPartiali(
+	__global const int *a,
+	__global long *partial,
+	const int len
+) {
+	__local long sums[GROUP_SIZE];
+	int l = get_local_id(0);
+
+	long sum = 0;
+	for(int i = get_global_id(0); i < len; i += get_global_size(0)) {
+		sum += a[i];
+	}
+	sums[l] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int half = GROUP_SIZE / 2; half > 0; half /= 2) {
+		if(l < half) sums[l] += sums[l + half];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if(l == 0) partial[get_group_id(0)] = sums[0];
+}
+__kernel void dotPartiali(
+	__global const int *a,
+	__global const int *b,
+	__global long *partial,
+	const int len
+) {
+	__local long sums[GROUP_SIZE];
+	int l = get_local_id(0);
+
+	long sum = 0;
+	for(int i = get_global_id(0); i < len; i += get_global_size(0)) {
+		sum += (long)a[i] * b[i];
+	}
+	sums[l] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int half = GROUP_SIZE / 2; half > 0; half /= 2) {
+		if(l < half) sums[l] += sums[l + half];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if(l == 0) partial[get_group_id(0)] = sums[0];
+}
+
+// LONG KERNELS
+
+// Uniform 64-bit integers in [min, min + range), one from each 64 random
+// bits. Each work item fills two components.
+__kernel void randomLong(
+	__global long *out,
+	const int len,
+	const uint key0,
+	const uint key1,
+	const uint offLo,
+	const uint offHi,
+	const uint stream,
+	const long min,
+	const ulong range
+) {
+	int i = get_global_id(0);
+	uint ctr[4];
+	philoxBlock(ctr, i, offLo, offHi, stream, key0, key1);
+	ulong bits0 = (ulong)ctr[0] << 32 | ctr[1];
+	ulong bits1 = (ulong)ctr[2] << 32 | ctr[3];
+	out[2*i] = min + (long)mul_hi(bits0, range);
+	if(2*i + 1 < len) {
+		out[2*i + 1] = min + (long)mul_hi(bits1, range);
+	}
+}
+
+__kernel void scalel(__global long *vector, const long scalar) {
+	int i = get_global_id(0);
+	vector[i] *= scalar;
+}
+__kernel void dividel(__global long *vector, const long divisor) {
+	int i = get_global_id(0);
+	vector[i] /= divisor;
+}
+__kernel void modulol(__global long *vector, const long modulus) {
+	int i = get_global_id(0);
+	vector[i] %= modulus;
+}
+
+__kernel void addl(__global long *augend, __global const long *addend) {
+	int i = get_global_id(0);
+	augend[i] += addend[i];
+}
+
+__kernel void addScaledl(
+	__global long *augend,
+	__global const long *addend,
+	const long coeff
+) {
+	int i = get_global_id(0);
+	augend[i] += coeff * addend[i];
+}
+
+__kernel void hadamardl(
+	__global long *multiplicand,
+	__global const long *multiplier
+) {
+	int i = get_global_id(0);
+	multiplicand[i] *= multiplier[i];
+}
+
+__kernel void matVecl(
+	__global const long *matrix,
+	__global const long *vector,
+	__global long *prod,
+	const int depth
+) {
+	int r = get_global_id(0);
+
+	long sum = 0;
+	for(int i = 0; i < depth; i++) {
+		sum += matrix[r*depth + i] * vector[i];
+	}
+	prod[r] = sum;
+}
+
+__kernel void matMull(
+	__global const long *mplcnd,
+	__global const long *mplier,
+	__global long *prod,
+	const int depth
+) {
+	int r = get_global_id(0);
+	int c = get_global_id(1);
+	int w = get_global_size(1);
+
+	long sum = 0;
+	for(int i = 0; i < depth; i++) {
+		sum += mplcnd[r*depth + i] * mplier[c + i*w];
+	}
+	prod[r*w + c] = sum;
+}
+
+__kernel void compNotl(__global long *vector) {
+	int i = get_global_id(0);
+	if(vector[i] == 0) vector[i] = 1;
+	else vector[i] = 0;
+}
+
+__kernel void sumPartiall(
+	__global const long *a,
+	__global long *partial,
+	const int len
+) {
+	__local long sums[GROUP_SIZE];
+	int l = get_local_id(0);
+
+	long sum = 0;
+	for(int i = get_global_id(0); i < len; i += get_global_size(0)) {
+		sum += a[i];
+	}
+	sums[l] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int half = GROUP_SIZE / 2; half > 0; half /= 2) {
+		if(l < half) sums[l] += sums[l + half];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if(l == 0) partial[get_group_id(0)] = sums[0];
+}
+__kernel void dotPartiall(
+	__global const long *a,
+	__global const long *b,
+	__global long *partial,
+	const int len
+) {
+	__local long sums[GROUP_SIZE];
+	int l = get_local_id(0);
+
+	long sum = 0;
+	for(int i = get_global_id(0); i < len; i += get_global_size(0)) {
+		sum += a[i] * b[i];
+	}
+	sums[l] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int half = GROUP_SIZE / 2; half > 0; half /= 2) {
+		if(l < half) sums[l] += sums[l + half];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if(l == 0) partial[get_group_id(0)] = sums[0];
+}
+
+// QUANTIZED KERNELS
+
+// Matrices of 8-bit codes have rows padded with zeros to ld, a multiple of 4,
+// so that they can be read as char4. Code q of row r stands for
+// scale[r] * (q - zero[r]).
+
+__kernel void quantize8(
+	__global const double *in,
+	__global char *out,
+	__global const double *scale,
+	__global const int *zero,
+	const int width,
+	const int ld
+) {
+	int r = get_global_id(0);
+	int c = get_global_id(1);
+
+	if(c >= width) {
+		out[r*ld + c] = 0;
+		return;
+	}
+	int q = (int)round(in[r*width + c] / scale[r]) + zero[r];
+	out[r*ld + c] = (char)clamp(q, -128, 127);
+}
+
+__kernel void dequantize8(
+	__global const char *in,
+	__global double *out,
+	__global const double *scale,
+	__global const int *zero,
+	const int ld
+) {
+	int r = get_global_id(0);
+	int c = get_global_id(1);
+	int w = get_global_size(1);
+
+	out[r*w + c] = scale[r] * (in[r*ld + c] - zero[r]);
+}
+
+// Transposes the height by width codes b into rows of ldOut codes
+__kernel void packColumns8(
+	__global const char *b,
+	__global char *bt,
+	const int height,
+	const int ld,
+	const int ldOut
+) {
+	int c = get_global_id(0);
+	int k = get_global_id(1);
+
+	bt[c*ldOut + k] = k < height ? b[k*ld + c] : 0;
+}
+
+// Product of the codes a and the transposed codes bt, four at a time,
+// accumulated in 32 bits. The zero points are taken out of the sum with the
+// row and column sums, and the scales are applied once at the end. The right
+// factor has a single scale and zero point.
+__kernel void matMul8(
+	__global const char4 *a,
+	__global const char4 *bt,
+	__global double *prod,
+	__global const double *scaleA,
+	__global const int *zeroA,
+	__global const double *scaleB,
+	__global const int *zeroB,
+	const int depth,
+	const int ld
+) {
+	int r = get_global_id(0);
+	int c = get_global_id(1);
+	int w = get_global_size(1);
+	int quads = ld / 4;
+
+	int4 acc = 0;
+	int4 sumA = 0;
+	int4 sumB = 0;
+	for(int k = 0; k < quads; k++) {
+		int4 x = convert_int4(a[r*quads + k]);
+		int4 y = convert_int4(bt[c*quads + k]);
+		acc += x * y;
+		sumA += x;
+		sumB += y;
+	}
+	int dot = acc.x + acc.y + acc.z + acc.w;
+	int za = zeroA[r];
+	int zb = zeroB[0];
+	dot -= zb * (sumA.x + sumA.y + sumA.z + sumA.w);
+	dot -= za * (sumB.x + sumB.y + sumB.z + sumB.w);
+	dot += depth * za * zb;
+	prod[r*w + c] = scaleA[r] * scaleB[0] * dot;
+}
+
+// BIT KERNELS
+
+// Bits are packed 64 to a word, least significant first. Rows of a matrix
+// start on a new word, and the bits past the end of a row are kept zero.
+
+__kernel void andBits(__global ulong *a, __global const ulong *b) {
+	int i = get_global_id(0);
+	a[i] &= b[i];
+}
+__kernel void orBits(__global ulong *a, __global const ulong *b) {
+	int i = get_global_id(0);
+	a[i] |= b[i];
+}
+__kernel void xorBits(__global ulong *a, __global const ulong *b) {
+	int i = get_global_id(0);
+	a[i] ^= b[i];
+}
+// lastMask has the bits of the last word of each row that are in use
+__kernel void notBits(
+	__global ulong *a,
+	const int rowWords,
+	const ulong lastMask
+) {
+	int i = get_global_id(0);
+	a[i] = ~a[i];
+	if(i % rowWords == rowWords - 1) a[i] &= lastMask;
+}
+
+// Per work group counts of the set bits of a, or of a & b
+__kernel void popcountPartial(
+	__global const ulong *a,
+	__global long *partial,
+	const int len
+) {
+	__local long sums[GROUP_SIZE];
+	int l = get_local_id(0);
+
+	long sum = 0;
+	for(int i = get_global_id(0); i < len; i += get_global_size(0)) {
+		sum += popcount(a[i]);
+	}
+	sums[l] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int half = GROUP_SIZE / 2; half > 0; half /= 2) {
+		if(l < half) sums[l] += sums[l + half];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if(l == 0) partial[get_group_id(0)] = sums[0];
+}
+__kernel void popcountAndPartial(
+	__global const ulong *a,
+	__global const ulong *b,
+	__global long *partial,
+	const int len
+) {
+	__local long sums[GROUP_SIZE];
+	int l = get_local_id(0);
+
+	long sum = 0;
+	for(int i = get_global_id(0); i < len; i += get_global_size(0)) {
+		sum += popcount(a[i] & b[i]);
+	}
+	sums[l] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int half = GROUP_SIZE / 2; half > 0; half /= 2) {
+		if(l < half) sums[l] += sums[l + half];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if(l == 0) partial[get_group_id(0)] = sums[0];
+}
+
+// Transposes the height by width bit matrix in. Each work item builds one
+// word of the output, from 64 rows of one column of in.
+__kernel void bitTranspose(
+	__global const ulong *in,
+	__global ulong *out,
+	const int height,
+	const int width
+) {
+	int c = get_global_id(0);
+	int word = get_global_id(1);
+	int inWords = (width + 63) / 64;
+	int outWords = get_global_size(1);
+
+	ulong bits = 0;
+	for(int t = 0; t < 64 && 64*word + t < height; t++) {
+		ulong x = in[(64*word + t)*inWords + c/64];
+		bits |= (x >> (c % 64) & 1) << t;
+	}
+	out[c*outWords + word] = bits;
+}
+
+// Boolean product: bit (r, c) is set if row r of a and row c of bt, the
+// transpose of the right factor, share a set bit. Each work item builds one
+// word of the product.
+__kernel void bitMatMul(
+	__global const ulong *a,
+	__global const ulong *bt,
+	__global ulong *prod,
+	const int depthWords,
+	const int width
+) {
+	int r = get_global_id(0);
+	int word = get_global_id(1);
+	int prodWords = get_global_size(1);
+
+	ulong bits = 0;
+	for(int t = 0; t < 64 && 64*word + t < width; t++) {
+		int c = 64*word + t;
+		for(int k = 0; k < depthWords; k++) {
+			if(a[r*depthWords + k] & bt[c*depthWords + k]) {
+				bits |= (ulong)1 << t;
+				break;
+			}
+		}
+	}
+	prod[r*prodWords + word] = bits;
+}
+
+// Boolean matrix and vector product, one word of the result per work item
+__kernel void bitMatVec(
+	__global const ulong *matrix,
+	__global const ulong *vector,
+	__global ulong *prod,
+	const int depthWords,
+	const int height
+) {
+	int word = get_global_id(0);
+
+	ulong bits = 0;
+	for(int t = 0; t < 64 && 64*word + t < height; t++) {
+		int r = 64*word + t;
+		for(int k = 0; k < depthWords; k++) {
+			if(matrix[r*depthWords + k] & vector[k]) {
+				bits |= (ulong)1 << t;
+				break;
+			}
+		}
+	}
+	prod[word] = bits;
 }
 
 )";
@@ -177,6 +1621,8 @@ cl_uint *FinLin::platformCount;
 cl_uint *FinLin::deviceCount; int FinLin::platformID; int FinLin::deviceID;
 cl_context FinLin::context;
 cl_command_queue FinLin::commandQueue;
+cl_command_queue FinLin::transferQueue;
+cl_command_queue FinLin::downloadQueue;
 cl_program FinLin::program;
 
 cl_kernel FinLin::reduce;
@@ -186,9 +1632,56 @@ cl_kernel FinLin::addScaled;
 cl_kernel FinLin::hadamard;
 cl_kernel FinLin::sigmoid;
 cl_kernel FinLin::dsigmoid;
+cl_kernel FinLin::relu;
+cl_kernel FinLin::tanhActivation;
+cl_kernel FinLin::gelu;
+cl_kernel FinLin::logistic;
+cl_kernel FinLin::softmaxRows;
 cl_kernel FinLin::matMul;
 cl_kernel FinLin::matVec;
 cl_kernel FinLin::compNot;
+cl_kernel FinLin::matMulGeneral;
+cl_kernel FinLin::householder;
+cl_kernel FinLin::applyHouseholder;
+cl_kernel FinLin::householderT;
+cl_kernel FinLin::triSolve;
+cl_kernel FinLin::choleskyBlock;
+cl_kernel FinLin::dotPartial;
+cl_kernel FinLin::dotFinish;
+cl_kernel FinLin::sumPartial;
+cl_kernel FinLin::axpyRatio;
+cl_kernel FinLin::xpayRatio;
+cl_kernel FinLin::hadamardOut;
+cl_kernel FinLin::invDiagonal;
+cl_kernel FinLin::divideBySlot;
+cl_kernel FinLin::bicgstabDirection;
+cl_kernel FinLin::bicgstabHalf;
+cl_kernel FinLin::bicgstabUpdate;
+cl_kernel FinLin::gmresGivens;
+cl_kernel FinLin::ger;
+cl_kernel FinLin::syrkUpdate;
+cl_kernel FinLin::kron;
+cl_kernel FinLin::rrefStep;
+cl_kernel FinLin::scaleRows;
+cl_kernel FinLin::scaleCols;
+cl_kernel FinLin::addDiagonal;
+cl_kernel FinLin::shiftDiagonal;
+cl_kernel FinLin::triMul;
+cl_kernel FinLin::packSym;
+cl_kernel FinLin::unpackSym;
+cl_kernel FinLin::symMul;
+cl_kernel FinLin::fillDiagonal;
+cl_kernel FinLin::randomUniform;
+cl_kernel FinLin::randomNormal;
+cl_kernel FinLin::gather;
+cl_kernel FinLin::im2col;
+cl_kernel FinLin::convDirect;
+cl_kernel FinLin::toDouble;
+
+cl_kernel FinLin::toSingle;
+cl_kernel FinLin::luPivot;
+cl_kernel FinLin::luEliminate;
+cl_kernel FinLin::luScale;
 
 cl_kernel FinLin::reducei;
 cl_kernel FinLin::scalei;
@@ -200,9 +1693,62 @@ cl_kernel FinLin::hadamardi;
 cl_kernel FinLin::matMuli;
 cl_kernel FinLin::matVeci;
 cl_kernel FinLin::compNoti;
+cl_kernel FinLin::randomInt;
+cl_kernel FinLin::sumPartiali;
+cl_kernel FinLin::dotPartiali;
+
+cl_kernel FinLin::randomLong;
+cl_kernel FinLin::scalel;
+cl_kernel FinLin::dividel;
+cl_kernel FinLin::modulol;
+cl_kernel FinLin::addl;
+cl_kernel FinLin::addScaledl;
+cl_kernel FinLin::hadamardl;
+cl_kernel FinLin::matVecl;
+cl_kernel FinLin::matMull;
+cl_kernel FinLin::compNotl;
+cl_kernel FinLin::sumPartiall;
+cl_kernel FinLin::dotPartiall;
+
+cl_kernel FinLin::quantize8;
+cl_kernel FinLin::dequantize8;
+cl_kernel FinLin::packColumns8;
+cl_kernel FinLin::matMul8;
+
+cl_kernel FinLin::andBits;
+cl_kernel FinLin::orBits;
+cl_kernel FinLin::xorBits;
+cl_kernel FinLin::notBits;
+cl_kernel FinLin::popcountPartial;
+cl_kernel FinLin::popcountAndPartial;
+cl_kernel FinLin::bitTranspose;
+cl_kernel FinLin::bitMatMul;
+cl_kernel FinLin::bitMatVec;
 
 double *res;
 cl_mem memRes;
+cl_mem FinLin::memPartial;
+
+bool FinLin::hugePages = true;
+cl_mem FinLin::memStage;
+char *FinLin::stage;
+
+FinLin::Graph *FinLin::capturing = NULL;
+
+double FinLin::launchLatency = 0;
+double FinLin::transferRate = INFINITY;
+double FinLin::hostRate = 0;
+int FinLin::dispatch = DISPATCH_AUTO;
+
+FinLin::UserKernel *FinLin::userKernels = NULL;
+int FinLin::numUserKernels = 0;
+
+int FinLin::convCrossover = 25;
+char *FinLin::cacheDir = NULL;
+
+unsigned long long FinLin::rngKey = 0;
+unsigned int FinLin::rngStream = 0;
+unsigned long long FinLin::rngOffset = 0;
 
 void FinLin::checkErr() {
 	if(err != 0) {
@@ -333,6 +1879,20 @@ void FinLin::init(int platformID, int deviceID) {
 		&err
 	);
 	checkErr();
+	transferQueue = clCreateCommandQueueWithProperties(
+		context,
+		devices[deviceID],
+		NULL,
+		&err
+	);
+	checkErr();
+	downloadQueue = clCreateCommandQueueWithProperties(
+		context,
+		devices[deviceID],
+		NULL,
+		&err
+	);
+	checkErr();
 
 	program = clCreateProgramWithSource(
 		context,
@@ -343,7 +1903,15 @@ void FinLin::init(int platformID, int deviceID) {
 	);
 	checkErr();
 
-	err = clBuildProgram(program, 1, devices + deviceID, NULL, NULL, NULL);
+	char options[64];
+	snprintf(
+		options,
+		sizeof(options),
+		"-D GROUP_SIZE=%d -D CONV_PATCH=%d",
+		GROUP_SIZE,
+		CONV_PATCH
+	);
+	err = clBuildProgram(program, 1, devices + deviceID, options, NULL, NULL);
 	checkErr();
 
 	scale = clCreateKernel(program, "scale", &err); checkErr();
@@ -353,9 +1921,60 @@ void FinLin::init(int platformID, int deviceID) {
 	reduce = clCreateKernel(program, "reduce", &err); checkErr();
 	sigmoid = clCreateKernel(program, "sigmoid", &err); checkErr();
 	dsigmoid = clCreateKernel(program, "dsigmoid", &err); checkErr();
+	relu = clCreateKernel(program, "relu", &err); checkErr();
+	tanhActivation =
+		clCreateKernel(program, "tanhActivation", &err); checkErr();
+	gelu = clCreateKernel(program, "gelu", &err); checkErr();
+	logistic = clCreateKernel(program, "logistic", &err); checkErr();
+	softmaxRows = clCreateKernel(program, "softmaxRows", &err); checkErr();
 	matVec = clCreateKernel(program, "matVec", &err); checkErr();
 	matMul = clCreateKernel(program, "matMul", &err); checkErr();
 	compNot = clCreateKernel(program, "compNot", &err); checkErr();
+	matMulGeneral = clCreateKernel(program, "matMulGeneral", &err); checkErr();
+	householder = clCreateKernel(program, "householder", &err); checkErr();
+	applyHouseholder =
+		clCreateKernel(program, "applyHouseholder", &err); checkErr();
+	householderT = clCreateKernel(program, "householderT", &err); checkErr();
+	triSolve = clCreateKernel(program, "triSolve", &err); checkErr();
+	choleskyBlock = clCreateKernel(program, "choleskyBlock", &err); checkErr();
+	dotPartial = clCreateKernel(program, "dotPartial", &err); checkErr();
+	dotFinish = clCreateKernel(program, "dotFinish", &err); checkErr();
+	sumPartial = clCreateKernel(program, "sumPartial", &err); checkErr();
+	axpyRatio = clCreateKernel(program, "axpyRatio", &err); checkErr();
+	xpayRatio = clCreateKernel(program, "xpayRatio", &err); checkErr();
+	hadamardOut = clCreateKernel(program, "hadamardOut", &err); checkErr();
+	invDiagonal = clCreateKernel(program, "invDiagonal", &err); checkErr();
+	divideBySlot = clCreateKernel(program, "divideBySlot", &err); checkErr();
+	bicgstabDirection =
+		clCreateKernel(program, "bicgstabDirection", &err); checkErr();
+	bicgstabHalf = clCreateKernel(program, "bicgstabHalf", &err); checkErr();
+	bicgstabUpdate =
+		clCreateKernel(program, "bicgstabUpdate", &err); checkErr();
+	gmresGivens = clCreateKernel(program, "gmresGivens", &err); checkErr();
+	ger = clCreateKernel(program, "ger", &err); checkErr();
+	syrkUpdate = clCreateKernel(program, "syrkUpdate", &err); checkErr();
+	kron = clCreateKernel(program, "kron", &err); checkErr();
+	rrefStep = clCreateKernel(program, "rrefStep", &err); checkErr();
+	scaleRows = clCreateKernel(program, "scaleRows", &err); checkErr();
+	scaleCols = clCreateKernel(program, "scaleCols", &err); checkErr();
+	addDiagonal = clCreateKernel(program, "addDiagonal", &err); checkErr();
+	shiftDiagonal = clCreateKernel(program, "shiftDiagonal", &err); checkErr();
+	triMul = clCreateKernel(program, "triMul", &err); checkErr();
+	packSym = clCreateKernel(program, "packSym", &err); checkErr();
+	unpackSym = clCreateKernel(program, "unpackSym", &err); checkErr();
+	symMul = clCreateKernel(program, "symMul", &err); checkErr();
+	fillDiagonal = clCreateKernel(program, "fillDiagonal", &err); checkErr();
+	randomUniform = clCreateKernel(program, "randomUniform", &err); checkErr();
+	randomNormal = clCreateKernel(program, "randomNormal", &err); checkErr();
+	gather = clCreateKernel(program, "gather", &err); checkErr();
+	im2col = clCreateKernel(program, "im2col", &err); checkErr();
+	convDirect = clCreateKernel(program, "convDirect", &err); checkErr();
+	toDouble = clCreateKernel(program, "toDouble", &err); checkErr();
+
+	toSingle = clCreateKernel(program, "toSingle", &err); checkErr();
+	luPivot = clCreateKernel(program, "luPivot", &err); checkErr();
+	luEliminate = clCreateKernel(program, "luEliminate", &err); checkErr();
+	luScale = clCreateKernel(program, "luScale", &err); checkErr();
 
 	scalei = clCreateKernel(program, "scalei", &err); checkErr();
 	dividei = clCreateKernel(program, "dividei", &err); checkErr();
@@ -367,6 +1986,78 @@ void FinLin::init(int platformID, int deviceID) {
 	matVeci = clCreateKernel(program, "matVeci", &err); checkErr();
 	matMuli = clCreateKernel(program, "matMuli", &err); checkErr();
 	compNoti = clCreateKernel(program, "compNoti", &err); checkErr();
+	randomInt = clCreateKernel(program, "randomInt", &err); checkErr();
+	sumPartiali = clCreateKernel(program, "sumPartiali", &err); checkErr();
+	dotPartiali = clCreateKernel(program, "dotPartiali", &err); checkErr();
+
+	randomLong = clCreateKernel(program, "randomLong", &err); checkErr();
+	scalel = clCreateKernel(program, "scalel", &err); checkErr();
+	dividel = clCreateKernel(program, "dividel", &err); checkErr();
+	modulol = clCreateKernel(program, "modulol", &err); checkErr();
+	addl = clCreateKernel(program, "addl", &err); checkErr();
+	addScaledl = clCreateKernel(program, "addScaledl", &err); checkErr();
+	hadamardl = clCreateKernel(program, "hadamardl", &err); checkErr();
+	matVecl = clCreateKernel(program, "matVecl", &err); checkErr();
+	matMull = clCreateKernel(program, "matMull", &err); checkErr();
+	compNotl = clCreateKernel(program, "compNotl", &err); checkErr();
+	sumPartiall = clCreateKernel(program, "sumPartiall", &err); checkErr();
+	dotPartiall = clCreateKernel(program, "dotPartiall", &err); checkErr();
+
+	quantize8 = clCreateKernel(program, "quantize8", &err); checkErr();
+	dequantize8 = clCreateKernel(program, "dequantize8", &err); checkErr();
+	packColumns8 = clCreateKernel(program, "packColumns8", &err); checkErr();
+	matMul8 = clCreateKernel(program, "matMul8", &err); checkErr();
+
+	andBits = clCreateKernel(program, "andBits", &err); checkErr();
+	orBits = clCreateKernel(program, "orBits", &err); checkErr();
+	xorBits = clCreateKernel(program, "xorBits", &err); checkErr();
+	notBits = clCreateKernel(program, "notBits", &err); checkErr();
+	popcountPartial =
+		clCreateKernel(program, "popcountPartial", &err); checkErr();
+	popcountAndPartial =
+		clCreateKernel(program, "popcountAndPartial", &err); checkErr();
+	bitTranspose = clCreateKernel(program, "bitTranspose", &err); checkErr();
+	bitMatMul = clCreateKernel(program, "bitMatMul", &err); checkErr();
+	bitMatVec = clCreateKernel(program, "bitMatVec", &err); checkErr();
+
+	memPartial = createBuffer(GROUP_SIZE * sizeof(double));
+
+	memStage = clCreateBuffer(
+		context,
+		CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+		2 * STAGE_CHUNK,
+		NULL,
+		&err
+	);
+	checkErr();
+	stage = (char*)clEnqueueMapBuffer(
+		commandQueue,
+		memStage,
+		CL_TRUE,
+		CL_MAP_READ | CL_MAP_WRITE,
+		0,
+		2 * STAGE_CHUNK,
+		0,
+		NULL,
+		NULL,
+		&err
+	);
+	checkErr();
+
+	const char *dir = getenv("FINLIN_CACHE");
+	const char *home = getenv("HOME");
+	if(dir != NULL) {
+		setKernelCache(dir);
+	} else if(home != NULL) {
+		char *path = (char*)malloc(strlen(home) + sizeof("/.cache/finlin"));
+		sprintf(path, "%s/.cache", home);
+		mkdir(path, 0755); // Fails harmlessly if it exists
+		strcat(path, "/finlin");
+		setKernelCache(path);
+		free(path);
+	}
+
+	calibrate();
 }
 
 // General helper functions
@@ -378,6 +2069,9 @@ void FinLin::setArg(cl_kernel kernel, int argno, cl_mem obj) {
 		(void*)&obj
 	);
 	FinLin::checkErr();
+	if(capturing != NULL) {
+		capturing->recordArg(kernel, argno, sizeof(cl_mem), &obj, true);
+	}
 }
 void FinLin::setArg(cl_kernel kernel, int argno, double obj) {
 	FinLin::err = clSetKernelArg(
@@ -387,6 +2081,9 @@ void FinLin::setArg(cl_kernel kernel, int argno, double obj) {
 		(void*)&obj
 	);
 	FinLin::checkErr();
+	if(capturing != NULL) {
+		capturing->recordArg(kernel, argno, sizeof(double), &obj, false);
+	}
 }
 void FinLin::setArg(cl_kernel kernel, int argno, int obj) {
 	FinLin::err = clSetKernelArg(
@@ -396,20 +2093,68 @@ void FinLin::setArg(cl_kernel kernel, int argno, int obj) {
 		(void*)&obj
 	);
 	FinLin::checkErr();
+	if(capturing != NULL) {
+		capturing->recordArg(kernel, argno, sizeof(int), &obj, false);
+	}
 }
-void FinLin::writeBuffer(cl_mem buffer, size_t offset, size_t cb, const void *ptr) {
-	FinLin::err = clEnqueueWriteBuffer(
-		FinLin::commandQueue,
-		buffer,
-		CL_TRUE,
-		offset,
-		cb,
-		ptr,
-		0,
-		NULL,
-		NULL
+void FinLin::setArg(cl_kernel kernel, int argno, int64_t obj) {
+	FinLin::err = clSetKernelArg(
+		kernel,
+		argno,
+		sizeof(int64_t),
+		(void*)&obj
 	);
 	FinLin::checkErr();
+	if(capturing != NULL) {
+		capturing->recordArg(kernel, argno, sizeof(int64_t), &obj, false);
+	}
+}
+void FinLin::writeBuffer(cl_mem buffer, size_t offset, size_t cb, const void *ptr) {
+	if(cb < STAGE_MIN) {
+		FinLin::err = clEnqueueWriteBuffer(
+			FinLin::commandQueue,
+			buffer,
+			CL_TRUE,
+			offset,
+			cb,
+			ptr,
+			0,
+			NULL,
+			NULL
+		);
+		FinLin::checkErr();
+		return;
+	}
+
+	// Copy into one half of the pinned pool while the other is transferred
+	cl_event sent[2] = {NULL, NULL};
+	for(size_t done = 0; done < cb; done += STAGE_CHUNK) {
+		int half = done / STAGE_CHUNK % 2;
+		size_t len = cb - done < STAGE_CHUNK ? cb - done : STAGE_CHUNK;
+		if(sent[half] != NULL) {
+			clWaitForEvents(1, &sent[half]);
+			clReleaseEvent(sent[half]);
+		}
+		memcpy(stage + half*STAGE_CHUNK, (const char*)ptr + done, len);
+		FinLin::err = clEnqueueWriteBuffer(
+			FinLin::commandQueue,
+			buffer,
+			CL_FALSE,
+			offset + done,
+			len,
+			stage + half*STAGE_CHUNK,
+			0,
+			NULL,
+			&sent[half]
+		);
+		FinLin::checkErr();
+		clFlush(FinLin::commandQueue);
+	}
+	for(int half = 0; half < 2; half++) {
+		if(sent[half] == NULL) continue;
+		clWaitForEvents(1, &sent[half]);
+		clReleaseEvent(sent[half]);
+	}
 }
 void FinLin::execKernel(
 	cl_kernel kernel,
@@ -420,6 +2165,15 @@ void FinLin::execKernel(
 	size_t workOffset = offset;
 	size_t globalWorkSize = globalSize;
 	size_t localWorkSize = localSize;
+	if(capturing != NULL) {
+		capturing->recordLaunch(
+			kernel,
+			1,
+			&workOffset,
+			&globalWorkSize,
+			&localWorkSize
+		);
+	}
 	if(localSize == 0) {
 		FinLin::err = clEnqueueNDRangeKernel(
 			FinLin::commandQueue,
@@ -454,17 +2208,24 @@ void FinLin::execKernel(
 	size_t globalSizeY,
 	size_t localSize // 0 for NULL
 ) {
-	size_t workOffset = offset;
-	size_t *globalWorkSize = (size_t*)malloc(2 * sizeof(size_t));
-	globalWorkSize[0] = globalSizeX;
-	globalWorkSize[1] = globalSizeY;
-	size_t localWorkSize = localSize;
+	size_t workOffset[2] = {offset, 0};
+	size_t globalWorkSize[2] = {globalSizeX, globalSizeY};
+	size_t localWorkSize[2] = {localSize, localSize};
+	if(capturing != NULL) {
+		capturing->recordLaunch(
+			kernel,
+			2,
+			workOffset,
+			globalWorkSize,
+			localWorkSize
+		);
+	}
 	if(localSize == 0) {
 		FinLin::err = clEnqueueNDRangeKernel(
 			FinLin::commandQueue,
 			kernel,
 			2,
-			&workOffset,
+			workOffset,
 			globalWorkSize,
 			NULL,
 			0,
@@ -476,9 +2237,9 @@ void FinLin::execKernel(
 			FinLin::commandQueue,
 			kernel,
 			2,
-			&workOffset,
+			workOffset,
 			globalWorkSize,
-			&localWorkSize,
+			localWorkSize,
 			0,
 			NULL,
 			NULL
@@ -487,16 +2248,696 @@ void FinLin::execKernel(
 	FinLin::checkErr();
 }
 void FinLin::readBuffer(cl_mem buffer, size_t offset, size_t cb, void *ptr) {
-	FinLin::err = clEnqueueReadBuffer(
+	if(cb < STAGE_MIN) {
+		FinLin::err = clEnqueueReadBuffer(
+			FinLin::commandQueue,
+			buffer,
+			CL_TRUE,
+			offset,
+			cb,
+			ptr,
+			0,
+			NULL,
+			NULL
+		);
+		FinLin::checkErr();
+		return;
+	}
+
+	// Copy out of one half of the pinned pool while the other is filled
+	cl_event received[2];
+	size_t chunks = (cb + STAGE_CHUNK - 1) / STAGE_CHUNK;
+	for(size_t i = 0; i <= chunks; i++) {
+		if(i < chunks) {
+			size_t len = i+1 < chunks ? STAGE_CHUNK : cb - i*STAGE_CHUNK;
+			FinLin::err = clEnqueueReadBuffer(
+				FinLin::commandQueue,
+				buffer,
+				CL_FALSE,
+				offset + i*STAGE_CHUNK,
+				len,
+				stage + i%2 * STAGE_CHUNK,
+				0,
+				NULL,
+				&received[i%2]
+			);
+			FinLin::checkErr();
+			clFlush(FinLin::commandQueue);
+		}
+		if(i > 0) {
+			size_t len = i < chunks ? STAGE_CHUNK : cb - (i-1)*STAGE_CHUNK;
+			clWaitForEvents(1, &received[(i-1) % 2]);
+			clReleaseEvent(received[(i-1) % 2]);
+			memcpy(
+				(char*)ptr + (i-1)*STAGE_CHUNK,
+				stage + (i-1)%2 * STAGE_CHUNK,
+				len
+			);
+		}
+	}
+}
+cl_mem FinLin::createBuffer(size_t cb) {
+	cl_mem buffer = clCreateBuffer(
+		FinLin::context,
+		CL_MEM_READ_WRITE,
+		cb,
+		NULL,
+		&FinLin::err
+	);
+	FinLin::checkErr();
+	return buffer;
+}
+void FinLin::copyBuffer(
+	cl_mem src,
+	cl_mem dst,
+	size_t srcOffset,
+	size_t dstOffset,
+	size_t cb
+) {
+	FinLin::err = clEnqueueCopyBuffer(
+		FinLin::commandQueue,
+		src,
+		dst,
+		srcOffset,
+		dstOffset,
+		cb,
+		0,
+		NULL,
+		NULL
+	);
+	FinLin::checkErr();
+	if(capturing != NULL) {
+		capturing->recordCopy(src, dst, srcOffset, dstOffset, cb);
+	}
+}
+void FinLin::copyRect(
+	cl_mem src,
+	cl_mem dst,
+	size_t srcOffset,
+	size_t srcPitch,
+	size_t dstOffset,
+	size_t dstPitch,
+	size_t cb,
+	size_t rows
+) {
+	size_t srcOrigin[3] = {srcOffset, 0, 0};
+	size_t dstOrigin[3] = {dstOffset, 0, 0};
+	size_t region[3] = {cb, rows, 1};
+	FinLin::err = clEnqueueCopyBufferRect(
+		FinLin::commandQueue,
+		src,
+		dst,
+		srcOrigin,
+		dstOrigin,
+		region,
+		srcPitch,
+		0,
+		dstPitch,
+		0,
+		0,
+		NULL,
+		NULL
+	);
+	FinLin::checkErr();
+	if(capturing != NULL) {
+		capturing->recordCopyRect(
+			src,
+			dst,
+			srcOffset,
+			srcPitch,
+			dstOffset,
+			dstPitch,
+			cb,
+			rows
+		);
+	}
+}
+void FinLin::zeroBuffer(cl_mem buffer, size_t cb) {
+	double zero = 0;
+	FinLin::err = clEnqueueFillBuffer(
 		FinLin::commandQueue,
 		buffer,
-		CL_TRUE,
-		offset,
+		&zero,
+		sizeof(double),
+		0,
 		cb,
-		ptr,
 		0,
 		NULL,
 		NULL
 	);
 	FinLin::checkErr();
+	if(capturing != NULL) capturing->recordFill(buffer, cb);
+}
+void FinLin::dot(
+	cl_mem a,
+	cl_mem b,
+	int len,
+	cl_mem out,
+	int index,
+	bool root
+) {
+	FinLin::setArg(FinLin::dotPartial, 0, a);
+	FinLin::setArg(FinLin::dotPartial, 1, b);
+	FinLin::setArg(FinLin::dotPartial, 2, FinLin::memPartial);
+	FinLin::setArg(FinLin::dotPartial, 3, len);
+	FinLin::execKernel(
+		FinLin::dotPartial,
+		0,
+		FinLin::GROUP_SIZE * FinLin::GROUP_SIZE,
+		FinLin::GROUP_SIZE
+	);
+
+	FinLin::setArg(FinLin::dotFinish, 0, FinLin::memPartial);
+	FinLin::setArg(FinLin::dotFinish, 1, out);
+	FinLin::setArg(FinLin::dotFinish, 2, index);
+	FinLin::setArg(FinLin::dotFinish, 3, (int)root);
+	FinLin::execKernel(
+		FinLin::dotFinish,
+		0,
+		FinLin::GROUP_SIZE,
+		FinLin::GROUP_SIZE
+	);
+}
+double FinLin::total(cl_kernel partial, cl_mem a, cl_mem b, int len) {
+	int argno = 0;
+	FinLin::setArg(partial, argno++, a);
+	if(b != NULL) FinLin::setArg(partial, argno++, b);
+	FinLin::setArg(partial, argno++, FinLin::memPartial);
+	FinLin::setArg(partial, argno++, len);
+	FinLin::execKernel(
+		partial,
+		0,
+		FinLin::GROUP_SIZE * FinLin::GROUP_SIZE,
+		FinLin::GROUP_SIZE
+	);
+
+	double sums[GROUP_SIZE];
+	FinLin::readBuffer(FinLin::memPartial, 0, sizeof(sums), sums);
+	double sum = 0;
+	for(int i = 0; i < GROUP_SIZE; i++) {
+		sum += sums[i];
+	}
+	return sum;
+}
+int64_t FinLin::totall(cl_kernel partial, cl_mem a, cl_mem b, int len) {
+	int argno = 0;
+	FinLin::setArg(partial, argno++, a);
+	if(b != NULL) FinLin::setArg(partial, argno++, b);
+	FinLin::setArg(partial, argno++, FinLin::memPartial);
+	FinLin::setArg(partial, argno++, len);
+	FinLin::execKernel(
+		partial,
+		0,
+		FinLin::GROUP_SIZE * FinLin::GROUP_SIZE,
+		FinLin::GROUP_SIZE
+	);
+
+	int64_t sums[GROUP_SIZE];
+	FinLin::readBuffer(FinLin::memPartial, 0, sizeof(sums), sums);
+	int64_t sum = 0;
+	for(int i = 0; i < GROUP_SIZE; i++) {
+		sum += sums[i];
+	}
+	return sum;
+}
+void FinLin::gemm(
+	int height,
+	int width,
+	int depth,
+	double alpha,
+	cl_mem a, int offA, int lda, bool transA,
+	cl_mem b, int offB, int ldb, bool transB,
+	double beta,
+	cl_mem c, int offC, int ldc
+) {
+	if(height == 0 || width == 0) return;
+
+	FinLin::setArg(FinLin::matMulGeneral, 0, a);
+	FinLin::setArg(FinLin::matMulGeneral, 1, b);
+	FinLin::setArg(FinLin::matMulGeneral, 2, c);
+	FinLin::setArg(FinLin::matMulGeneral, 3, offA);
+	FinLin::setArg(FinLin::matMulGeneral, 4, lda);
+	FinLin::setArg(FinLin::matMulGeneral, 5, (int)transA);
+	FinLin::setArg(FinLin::matMulGeneral, 6, offB);
+	FinLin::setArg(FinLin::matMulGeneral, 7, ldb);
+	FinLin::setArg(FinLin::matMulGeneral, 8, (int)transB);
+	FinLin::setArg(FinLin::matMulGeneral, 9, offC);
+	FinLin::setArg(FinLin::matMulGeneral, 10, ldc);
+	FinLin::setArg(FinLin::matMulGeneral, 11, depth);
+	FinLin::setArg(FinLin::matMulGeneral, 12, alpha);
+	FinLin::setArg(FinLin::matMulGeneral, 13, beta);
+	FinLin::execKernel(FinLin::matMulGeneral, 0, height, width, 0);
+}
+void FinLin::writeTile(
+	cl_mem tile,
+	const double *host, int r0, int c0, int ld,
+	int rows, int cols,
+	cl_event wait,
+	cl_event *done
+) {
+	size_t bufferOrigin[3] = {0, 0, 0};
+	size_t hostOrigin[3] = {c0 * sizeof(double), (size_t)r0, 0};
+	size_t region[3] = {cols * sizeof(double), (size_t)rows, 1};
+	FinLin::err = clEnqueueWriteBufferRect(
+		FinLin::transferQueue,
+		tile,
+		CL_FALSE,
+		bufferOrigin,
+		hostOrigin,
+		region,
+		cols * sizeof(double),
+		0,
+		ld * sizeof(double),
+		0,
+		host,
+		wait == NULL ? 0 : 1,
+		wait == NULL ? NULL : &wait,
+		done
+	);
+	FinLin::checkErr();
+}
+void FinLin::readTile(
+	cl_mem tile,
+	double *host, int r0, int c0, int ld,
+	int rows, int cols,
+	cl_event wait,
+	cl_event *done
+) {
+	size_t bufferOrigin[3] = {0, 0, 0};
+	size_t hostOrigin[3] = {c0 * sizeof(double), (size_t)r0, 0};
+	size_t region[3] = {cols * sizeof(double), (size_t)rows, 1};
+	FinLin::err = clEnqueueReadBufferRect(
+		FinLin::downloadQueue,
+		tile,
+		CL_FALSE,
+		bufferOrigin,
+		hostOrigin,
+		region,
+		cols * sizeof(double),
+		0,
+		ld * sizeof(double),
+		0,
+		host,
+		wait == NULL ? 0 : 1,
+		wait == NULL ? NULL : &wait,
+		done
+	);
+	FinLin::checkErr();
+}
+void FinLin::gemmOutOfCore(
+	int height,
+	int width,
+	int depth,
+	const double *a,
+	const double *b,
+	double *c,
+	size_t deviceBytes
+) {
+	if(height == 0 || width == 0) return;
+	if(depth == 0) {
+		memset(c, 0, (size_t)height*width * sizeof(double));
+		return;
+	}
+
+	// Two tiles each of a, b and c, all square
+	int tile = sqrt(deviceBytes / (6 * sizeof(double)));
+	if(tile < 1) {
+		fprintf(
+			stderr,
+			"Cannot multiply matrices in %zu bytes of GPU memory.\n",
+			deviceBytes
+		);
+		exit(1);
+	}
+	int tm = tile < height ? tile : height;
+	int tn = tile < width ? tile : width;
+	int tk = tile < depth ? tile : depth;
+
+	cl_mem tileA[2];
+	cl_mem tileB[2];
+	cl_mem tileC[2];
+	for(int s = 0; s < 2; s++) {
+		tileA[s] = createBuffer(tm*tk * sizeof(double));
+		tileB[s] = createBuffer(tk*tn * sizeof(double));
+		tileC[s] = createBuffer(tm*tn * sizeof(double));
+	}
+	cl_event multiplied[2] = {NULL, NULL}; // Last use of each a and b tile
+	cl_event downloaded[2] = {NULL, NULL}; // Last download of each c tile
+
+	int step = 0;
+	int tiles = 0;
+	for(int i0 = 0; i0 < height; i0 += tm) {
+		int rows = height - i0 < tm ? height - i0 : tm;
+		for(int j0 = 0; j0 < width; j0 += tn) {
+			int cols = width - j0 < tn ? width - j0 : tn;
+			int cs = tiles % 2;
+
+			// The c tile is overwritten once its last product is downloaded
+			if(downloaded[cs] != NULL) {
+				err = clEnqueueBarrierWithWaitList(
+					commandQueue,
+					1,
+					&downloaded[cs],
+					NULL
+				);
+				checkErr();
+				clReleaseEvent(downloaded[cs]);
+				downloaded[cs] = NULL;
+			}
+
+			for(int k0 = 0; k0 < depth; k0 += tk) {
+				int inner = depth - k0 < tk ? depth - k0 : tk;
+				int s = step % 2;
+
+				// Upload the next a and b tiles while the other pair is in use
+				cl_event uploaded[2];
+				writeTile(
+					tileA[s], a, i0, k0, depth, rows, inner,
+					multiplied[s], &uploaded[0]
+				);
+				writeTile(
+					tileB[s], b, k0, j0, width, inner, cols,
+					multiplied[s], &uploaded[1]
+				);
+				clFlush(transferQueue);
+				if(multiplied[s] != NULL) clReleaseEvent(multiplied[s]);
+
+				err = clEnqueueBarrierWithWaitList(
+					commandQueue,
+					2,
+					uploaded,
+					NULL
+				);
+				checkErr();
+				clReleaseEvent(uploaded[0]);
+				clReleaseEvent(uploaded[1]);
+				gemm(
+					rows, cols, inner, 1.0,
+					tileA[s], 0, inner, false,
+					tileB[s], 0, cols, false,
+					k0 == 0 ? 0.0 : 1.0, tileC[cs], 0, cols
+				);
+				err = clEnqueueMarkerWithWaitList(
+					commandQueue,
+					0,
+					NULL,
+					&multiplied[s]
+				);
+				checkErr();
+				clFlush(commandQueue);
+				step++;
+			}
+
+			readTile(
+				tileC[cs], c, i0, j0, width, rows, cols,
+				multiplied[(step-1) % 2], &downloaded[cs]
+			);
+			clFlush(downloadQueue);
+			tiles++;
+		}
+	}
+	clFinish(commandQueue);
+	clFinish(transferQueue);
+	clFinish(downloadQueue);
+
+	for(int s = 0; s < 2; s++) {
+		if(multiplied[s] != NULL) clReleaseEvent(multiplied[s]);
+		if(downloaded[s] != NULL) clReleaseEvent(downloaded[s]);
+		clReleaseMemObject(tileA[s]);
+		clReleaseMemObject(tileB[s]);
+		clReleaseMemObject(tileC[s]);
+	}
+}
+void FinLin::seed(unsigned long long seed, unsigned int stream) {
+	rngKey = seed;
+	rngStream = stream;
+	rngOffset = 0;
+}
+void FinLin::randomArgs(cl_kernel kernel, cl_mem out, int len) {
+	FinLin::setArg(kernel, 0, out);
+	FinLin::setArg(kernel, 1, len);
+	FinLin::setArg(kernel, 2, (int)(unsigned int)rngKey);
+	FinLin::setArg(kernel, 3, (int)(unsigned int)(rngKey >> 32));
+	FinLin::setArg(kernel, 4, (int)(unsigned int)rngOffset);
+	FinLin::setArg(kernel, 5, (int)(unsigned int)(rngOffset >> 32));
+	FinLin::setArg(kernel, 6, (int)rngStream);
+	rngOffset += (len + 1) / 2;
+}
+void *FinLin::allocHost(size_t cb) {
+	size_t alignment = hugePages && cb >= HUGE_PAGE ? HUGE_PAGE : 64;
+	void *ptr;
+	if(posix_memalign(&ptr, alignment, cb == 0 ? 1 : cb) != 0) {
+		fprintf(stderr, "Cannot allocate %zu bytes of host memory.\n", cb);
+		exit(1);
+	}
+#ifdef MADV_HUGEPAGE
+	if(alignment == HUGE_PAGE) madvise(ptr, cb, MADV_HUGEPAGE);
+#endif
+	return ptr;
+}
+void FinLin::useHugePages(bool enable) {
+	hugePages = enable;
+}
+
+// Host and device dispatch
+static double monotonicSeconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+void FinLin::calibrate() {
+	size_t cb = CALIBRATION_SIZE * sizeof(double);
+	double *host = (double*)allocHost(cb);
+	for(int i = 0; i < CALIBRATION_SIZE; i++) host[i] = i;
+	cl_mem mem = createBuffer(cb);
+	writeBuffer(mem, 0, cb, host);
+
+	volatile double zero = 0; // Keeps the host loop from being optimized out
+	double scalar = zero;
+
+	launchLatency = INFINITY;
+	transferRate = 0;
+	hostRate = 0;
+	for(int rep = 0; rep < CALIBRATION_REPS; rep++) {
+		double start = monotonicSeconds();
+		setArg(scale, 0, mem);
+		setArg(scale, 1, 1.0);
+		execKernel(scale, 0, 1, 0);
+		readBuffer(mem, 0, sizeof(double), host);
+		launchLatency = fmin(launchLatency, monotonicSeconds() - start);
+
+		start = monotonicSeconds();
+		writeBuffer(mem, 0, cb, host);
+		readBuffer(mem, 0, cb, host);
+		transferRate = fmax(transferRate, 2*cb / (monotonicSeconds() - start));
+
+		start = monotonicSeconds();
+		for(int i = 0; i < CALIBRATION_SIZE; i++) {
+			host[i] += scalar * host[i];
+		}
+		double time = monotonicSeconds() - start;
+		hostRate = fmax(hostRate, CALIBRATION_SIZE / fmax(time, 1e-9));
+	}
+
+	clReleaseMemObject(mem);
+	free(host);
+}
+bool FinLin::onHost(double work, size_t transferred) {
+	if(capturing != NULL) return false;
+	if(dispatch != DISPATCH_AUTO) return dispatch == DISPATCH_HOST;
+	double device = launchLatency + transferred * sizeof(double) / transferRate;
+	return work / hostRate < device;
+}
+void FinLin::setDispatch(int mode) {
+	dispatch = mode;
+}
+
+// Expression kernels
+static const char *MAP_SRC = R"(
+__kernel void userMap(__global double *a) {
+	int i = get_global_id(0);
+	double x = a[i];
+	a[i] = (%s);
+}
+)";
+static const char *ZIP_SRC = R"(
+__kernel void userZip(__global double *a, __global const double *b) {
+	int i = get_global_id(0);
+	double x = a[i];
+	double y = b[i];
+	a[i] = (%s);
+}
+)";
+
+const uint64_t FNV_OFFSET = 0xcbf29ce484222325;
+uint64_t hashString(uint64_t hash, const char *str) { // FNV-1a
+	for(; *str; str++) {
+		hash ^= (unsigned char)*str;
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+cl_kernel FinLin::userKernel(const char *expr, bool zip) {
+	const char *format = zip ? ZIP_SRC : MAP_SRC;
+	size_t len = strlen(format) + strlen(expr);
+	char *src = (char*)malloc(len);
+	snprintf(src, len, format, expr);
+	uint64_t hash = hashString(FNV_OFFSET, src);
+
+	for(int i = 0; i < numUserKernels; i++) {
+		if(userKernels[i].hash == hash && strcmp(userKernels[i].src, src) == 0) {
+			free(src);
+			return userKernels[i].kernel;
+		}
+	}
+
+	cl_program userProgram = buildCached(src);
+	cl_kernel kernel =
+		clCreateKernel(userProgram, zip ? "userZip" : "userMap", &err);
+	checkErr();
+	clReleaseProgram(userProgram); // The kernel keeps it alive
+
+	userKernels = (UserKernel*)realloc(
+		userKernels,
+		(numUserKernels + 1) * sizeof(UserKernel)
+	);
+	userKernels[numUserKernels].hash = hash;
+	userKernels[numUserKernels].src = src;
+	userKernels[numUserKernels].kernel = kernel;
+	numUserKernels++;
+	return kernel;
+}
+cl_program FinLin::buildCached(const char *src) {
+	// Binaries only suit the device and driver that built them
+	char device[256] = "";
+	char driver[256] = "";
+	clGetDeviceInfo(
+		devices[deviceID],
+		CL_DEVICE_NAME,
+		sizeof(device),
+		device,
+		NULL
+	);
+	clGetDeviceInfo(
+		devices[deviceID],
+		CL_DRIVER_VERSION,
+		sizeof(driver),
+		driver,
+		NULL
+	);
+	uint64_t hash = hashString(FNV_OFFSET, device);
+	hash = hashString(hash, driver);
+	hash = hashString(hash, src);
+
+	char *path = NULL;
+	if(cacheDir != NULL) {
+		path = (char*)malloc(strlen(cacheDir) + sizeof("/0123456789abcdef.bin"));
+		sprintf(path, "%s/%016llx.bin", cacheDir, (unsigned long long)hash);
+
+		FILE *file = fopen(path, "rb");
+		if(file != NULL) {
+			fseek(file, 0, SEEK_END);
+			size_t size = ftell(file);
+			rewind(file);
+			unsigned char *binary = (unsigned char*)malloc(size);
+			bool complete = fread(binary, 1, size, file) == size;
+			fclose(file);
+
+			cl_int status = CL_SUCCESS;
+			cl_program cached = NULL;
+			if(complete) {
+				cached = clCreateProgramWithBinary(
+					context,
+					1,
+					devices + deviceID,
+					&size,
+					(const unsigned char**)&binary,
+					&status,
+					&err
+				);
+			}
+			free(binary);
+			if(
+				cached != NULL
+				&& err == CL_SUCCESS
+				&& status == CL_SUCCESS
+				&& clBuildProgram(cached, 1, devices + deviceID, NULL, NULL, NULL)
+					== CL_SUCCESS
+			) {
+				free(path);
+				return cached;
+			}
+			// Stale or damaged, so it is built from source and replaced
+			if(cached != NULL) clReleaseProgram(cached);
+		}
+	}
+
+	cl_program built = clCreateProgramWithSource(context, 1, &src, NULL, &err);
+	checkErr();
+	if(clBuildProgram(built, 1, devices + deviceID, NULL, NULL, NULL) != 0) {
+		size_t logLen;
+		clGetProgramBuildInfo(
+			built,
+			devices[deviceID],
+			CL_PROGRAM_BUILD_LOG,
+			0,
+			NULL,
+			&logLen
+		);
+		char *log = (char*)malloc(logLen + 1);
+		clGetProgramBuildInfo(
+			built,
+			devices[deviceID],
+			CL_PROGRAM_BUILD_LOG,
+			logLen,
+			log,
+			NULL
+		);
+		log[logLen] = 0;
+		fprintf(stderr, "Cannot build kernel:\n%s\nBuild Log:\n%s\n", src, log);
+		exit(1);
+	}
+
+	if(path != NULL) {
+		size_t size = 0;
+		clGetProgramInfo(
+			built,
+			CL_PROGRAM_BINARY_SIZES,
+			sizeof(size),
+			&size,
+			NULL
+		);
+		unsigned char *binary = (unsigned char*)malloc(size);
+		clGetProgramInfo(
+			built,
+			CL_PROGRAM_BINARIES,
+			sizeof(binary),
+			&binary,
+			NULL
+		);
+
+		// Written under another name first, so that no other process loads
+		// a partial file
+		char *part = (char*)malloc(strlen(path) + 16);
+		sprintf(part, "%s.%d", path, (int)getpid());
+		FILE *file = fopen(part, "wb");
+		if(file != NULL) {
+			bool complete = size > 0 && fwrite(binary, 1, size, file) == size;
+			fclose(file);
+			if(complete) rename(part, path);
+			else remove(part);
+		}
+		free(part);
+		free(binary);
+		free(path);
+	}
+	return built;
+}
+void FinLin::setKernelCache(const char *dir) {
+	free(cacheDir);
+	cacheDir = NULL;
+	if(dir == NULL) return;
+	cacheDir = strdup(dir);
+	mkdir(cacheDir, 0755); // Fails harmlessly if it exists
 }
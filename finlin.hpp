@@ -9,6 +9,21 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <stdint.h>
+
+class Vec;
+class Mat;
+class Veci;
+class Mati;
+class Vecl;
+class Matl;
+class BitVec;
+class BitMat;
+class Mat8;
+class ScalarMat;
+class DiagMat;
+class TriMat;
+class SymMat;
 
 class FinLin {
 	friend class Vec;
@@ -16,10 +31,23 @@ class FinLin {
 
 	friend class Veci;
 	friend class Mati;
+	friend class Vecl;
+	friend class Matl;
+	friend class BitVec;
+	friend class BitMat;
+	friend class Mat8;
+	friend class DiagMat;
+	friend class TriMat;
+	friend class SymMat;
+
+	public:
+	class Graph; // Defined below
+	private:
 
 	static void setArg(cl_kernel kernel, int argno, cl_mem obj);
 	static void setArg(cl_kernel kernel, int argno, double obj);
 	static void setArg(cl_kernel kernel, int argno, int obj);
+	static void setArg(cl_kernel kernel, int argno, int64_t obj);
 	static void writeBuffer(
 		cl_mem buffer,
 		size_t offset,
@@ -45,8 +73,75 @@ class FinLin {
 		size_t cb,
 		void *ptr
 	);
+	static cl_mem createBuffer(size_t cb);
+	static void copyBuffer(
+		cl_mem src,
+		cl_mem dst,
+		size_t srcOffset,
+		size_t dstOffset,
+		size_t cb
+	);
+	static void copyRect( // Rows of cb bytes, each pitch bytes apart
+		cl_mem src,
+		cl_mem dst,
+		size_t srcOffset,
+		size_t srcPitch,
+		size_t dstOffset,
+		size_t dstPitch,
+		size_t cb,
+		size_t rows
+	);
+	static void zeroBuffer(cl_mem buffer, size_t cb);
+	static void dot( // out[index] = a . b, or its square root, on the GPU
+		cl_mem a,
+		cl_mem b,
+		int len,
+		cl_mem out,
+		int index,
+		bool root
+	);
+	// Sum of a, or a . b if b is not NULL, by one of the partial reduction
+	// kernels over GROUP_SIZE work groups, read back to the host
+	static double total(cl_kernel partial, cl_mem a, cl_mem b, int len);
+	static int64_t totall(cl_kernel partial, cl_mem a, cl_mem b, int len);
+	static void gemm( // c = alpha * op(a) * op(b) + beta * c, offsets in doubles
+		int height,
+		int width,
+		int depth,
+		double alpha,
+		cl_mem a, int offA, int lda, bool transA,
+		cl_mem b, int offB, int ldb, bool transB,
+		double beta,
+		cl_mem c, int offC, int ldc
+	);
+	// Cross-correlation of channels height by width images in with
+	// outChannels * channels kh by kw filters, filter (o, c) at offset
+	// (o * channels + c) * kh * kw, into outChannels images in out.
+	static void conv(
+		cl_mem in, int channels, int height, int width,
+		cl_mem filters, int outChannels, int kh, int kw,
+		int stride, int padY, int padX,
+		cl_mem out
+	);
+	static int convCrossover; // Largest filter area convolved directly
+	static void writeTile( // Rows by cols block of row-major host array, ld
+		cl_mem tile,
+		const double *host, int r0, int c0, int ld,
+		int rows, int cols,
+		cl_event wait, // Or NULL
+		cl_event *done
+	);
+	static void readTile(
+		cl_mem tile,
+		double *host, int r0, int c0, int ld,
+		int rows, int cols,
+		cl_event wait,
+		cl_event *done
+	);
 
 	static const char *SRC; // Kernel source code
+	static const int GROUP_SIZE = 64; // Work group size of reduction kernels
+	static const int CONV_PATCH = 1024; // Local doubles of convDirect
 	static int err; // Error code output
 
 	static cl_platform_id *platforms;
@@ -59,6 +154,8 @@ class FinLin {
 
 	static cl_context context;
 	static cl_command_queue commandQueue;
+	static cl_command_queue transferQueue; // Lets copies overlap kernels
+	static cl_command_queue downloadQueue; // Lets downloads overlap uploads
 	static cl_program program;
 
 	// Kernels
@@ -68,10 +165,58 @@ class FinLin {
 	static cl_kernel hadamard; // Multiply two arrays element-wise
 	static cl_kernel sigmoid; // Perform fast sigmoid on each element
 	static cl_kernel dsigmoid; // Perform derivative of sigmoid on each element
+	static cl_kernel relu; // Scale negative elements, zero for plain ReLU
+	static cl_kernel tanhActivation; // Perform tanh on each element
+	static cl_kernel gelu; // Perform GELU on each element
+	static cl_kernel logistic; // Perform exact sigmoid on each element
+	static cl_kernel softmaxRows; // Softmax or log-softmax of each row
 	static cl_kernel reduce; // Halves an even-length array, preserving sum.
 	static cl_kernel matVec; // Matrix and vector multiplication
 	static cl_kernel matMul; // Matrix multiplication
 	static cl_kernel compNot; // Replace zeros with ones, non-zeros with zeros.
+	static cl_kernel matMulGeneral; // Strided, transposable, scaled matMul
+	static cl_kernel householder; // Compute reflector of a column
+	static cl_kernel applyHouseholder; // Apply reflector to later columns
+	static cl_kernel householderT; // Triangular factor of block reflector
+	static cl_kernel triSolve; // Solve triangular system in place
+	static cl_kernel choleskyBlock; // Factor diagonal block of Cholesky
+	static cl_kernel dotPartial; // Per work group sums of a dot product
+	static cl_kernel dotFinish; // Sum the partial sums of dotPartial
+	static cl_kernel sumPartial; // Per work group sums of an array
+	static cl_kernel axpyRatio; // y += ratio of GPU scalars times x
+	static cl_kernel xpayRatio; // y = x + ratio of GPU scalars times y
+	static cl_kernel hadamardOut; // Element-wise product into third array
+	static cl_kernel invDiagonal; // Reciprocals of a matrix's diagonal
+	static cl_kernel divideBySlot; // Divide array by a GPU scalar
+	static cl_kernel bicgstabDirection; // BiCGSTAB search direction update
+	static cl_kernel bicgstabHalf; // BiCGSTAB intermediate residual
+	static cl_kernel bicgstabUpdate; // BiCGSTAB solution and residual update
+	static cl_kernel gmresGivens; // Rotate a new Hessenberg column for GMRES
+	static cl_kernel ger; // Add a scaled outer product
+	static cl_kernel syrkUpdate; // Add a a^T, one triangle mirrored
+	static cl_kernel kron; // Kronecker product
+	static cl_kernel rrefStep; // One column of Gauss-Jordan elimination
+	static cl_kernel scaleRows; // Multiply or divide rows by a diagonal
+	static cl_kernel scaleCols; // Multiply columns by a diagonal
+	static cl_kernel addDiagonal; // Add an array to the diagonal of a matrix
+	static cl_kernel shiftDiagonal; // Add a scalar to the diagonal of a matrix
+	static cl_kernel triMul; // Product skipping the zero triangle of a factor
+	static cl_kernel packSym; // Lower triangle of a matrix, packed
+	static cl_kernel unpackSym; // Symmetric matrix from its packed triangle
+	static cl_kernel symMul; // Product with a packed symmetric matrix
+	static cl_kernel fillDiagonal; // Set the diagonal of a matrix to a scalar
+	static cl_kernel randomUniform; // Philox uniform doubles
+	static cl_kernel randomNormal; // Philox normal doubles
+	static cl_kernel gather; // Permute an array by an index array
+	static cl_kernel toDouble; // Widen a single precision array
+	static cl_kernel im2col; // Filter windows as columns, for convolution
+	static cl_kernel convDirect; // Convolution tiled in local memory
+
+	// Single precision kernels
+	static cl_kernel toSingle; // Narrow a double precision array
+	static cl_kernel luPivot; // Partial pivoting step of LU factorization
+	static cl_kernel luEliminate; // Eliminate below a pivot
+	static cl_kernel luScale; // Store the multipliers of a pivot
 
 	// Integer kernels
 	static cl_kernel scalei; // Scale an array
@@ -84,37 +229,281 @@ class FinLin {
 	static cl_kernel matVeci; // Matrix and vector multiplication
 	static cl_kernel matMuli; // Matrix multiplication
 	static cl_kernel compNoti; // Replace zeros with ones, non-zeros with zeros.
+	static cl_kernel randomInt; // Philox uniform integers
+	static cl_kernel sumPartiali; // Per work group sums, in 64 bits
+	static cl_kernel dotPartiali; // Per work group sums of a dot product, ''
+
+	// Long kernels
+	static cl_kernel randomLong; // Philox uniform 64-bit integers
+	static cl_kernel scalel; // Scale an array
+	static cl_kernel dividel; // Divide an array by a scalar
+	static cl_kernel modulol; // Perform modulo on integer array
+	static cl_kernel addl; // Add two arrays element-wise
+	static cl_kernel addScaledl; // Add a scalar multiple of an array to another
+	static cl_kernel hadamardl; // Multiply two arrays element-wise
+	static cl_kernel matVecl; // Matrix and vector multiplication
+	static cl_kernel matMull; // Matrix multiplication
+	static cl_kernel compNotl; // Replace zeros with ones, non-zeros with zeros.
+	static cl_kernel sumPartiall; // Per work group sums of an array
+	static cl_kernel dotPartiall; // Per work group sums of a dot product
+
+	// Quantized kernels
+	static cl_kernel quantize8; // Doubles to 8-bit codes, padded rows
+	static cl_kernel dequantize8; // 8-bit codes to doubles
+	static cl_kernel packColumns8; // Transpose 8-bit codes
+	static cl_kernel matMul8; // 8-bit matrix multiplication, 32-bit sums
+
+	// Bit kernels
+	static cl_kernel andBits; // AND two packed arrays
+	static cl_kernel orBits; // OR two packed arrays
+	static cl_kernel xorBits; // XOR two packed arrays
+	static cl_kernel notBits; // Complement, keeping padding bits zero
+	static cl_kernel popcountPartial; // Per work group counts of set bits
+	static cl_kernel popcountAndPartial; // '' of a AND b
+	static cl_kernel bitTranspose; // Transpose a bit matrix
+	static cl_kernel bitMatMul; // Boolean matrix multiplication
+	static cl_kernel bitMatVec; // Boolean matrix and vector multiplication
 
 	static void checkErr(); // Stops the program if there is an error
 
 	static double *res; // Results from kernels
 	static cl_mem memRes; // Memory object for res
+	static cl_mem memPartial; // Partial sums of reductions
+
+	static bool hugePages; // Whether large host arrays use huge pages
+	static const size_t HUGE_PAGE = 2 << 20;
+	static const size_t STAGE_CHUNK = 4 << 20; // Half of the pinned pool
+	static const size_t STAGE_MIN = 256 << 10; // Smaller transfers are direct
+	static cl_mem memStage; // Pinned pool for staging transfers
+	static char *stage; // Its persistent mapping
+
+	static Graph *capturing; // Graph being recorded, or NULL
+
+	// OpenCL memory of a vector or matrix, shared by every value that aliases
+	// it, so that whichever of them first runs on the GPU creates it for all.
+	// Copies share it too, along with the components, until one is written.
+	struct Buffer {
+		cl_mem clmem; // NULL until then
+		int refs; // Copies sharing the components, counting the original
+		bool pinned; // Graph output, overwritten by replays, so never shared
+	};
+
+	// Costs measured by init, to run small operations on the host
+	static const int CALIBRATION_SIZE = 1 << 18; // Doubles transferred
+	static const int CALIBRATION_REPS = 5; // Fastest of these is kept
+	static double launchLatency; // Seconds for a launch and a blocking read
+	static double transferRate; // Bytes per second to or from the device
+	static double hostRate; // Element-wise operations per second on the host
+	static int dispatch; // DISPATCH_AUTO, DISPATCH_HOST or DISPATCH_DEVICE
+	static void calibrate();
+	// Whether work element-wise operations on the host are faster than a
+	// launch moving transferred doubles. Never while capturing a graph.
+	static bool onHost(double work, size_t transferred);
+
+	struct UserKernel { // Built from an expression, by map or zip
+		uint64_t hash; // Of src
+		char *src;
+		cl_kernel kernel;
+	};
+	static UserKernel *userKernels; // Built so far
+	static int numUserKernels;
+	static char *cacheDir; // Where program binaries are kept, or NULL
+	static cl_kernel userKernel(const char *expr, bool zip);
+	static cl_program buildCached(const char *src); // From the disk cache if
+													// it has been built before
+
+	static unsigned long long rngKey; // Seed of the random number generator
+	static unsigned int rngStream; // Independent sequence of that seed
+	static unsigned long long rngOffset; // Philox blocks used so far
+	static void randomArgs( // Sets the first arguments of a random kernel,
+		cl_kernel kernel, // reserving the blocks it will use
+		cl_mem out,
+		int len
+	);
 
 	public:
 
+	// Records the GPU work of a block of operations, which still run as
+	// usual, so that it can be replayed with one enqueue per step. Host work
+	// is not replayed: changed inputs are uploaded with rebind, scalars read
+	// back while capturing keep their values, and only the objects named with
+	// output are read back after each replay.
+	class Graph {
+		friend class FinLin;
+
+		struct Arg { // Latest argument set on a kernel while capturing
+			cl_kernel kernel;
+			int argno;
+			size_t size;
+			char value[sizeof(double)];
+		};
+		struct Step {
+			cl_kernel kernel; // Copy of the kernel with bound arguments, or
+			cl_mem src; // NULL for a copy from src to dst, or a fill of dst
+			cl_mem dst; // if src is NULL too
+			size_t srcOffset;
+			size_t dstOffset;
+			size_t cb;
+			size_t rows; // Of cb bytes each for a rectangular copy, or 0
+			size_t srcPitch;
+			size_t dstPitch;
+			int dims;
+			size_t offset[2];
+			size_t globalSize[2];
+			size_t localSize[2]; // 0 for NULL
+		};
+		struct Output {
+			cl_mem buffer;
+			size_t cb;
+			void *data;
+		};
+
+		Arg *args;
+		int numArgs;
+		Step *steps;
+		int numSteps;
+		cl_mem *retained; // Buffers kept alive for replay
+		int numRetained;
+		Output *outputs;
+		int numOutputs;
+
+		void retain(cl_mem buffer);
+		void recordArg(
+			cl_kernel kernel,
+			int argno,
+			size_t size,
+			const void *value,
+			bool buffer
+		);
+		void recordLaunch(
+			cl_kernel kernel,
+			int dims,
+			const size_t *offset,
+			const size_t *globalSize,
+			const size_t *localSize
+		);
+		void recordCopy(
+			cl_mem src,
+			cl_mem dst,
+			size_t srcOffset,
+			size_t dstOffset,
+			size_t cb
+		);
+		void recordCopyRect(
+			cl_mem src,
+			cl_mem dst,
+			size_t srcOffset,
+			size_t srcPitch,
+			size_t dstOffset,
+			size_t dstPitch,
+			size_t cb,
+			size_t rows
+		);
+		void recordFill(cl_mem buffer, size_t cb);
+
+		public:
+
+		Graph();
+
+		void begin(); // Start capturing
+		void end(); // Stop capturing
+		void replay();
+
+		void rebind(Vec &input); // Uploads input before replay if it has
+		void rebind(Mat &input); // changed since it was last uploaded.
+		void rebind(Veci &input);
+		void rebind(Mati &input);
+		void rebind(Vecl &input);
+		void rebind(Matl &input);
+		void output(Vec &result); // Read back after each replay
+		void output(Mat &result);
+		void output(Veci &result);
+		void output(Mati &result);
+		void output(Vecl &result);
+		void output(Matl &result);
+
+		void clear(); // Release everything recorded
+	};
+
 	static void init(int platform, int device); // Sets up all the OpenCL stuff.
 												// Must be called before
 												// creating any objects.
+
+	// Host memory for components, 64-byte aligned, and on transparent huge
+	// pages when large unless disabled. Released with free.
+	static void *allocHost(size_t cb);
+	static void useHugePages(bool enable);
+
+	// Convolutions with filters of at most area components are computed
+	// directly, larger ones as a matrix multiplication. Defaults to 25.
+	static void setConvCrossover(int area);
+
+	// Operations with a host path choose it when cheaper, by their size and
+	// whether their operands are already on the device, using the launch
+	// latency and transfer rate measured by init. Either path can be forced.
+	static const int DISPATCH_AUTO = 0;
+	static const int DISPATCH_HOST = 1;
+	static const int DISPATCH_DEVICE = 2;
+	static void setDispatch(int mode);
+
+	// Kernels built from the expressions given to map and zip are kept on
+	// disk, so that later runs load them rather than compiling them again.
+	// The directory defaults to $FINLIN_CACHE, or ~/.cache/finlin. NULL keeps
+	// them in memory only.
+	static void setKernelCache(const char *dir);
+
+	// Restarts random number generation. Each stream of a seed is a
+	// separate, reproducible sequence.
+	static void seed(unsigned long long seed, unsigned int stream);
+
+	// c = a * b for row-major host arrays, which may be memory-mapped files,
+	// too large for the GPU. Tiles are streamed through at most deviceBytes
+	// of GPU memory, with transfers overlapping the multiplications.
+	static void gemmOutOfCore(
+		int height,
+		int width,
+		int depth,
+		const double *a,
+		const double *b,
+		double *c,
+		size_t deviceBytes
+	);
 };
 
 class Veci;
 class Vec { // Vector, real components, double precision, on the GPU.
+	friend class FinLin::Graph;
 	friend class Mat;
 	friend class Veci;
+	friend class Mat8;
+	friend class DiagMat;
+	friend class TriMat;
+	friend class SymMat;
 
 	int d; // Dimension
 	double *data; // Components
-	cl_mem clmem; // OpenCL memory object
+	FinLin::Buffer *buffer; // OpenCL memory object, made on first GPU use
 
-	bool dirty; // Changes have been made in RAM but not in GPU RAM
+	mutable bool dirty; // Changes have been made in RAM but not in GPU RAM
 
 	void createMem();
+	cl_mem mem() const; // Creates the OpenCL memory object if necessary
+	void release(); // Frees a scratch vector
+	void detach(); // Before writing, leaves components that copies share
+	void sync() const; // Uploads changes, without modifying the components
+	bool hostPath() const; // Whether element-wise operations run on the host
+	Vec deviceCopy() const;	// Copy for an element-wise operation to
+							// overwrite. Made on the GPU only, leaving
+							// the host components stale, unless the
+							// operation will run on the host.
 
 	public:
 
 	// Statics
 	static Vec randomUniform(int dim, double min, double max);
+	static Vec randomNormal(int dim, double mean, double stddev);
 	static Vec *gramSchmidt(int numVecs, Vec *vecs); // Mutates input.
+	static Vec load(const char *path); // From .npy file, memory-mapped
 
 	// Constructors
 	Vec(int dimension); // Zero vector
@@ -139,6 +528,16 @@ class Vec { // Vector, real components, double precision, on the GPU.
 	Vec sigmoid() const; // Fast sigmoid function
 	Vec dsigmoid() const; // Derivative of fast sigmoid function
 
+	Vec relu() const; // max(x, 0)
+	Vec leakyRelu(double slope) const; // slope * x where x is negative
+	Vec tanh() const;
+	Vec gelu() const; // x * Phi(x), with the normal CDF Phi
+	Vec logistic() const; // 1 / (1 + e^-x)
+
+	// OpenCL C expression of each component x, such as "exp(-x * x)".
+	// Each distinct expression is compiled once, on first use.
+	Vec map(const char *expr) const;
+
 	// Binary operations
 	Vec operator*(double scalar) const;
 	Vec operator/(double divisor) const;
@@ -149,6 +548,13 @@ class Vec { // Vector, real components, double precision, on the GPU.
 	Vec operator&(Vec multiplier) const; // Hadamard product
 	double operator*(Vec multiplier) const; // Dot product
 
+	// OpenCL C expression of the components x of this and y of other
+	Vec zip(Vec other, const char *expr) const;
+
+	// Cross-correlation with filter, as in convolutional networks, every
+	// stride components, with padding zeros at each end.
+	Vec conv1d(Vec filter, int stride, int padding) const;
+
 	// In-place operations
 	Vec operator*=(double scalar);
 	Vec operator/=(double divisor);
@@ -159,12 +565,20 @@ class Vec { // Vector, real components, double precision, on the GPU.
 	Vec normalize();
 	Vec setSigmoid(); // Fast sigmoid function
 	Vec setDsigmoid(); // Derivative of fast sigmoid function
+	Vec setRelu();
+	Vec setLeakyRelu(double slope);
+	Vec setTanh();
+	Vec setGelu();
+	Vec setLogistic();
+	Vec setMap(const char *expr);
+	Vec setZip(Vec other, const char *expr);
 
 	// Mutators
 	double setComp(int index, double value);	// Sets component.
 												// Returns previous value.
 	// Technical methods
-	Vec copy() const;
+	Vec copy() const; // Shares the components until either is written
+	void save(const char *path) const; // As .npy file
 	bool update();	// If necessary, updates the GPU memory and returns true.
 					// Vector operations should do this automatically.
 };
@@ -172,25 +586,117 @@ Vec operator*(double scalar, Vec vector);
 
 class Mati;
 class Mat { // Matrix, real components, double precision, on the GPU.
+	friend class FinLin::Graph;
 	friend class Mati;
+	friend class Mat8;
+	friend class DiagMat;
+	friend class TriMat;
+	friend class SymMat;
 
 	double *data; // Components, row by row
 	int h; // Height
 	int w; // Width
-	cl_mem clmem; // OpenCL memory object
+	FinLin::Buffer *buffer; // OpenCL memory object, made on first GPU use
 
-	bool dirty; // Changes have been made in RAM but not in GPU RAM
+	mutable bool dirty; // Changes have been made in RAM but not in GPU RAM
 
 	void createMem();
+	cl_mem mem() const; // Creates the OpenCL memory object if necessary
+	void release(); // Frees a scratch matrix
+	void detach(); // Before writing, leaves components that copies share
+	void sync() const; // Uploads changes, without modifying the components
+	bool hostPath() const; // Whether element-wise operations run on the host
+	Mat deviceCopy() const;	// Copy for an element-wise operation to
+							// overwrite. Made on the GPU only, leaving
+							// the host components stale, unless the
+							// operation will run on the host.
+
+	static const int QR_BLOCK = 32; // Panel width of blocked QR
+
+	// Blocked Householder QR of a, in place on the GPU. Reflectors are written
+	// to v (height by min(height, width)), block factors to t (rows of
+	// QR_BLOCK).
+	static void householderQR(
+		cl_mem a,
+		int height,
+		int width,
+		cl_mem v,
+		cl_mem t
+	);
+	static void householderQ( // Thin Q from reflectors, height by k, on GPU
+		int height,
+		int k,
+		cl_mem v,
+		cl_mem t,
+		cl_mem q
+	);
+	static void applyBlockReflector( // To rows j0 onward of b, offB is row j0
+		int height,
+		int k,
+		int j0,
+		int nb,
+		cl_mem v,
+		cl_mem t,
+		cl_mem b, int offB, int ldb, int bw,
+		bool transpose,
+		cl_mem work // 2 * QR_BLOCK * bw doubles
+	);
+
+	// Reduced row echelon form of a in place on the GPU, one launch per column.
+	// Columns at most tolerance in magnitude below the pivots are taken as
+	// zero. Returns, for each column, the row of its pivot, or -1 if none.
+	static int *gaussJordan(cl_mem a, int height, int width, double tolerance);
+	double rankTolerance() const; // Scaled to the largest component
+
+	static const int TRI_BLOCK = 32; // Block size of Cholesky and solves
+
+	void choleskyInPlace(); // Lower triangle on the GPU. Throws error if not SPD
+	static void triangularSolve( // op(t) x = b in place, t is size by size
+		cl_mem t,
+		int size,
+		bool upper,
+		bool transpose,
+		bool unit, // Diagonal of ones, not read
+		cl_mem b,
+		int bw
+	);
+
+	static const int REFINE_MAX = 30; // Iterations of solveRefined
+
+	// Single precision LU factorization with partial pivoting on the GPU,
+	// widened into lu. Row i of the factors is row perm[i] of this matrix.
+	// Returns false if a pivot was zero or overflowed.
+	bool luSingle(cl_mem lu, cl_mem perm) const;
+
+	static const int CHECK_INTERVAL = 8; // Iterations between residual reads
+
+	void mulVec(cl_mem vec, cl_mem prod) const; // On the GPU, if up to date
+	cl_mem invDiagonal() const; // Jacobi preconditioner on the GPU
+	void arnoldiStep( // Extend orthonormal basis rows, j+1 of them, by one
+		cl_mem basis,
+		cl_mem hess, // Column-major coefficients, height ldh
+		cl_mem corr, // Scratch, same size as hess
+		int ldh,
+		int j,
+		cl_mem diag, // Right preconditioner, or NULL
+		cl_mem vec, // Scratch, one column
+		cl_mem prod // Scratch, one column
+	) const;
 
 	public:
 
 	// Statics
 	static Mat randomUniform(int height, int width, double min, double max);
+	static Mat randomNormal(int height, int width, double mean, double stddev);
 	static Mat fromRowVec(Vec row);
 	static Mat fromColVec(Vec col);
 	static Mat fromRowVecs(int numVecs, Vec *vecs); // Throws error if
 	static Mat fromColVecs(int numVecs, Vec *vecs); // dimensions don't match.
+	static Mat block(int rows, int cols, const Mat *blocks);	// Row-major
+																// grid
+	static Mat kron(Mat a, Mat b); // Kronecker product
+	static Mat load(const char *path); // From .npy file, memory-mapped
+	static Mat fromCSV(const char *path); // Comma-separated rows of numbers
 
 	// Constructors
 	Mat(int size); // Identity matrix
@@ -211,16 +717,36 @@ class Mat { // Matrix, real components, double precision, on the GPU.
 
 	double det() const; // Determinant
 	double trace() const;
+	int rank() const; // Number of pivots of RREF, with a rounding tolerance
 
 	Mat operator-() const;
 	Mat T() const; // Transpose
 	Mat inv() const; // Inverse. Throws error if not invertible.
+	Mat *QR() const; // Householder QR decomposition. Returns array {Q, R}.
+	Mat cholesky() const; // Lower triangular L = LL^T. Throws error if not SPD.
+	Mat nullspace() const;	// Basis of solutions to m x = 0, as columns.
+							// A single zero column if only x = 0.
+	Mat columnSpace() const;	// Independent columns spanning the range.
+								// A single zero column if m is zero.
 
 	Mat operator~() const; // Replace zeros with ones, non-zeros with zeros.
 
+	Mat map(const char *expr) const; // OpenCL C expression of each component x
+
+	Mat relu() const; // max(x, 0)
+	Mat leakyRelu(double slope) const; // slope * x where x is negative
+	Mat tanh() const;
+	Mat gelu() const; // x * Phi(x), with the normal CDF Phi
+	Mat logistic() const; // 1 / (1 + e^-x)
+
+	Mat softmax() const; // Of each row
+	Mat logSoftmax() const; // ''
+
 	// Misc operations
 	Vec rowVec(int row) const;
 	Vec colVec(int col) const;
+	Mat hcat(Mat right) const; // Side by side
+	Mat vcat(Mat below) const; // One above the other
 
 	// Binary operations
 	Mat operator*(double scalar) const;
@@ -234,6 +760,60 @@ class Mat { // Matrix, real components, double precision, on the GPU.
 	Mat operator+(Mat addend) const;
 	Mat operator-(Mat subtrahend) const;
 
+	// With structured matrices, using only their stored components
+	Mat operator*(ScalarMat multiplier) const;
+	Mat operator*(DiagMat multiplier) const;
+	Mat operator*(TriMat multiplier) const;
+	Mat operator*(SymMat multiplier) const;
+	Mat operator+(ScalarMat addend) const;
+	Mat operator+(DiagMat addend) const;
+	Mat operator+(TriMat addend) const;
+	Mat operator+(SymMat addend) const;
+
+	Mat zip(Mat other, const char *expr) const; // '' of x and y of other
+
+	// Cross-correlation, as in convolutional networks, with stride and
+	// padding zeros on each side. conv1d treats each row as a channel, with
+	// filterCount filters of the same height, and returns one row per filter.
+	Mat conv1d(int filterCount, const Mat *filters, int stride, int padding)
+		const;
+	Mat conv2d(Mat filter, int stride, int padding) const;
+	// channels images in, filterCount * channels filters, filter c of output o
+	// at filters[o * channels + c]. Returns an array of filterCount images.
+	static Mat *conv2d(
+		int channels,
+		const Mat *in,
+		int filterCount,
+		const Mat *filters,
+		int stride,
+		int padding
+	);
+
+	Vec lstsq(Vec rhs) const; // Least squares solution. Throws error if wide.
+	Mat lstsq(Mat rhs) const; // One solution column per column of rhs.
+	Vec solveSPD(Vec rhs) const; // Solve symmetric positive definite system
+	Mat solveSPD(Mat rhs) const; // One solution column per column of rhs.
+	Vec solveRefined(Vec rhs); // Square system, to double accuracy by
+								// refining a single precision LU solution.
+
+	// Iterative solvers, run entirely on the GPU. They stop once the residual
+	// is within tol times the magnitude of rhs, or after maxIter iterations.
+	// jacobi enables diagonal preconditioning.
+	Vec cg(Vec rhs, double tol, int maxIter, bool jacobi); // Symmetric pos. def.
+	Vec bicgstab(Vec rhs, double tol, int maxIter, bool jacobi);
+	Vec gmres(Vec rhs, int restart, double tol, int maxIter, bool jacobi);
+
+	// Eigenpairs of a symmetric matrix, largest in magnitude, by Lanczos on the
+	// GPU. Returns array {D, V}: eigenvalues on the diagonal of k by k matrix
+	// D, eigenvectors as the columns of V. Stops at residual tol times the
+	// largest eigenvalue found, or after maxIter Lanczos steps, at least k.
+	Mat *eigenSym(int k, double tol, int maxIter);
+
+	// Rank k approximation U S V^T by randomized SVD, with oversample extra
+	// sample columns and powerIters power iterations. Returns array {U, S, V},
+	// singular values on the diagonal of k by k matrix S in decreasing order.
+	Mat *svdRandomized(int k, int oversample, int powerIters);
+
 	// In-place operations
 	Mat operator*=(double scalar);
 	Mat operator/=(double divisor);
@@ -243,34 +823,56 @@ class Mat { // Matrix, real components, double precision, on the GPU.
 	Mat operator+=(Mat addend);
 	Mat operator-=(Mat subtrahend);
 
-	Mat RREF();
+	Mat rank1Update(double alpha, Vec u, Vec v); // Adds alpha * u v^T
+	Mat syrk(Mat a);	// Adds a * a.T() to a square matrix, computing one
+						// triangle and mirroring it
+
+	Mat setMap(const char *expr);
+	Mat setZip(Mat other, const char *expr);
+
+	Mat setRelu();
+	Mat setLeakyRelu(double slope);
+	Mat setTanh();
+	Mat setGelu();
+	Mat setLogistic();
+	Mat setSoftmax();
+	Mat setLogSoftmax();
+
+	Mat RREF(); // Reduced row echelon form, by partial pivoting
 
 	// Mutators
 	double setComp(int r, int c, double value);	// Sets component.
 												// Returns previous value.
 	// Technical methods
-	Mat copy() const;
+	Mat copy() const; // Shares the components until either is written
+	void save(const char *path) const; // As .npy file
+	void toCSV(const char *path) const; // Shortest exact decimals
 	bool update();	// If necessary, updates the GPU memory and returns true.
 					// Matrix operations should do this automatically.
 };
 Mat operator*(double scalar, Mat matrix);
 
 class Veci { // Vector, integer components, on the GPU.
+	friend class FinLin::Graph;
 	friend class Vec;
 	friend class Mati;
+	friend class Vecl;
+	friend class BitVec;
 
 	int d; // Dimension
 	int *data; // Components
 	cl_mem clmem; // OpenCL memory object
 
-	bool dirty; // Changes have been made in RAM but not in GPU RAM
+	mutable bool dirty; // Changes have been made in RAM but not in GPU RAM
 
 	void createMem();
+	void sync() const; // Uploads changes, without modifying the components
 
 	public:
 
 	// Statics
-	static Veci randomUniform(int dim, int min, int max);
+	static Veci randomUniform(int dim, int min, int max); // In [min, max)
+	static Veci load(const char *path); // From .npy file, memory-mapped
 
 	// Constructors
 	Veci(int dimension); // Zero vector
@@ -285,7 +887,7 @@ class Veci { // Vector, integer components, on the GPU.
 	char *string() const; // As a string
 
 	// Unary operations
-	int sum() const; // Sum of components
+	int64_t sum() const; // Sum of components, accumulated in 64 bits
 	Veci operator~() const; // Replace zeros with ones, non-zeros with zeros.
 
 	Veci operator-() const;
@@ -294,12 +896,12 @@ class Veci { // Vector, integer components, on the GPU.
 	Veci operator*(int scalar) const;
 	Veci operator/(int divisor) const; // Round down
 	Veci operator%(int modulus) const; // Modulo
-	int operator^(int exponent) const; // Magnitude raised to even power
+	int64_t operator^(int exponent) const; // Magnitude raised to even power
 
 	Veci operator+(Veci addend) const; // Throws error if dimensions mis-match
 	Veci operator-(Veci subtrahend) const; // ''
 	Veci operator&(Veci multiplier) const; // Hadamard product
-	int operator*(Veci multiplier) const; // Dot product
+	int64_t operator*(Veci multiplier) const; // Dot product, in 64 bits
 
 	// In-place operations
 	Veci operator*=(int scalar);
@@ -314,29 +916,36 @@ class Veci { // Vector, integer components, on the GPU.
 												// Returns previous value.
 	// Technical methods
 	Veci copy() const;
+	void save(const char *path) const; // As .npy file
 	bool update();	// If necessary, updates the GPU memory and returns true.
 					// Vecitor operations should do this automatically.
 };
 Veci operator*(int scalar, Veci vector);
 
 class Mati { // Matrix, integer components, on the GPU.
+	friend class FinLin::Graph;
+	friend class Matl;
+	friend class BitMat;
+
 	int *data; // Components, row by row
 	int h; // Height
 	int w; // Width
 	cl_mem clmem; // OpenCL memory object
 
-	bool dirty; // Changes have been made in RAM but not in GPU RAM
+	mutable bool dirty; // Changes have been made in RAM but not in GPU RAM
 
 	void createMem();
+	void sync() const; // Uploads changes, without modifying the components
 
 	public:
 
 	// Statics
-	static Mati randomUniform(int height, int width, int min, int max);
+	static Mati randomUniform(int height, int width, int min, int max); // ''
 	static Mati fromRowVec(Veci row);
 	static Mati fromColVec(Veci col);
 	static Mati fromRowVecs(int numVecs, Veci *vecs); // Throws error if
 	static Mati fromColVecs(int numVecs, Veci *vecs); // dimensions don't match.
+	static Mati load(const char *path); // From .npy file, memory-mapped
 
 	// Constructors
 	Mati(int size); // Identity matrix
@@ -391,9 +1000,762 @@ class Mati { // Matrix, integer components, on the GPU.
 												// Returns previous value.
 	// Technical methods
 	Mati copy() const;
+	void save(const char *path) const; // As .npy file
 	bool update();	// If necessary, updates the GPU memory and returns true.
 					// Matirix operations should do this automatically.
 };
 Mati operator*(int scalar, Mati matrix);
 
+class Vecl { // Vector, 64-bit integer components, on the GPU.
+	friend class FinLin::Graph;
+	friend class Matl;
+
+	int d; // Dimension
+	int64_t *data; // Components
+	cl_mem clmem; // OpenCL memory object
+
+	mutable bool dirty; // Changes have been made in RAM but not in GPU RAM
+
+	void createMem();
+	void sync() const; // Uploads changes, without modifying the components
+
+	public:
+
+	// Statics
+	static Vecl randomUniform(int dim, int64_t min, int64_t max); // [min, max)
+	static Vecl load(const char *path); // From .npy file, memory-mapped
+
+	// Constructors
+	Vecl(int dimension); // Zero vector
+	Vecl(int dimension, int64_t *components);
+	Vecl(int dimension, int64_t value); // Populates all components with value
+	Vecl(Veci vec); // Widen 32-bit integers
+
+	// Accessors
+	int dim() const; // Dimension
+
+	int64_t comp(int index) const; // Component
+	char *string() const; // As a string
+
+	// Unary operations
+	int64_t sum() const; // Sum of components
+	Vecl operator~() const; // Replace zeros with ones, non-zeros with zeros.
+
+	Vecl operator-() const;
+
+	// Binary operations
+	Vecl operator*(int64_t scalar) const;
+	Vecl operator/(int64_t divisor) const; // Round toward zero
+	Vecl operator%(int64_t modulus) const; // Modulo
+	int64_t operator^(int exponent) const; // Magnitude raised to even power
+
+	Vecl operator+(Vecl addend) const; // Throws error if dimensions mis-match
+	Vecl operator-(Vecl subtrahend) const; // ''
+	Vecl operator&(Vecl multiplier) const; // Hadamard product
+	int64_t operator*(Vecl multiplier) const; // Dot product
+
+	// In-place operations
+	Vecl operator*=(int64_t scalar);
+	Vecl operator/=(int64_t divisor); // Round toward zero
+	Vecl operator%=(int64_t modulus); // Modulo
+	Vecl operator+=(Vecl addend);
+	Vecl operator-=(Vecl subtrahend);
+	Vecl operator&=(Vecl multiplier); // Hadamard product
+
+	// Mutators
+	int64_t setComp(int index, int64_t value);	// Sets component.
+												// Returns previous value.
+	// Technical methods
+	Vecl copy() const;
+	void save(const char *path) const; // As .npy file
+	bool update();	// If necessary, updates the GPU memory and returns true.
+					// Vector operations should do this automatically.
+};
+Vecl operator*(int64_t scalar, Vecl vector);
+
+class Matl { // Matrix, 64-bit integer components, on the GPU.
+	friend class FinLin::Graph;
+
+	int64_t *data; // Components, row by row
+	int h; // Height
+	int w; // Width
+	cl_mem clmem; // OpenCL memory object
+
+	mutable bool dirty; // Changes have been made in RAM but not in GPU RAM
+
+	void createMem();
+	void sync() const; // Uploads changes, without modifying the components
+
+	public:
+
+	// Statics
+	static Matl randomUniform( // In [min, max)
+		int height,
+		int width,
+		int64_t min,
+		int64_t max
+	);
+	static Matl fromRowVec(Vecl row);
+	static Matl fromColVec(Vecl col);
+	static Matl fromRowVecs(int numVecs, Vecl *vecs); // Throws error if
+	static Matl fromColVecs(int numVecs, Vecl *vecs); // dimensions don't match.
+	static Matl load(const char *path); // From .npy file, memory-mapped
+
+	// Constructors
+	Matl(int size); // Identity matrix
+	Matl(int height, int width); // Zero matrix
+	Matl(int height, int width, int64_t *data);
+	Matl(Mati mat); // Widen 32-bit integers
+
+	// Accessors
+	int height() const;
+	int width() const;
+
+	int64_t comp(int r, int c) const; // Component
+	char *string() const; // As a string
+
+	// Unary operations
+	int64_t trace() const;
+
+	Matl operator-() const;
+	Matl T() const; // Transpose
+
+	Matl operator~() const; // Replace zeros with ones, non-zeros with zeros.
+
+	// Misc operations
+	Vecl rowVecl(int row) const;
+	Vecl colVecl(int col) const;
+
+	// Binary operations
+	Matl operator*(int64_t scalar) const;
+	Matl operator/(int64_t divisor) const; // Rounds toward zero
+	Matl operator%(int64_t modulus) const; // Modulo
+	Matl operator^(int exponent) const; // Exponentiation
+
+	Vecl operator*(Vecl multiplier); // Throws error if dimensions mis-match
+
+	Matl operator*(Matl multiplier); // ''
+	Matl operator&(Matl multiplier) const; // Hadamard product
+	Matl operator+(Matl addend) const;
+	Matl operator-(Matl subtrahend) const;
+
+	// In-place operations
+	Matl operator*=(int64_t scalar);
+	Matl operator/=(int64_t divisor); // Rounds toward zero
+	Matl operator%=(int64_t modulus); // Modulo
+	Matl operator^=(int exponent); // Exponentiation
+
+	Matl operator&=(Matl multiplier); // Hadamard product
+	Matl operator+=(Matl addend);
+	Matl operator-=(Matl subtrahend);
+
+	// Mutators
+	int64_t setComp(int r, int c, int64_t value);	// Sets component.
+													// Returns previous value.
+	// Technical methods
+	Matl copy() const;
+	void save(const char *path) const; // As .npy file
+	bool update();	// If necessary, updates the GPU memory and returns true.
+					// Matrix operations should do this automatically.
+};
+Matl operator*(int64_t scalar, Matl matrix);
+
+class BitVec { // Vector of bits, packed 64 to a word, on the GPU.
+	friend class BitMat;
+
+	int d; // Dimension
+	int words; // Length of data
+	uint64_t *data; // Components, least significant bit first
+	cl_mem clmem; // OpenCL memory object
+
+	mutable bool dirty; // Changes have been made in RAM but not in GPU RAM
+
+	void createMem();
+	void sync() const; // Uploads changes, without modifying the components
+
+	public:
+
+	// Constructors
+	BitVec(int dimension); // All bits clear
+	BitVec(int dimension, bool value); // All bits equal to value
+	BitVec(Veci vec); // Bits set where components are non-zero
+
+	// Accessors
+	int dim() const; // Dimension
+
+	bool comp(int index) const; // Component
+	char *string() const; // As a string
+
+	// Unary operations
+	int64_t count() const; // Number of set bits
+	BitVec operator~() const; // NOT
+
+	// Binary operations
+	BitVec operator&(BitVec mask) const; // AND
+	BitVec operator|(BitVec mask) const; // OR
+	BitVec operator^(BitVec mask) const; // XOR
+	int64_t operator*(BitVec mask) const; // Number of bits set in both
+
+	// In-place operations
+	BitVec operator&=(BitVec mask);
+	BitVec operator|=(BitVec mask);
+	BitVec operator^=(BitVec mask);
+
+	// Mutators
+	bool setComp(int index, bool value);	// Sets component.
+											// Returns previous value.
+	// Technical methods
+	BitVec copy() const;
+	bool update();	// If necessary, updates the GPU memory and returns true.
+					// Vector operations should do this automatically.
+};
+
+class BitMat { // Matrix of bits, rows packed 64 to a word, on the GPU.
+	int h; // Height
+	int w; // Width
+	int rowWords; // Words per row
+	uint64_t *data; // Rows, each starting on a new word
+	cl_mem clmem; // OpenCL memory object
+
+	mutable bool dirty; // Changes have been made in RAM but not in GPU RAM
+
+	void createMem();
+	void sync() const; // Uploads changes, without modifying the components
+
+	public:
+
+	// Constructors
+	BitMat(int size); // Identity matrix
+	BitMat(int height, int width); // All bits clear
+	BitMat(Mati mat); // Bits set where components are non-zero
+
+	// Accessors
+	int height() const;
+	int width() const;
+
+	bool comp(int r, int c) const; // Component
+	char *string() const; // As a string
+
+	// Unary operations
+	int64_t count() const; // Number of set bits
+	BitMat operator~() const; // NOT
+	BitMat T() const; // Transpose
+	BitMat closure() const; // Transitive closure of a square adjacency matrix
+
+	// Binary operations
+	BitMat operator&(BitMat mask) const; // AND
+	BitMat operator|(BitMat mask) const; // OR
+	BitMat operator^(BitMat mask) const; // XOR
+
+	BitVec operator*(BitVec multiplier); // Boolean (AND-OR) product
+	BitMat operator*(BitMat multiplier); // ''
+
+	// In-place operations
+	BitMat operator&=(BitMat mask);
+	BitMat operator|=(BitMat mask);
+	BitMat operator^=(BitMat mask);
+
+	// Mutators
+	bool setComp(int r, int c, bool value);	// Sets component.
+											// Returns previous value.
+	// Technical methods
+	BitMat copy() const;
+	bool update();	// If necessary, updates the GPU memory and returns true.
+					// Matrix operations should do this automatically.
+};
+
+class Mat8 { // Matrix of 8-bit codes with scales and zero points, on the GPU.
+	int h; // Height
+	int w; // Width
+	int ld; // Codes per row, w rounded up to a multiple of 4
+	int8_t *data; // Codes, row-major, rows padded with zeros
+	double *scales; // Scale of each row
+	int *zeros; // Zero point of each row
+	bool perRow; // Whether rows have their own scale and zero point
+	cl_mem clmem; // OpenCL memory object
+	cl_mem scalemem; // ''
+	cl_mem zeromem; // ''
+
+	public:
+
+	// Constructors
+	Mat8(Mat mat, bool perRow);	// Quantizes with a scale and zero point per
+								// row, or one for the whole matrix
+
+	// Accessors
+	int height() const;
+	int width() const;
+
+	double comp(int r, int c) const; // Dequantized component
+	Mat dequantize() const;
+
+	// Binary operations
+	Vec operator*(Vec vec);	// Quantizes vec for the product,
+							// accumulating in 32 bits
+	Mat operator*(Mat8 multiplier); // Multiplier must not be per row
+};
+
+class ScalarMat { // Scaled identity matrix, stored as its size and scalar.
+	int n; // Size
+	double x; // Scalar on the diagonal
+
+	public:
+
+	// Constructors
+	ScalarMat(int size, double scalar);
+
+	// Accessors
+	int size() const;
+	double scalar() const;
+
+	double comp(int r, int c) const; // Component
+	Mat toMat() const; // Dense
+
+	// Binary operations
+	Vec operator*(Vec multiplier) const;
+	Mat operator*(Mat multiplier) const;
+	ScalarMat operator*(ScalarMat multiplier) const;
+	Mat operator+(Mat addend) const; // Adds to the diagonal only
+	ScalarMat operator+(ScalarMat addend) const;
+
+	Vec solve(Vec rhs) const; // Divides by the scalar
+	Mat solve(Mat rhs) const; // ''
+};
+
+class DiagMat { // Diagonal matrix, storing only its diagonal, on the GPU.
+	friend class Mat;
+
+	Vec diag; // Diagonal
+
+	public:
+
+	// Constructors
+	DiagMat(Vec diagonal);
+	DiagMat(Mat mat); // Diagonal of a square matrix
+
+	// Accessors
+	int size() const;
+	Vec diagonal() const;
+
+	double comp(int r, int c) const; // Component
+	Mat toMat() const; // Dense
+
+	// Binary operations
+	Vec operator*(Vec multiplier) const; // Scales components
+	Mat operator*(Mat multiplier) const; // Scales rows
+	DiagMat operator*(DiagMat multiplier) const;
+	Mat operator+(Mat addend) const; // Adds to the diagonal only
+	DiagMat operator+(DiagMat addend) const;
+
+	Vec solve(Vec rhs) const; // Divides by the diagonal
+	Mat solve(Mat rhs) const; // ''
+};
+
+class TriMat { // Triangular matrix, on the GPU. Skips its zeros in products.
+	friend class Mat;
+
+	Mat tri; // Dense, zero outside the triangle
+	bool upper; // Upper or lower triangular
+
+	public:
+
+	// Constructors
+	TriMat(Mat mat, bool upper); // Triangle of a square matrix, diagonal in
+
+	// Accessors
+	int size() const;
+	bool isUpper() const;
+
+	double comp(int r, int c) const; // Component
+	Mat toMat() const; // Dense
+
+	// Binary operations
+	Vec operator*(Vec multiplier) const;
+	Mat operator*(Mat multiplier) const;
+	Mat operator+(Mat addend) const;
+	TriMat operator+(TriMat addend) const; // Must be the same triangle
+
+	Vec solve(Vec rhs) const; // Blocked substitution, on the GPU
+	Mat solve(Mat rhs) const; // ''
+};
+
+class SymMat { // Symmetric matrix, lower triangle packed row by row, on GPU.
+	friend class Mat;
+
+	int n; // Size
+	Vec packed; // n(n+1)/2 components of the lower triangle
+
+	public:
+
+	// Constructors
+	SymMat(Mat mat); // From the lower triangle of a square matrix
+
+	// Accessors
+	int size() const;
+
+	double comp(int r, int c) const; // Component
+	Mat toMat() const; // Dense
+
+	// Binary operations
+	Vec operator*(Vec multiplier) const;
+	Mat operator*(Mat multiplier) const;
+	Mat operator+(Mat addend) const;
+	SymMat operator+(SymMat addend) const; // Adds the packed triangles
+
+	Vec solve(Vec rhs) const; // By Cholesky. Throws error if not SPD.
+	Mat solve(Mat rhs) const; // ''
+};
+
+// Fixed-size vectors and matrices, for small geometry. Components live in the
+// object itself and all arithmetic runs on the host, with loops of constant
+// length for the compiler to unroll and vectorize. Nothing touches OpenCL,
+// except converting to and from Vec and Mat.
+
+template <int N>
+class VecN { // Vector of N doubles, on the host.
+	double data[N]; // Components
+
+	public:
+
+	// Constructors
+	VecN() { // Zero vector
+		for(int i = 0; i < N; i++) data[i] = 0;
+	}
+	explicit VecN(double value) { // Populates all components with value
+		for(int i = 0; i < N; i++) data[i] = value;
+	}
+	VecN(const double *components) {
+		for(int i = 0; i < N; i++) data[i] = components[i];
+	}
+	explicit VecN(Vec vec) { // Throws error if dimensions mis-match
+		if(vec.dim() != N) {
+			fprintf(
+				stderr,
+				"Dimension mismatch. "
+				"Cannot make %d-dimensional fixed vector from dimension %d.\n",
+				N,
+				vec.dim()
+			);
+			exit(1);
+		}
+		for(int i = 0; i < N; i++) data[i] = vec.comp(i);
+	}
+
+	// Accessors
+	static constexpr int dim() { return N; }
+
+	double comp(int index) const { return data[index]; }
+	Vec toVec() const { // On the GPU
+		double *components = (double*)FinLin::allocHost(N * sizeof(double));
+		memcpy(components, data, N * sizeof(double));
+		return Vec(N, components);
+	}
+
+	// Unary operations
+	VecN operator-() const { return *this * -1.0; }
+	double norm() const { return sqrt(*this * *this); } // Magnitude
+	VecN normal() const { return *this / norm(); } // Unit vector
+	double sum() const {
+		double sum = 0;
+		for(int i = 0; i < N; i++) sum += data[i];
+		return sum;
+	}
+
+	// Binary operations
+	VecN operator*(double scalar) const {
+		VecN res = *this;
+		return res *= scalar;
+	}
+	VecN operator/(double divisor) const {
+		VecN res = *this;
+		return res /= divisor;
+	}
+	VecN operator+(VecN addend) const {
+		VecN res = *this;
+		return res += addend;
+	}
+	VecN operator-(VecN subtrahend) const {
+		VecN res = *this;
+		return res -= subtrahend;
+	}
+	VecN operator&(VecN multiplier) const { // Hadamard product
+		VecN res = *this;
+		return res &= multiplier;
+	}
+	double operator*(VecN multiplier) const { // Dot product
+		double sum = 0;
+		for(int i = 0; i < N; i++) sum += data[i] * multiplier.data[i];
+		return sum;
+	}
+	VecN cross(VecN multiplier) const { // Cross product, 3 dimensions only
+		static_assert(N == 3, "Cross product needs 3 dimensions.");
+		const double *a = data;
+		const double *b = multiplier.data;
+		double res[3] = {
+			a[1]*b[2] - a[2]*b[1],
+			a[2]*b[0] - a[0]*b[2],
+			a[0]*b[1] - a[1]*b[0]
+		};
+		return VecN(res);
+	}
+
+	// In-place operations
+	VecN operator*=(double scalar) {
+		for(int i = 0; i < N; i++) data[i] *= scalar;
+		return *this;
+	}
+	VecN operator/=(double divisor) {
+		return *this *= 1.0/divisor;
+	}
+	VecN operator+=(VecN addend) {
+		for(int i = 0; i < N; i++) data[i] += addend.data[i];
+		return *this;
+	}
+	VecN operator-=(VecN subtrahend) {
+		for(int i = 0; i < N; i++) data[i] -= subtrahend.data[i];
+		return *this;
+	}
+	VecN operator&=(VecN multiplier) { // Hadamard product
+		for(int i = 0; i < N; i++) data[i] *= multiplier.data[i];
+		return *this;
+	}
+
+	VecN normalize() {
+		return *this /= norm();
+	}
+
+	// Mutators
+	double setComp(int index, double value) {	// Sets component.
+		double prev = data[index];				// Returns previous value.
+		data[index] = value;
+		return prev;
+	}
+};
+template <int N>
+VecN<N> operator*(double scalar, VecN<N> vector) {
+	return vector * scalar;
+}
+
+template <int R, int C>
+class MatN { // R by C matrix of doubles, on the host.
+	double data[R * C]; // Components, row by row
+
+	public:
+
+	// Statics
+	static MatN identity() { // Square only
+		static_assert(R == C, "Identity must be square.");
+		MatN res;
+		for(int i = 0; i < R; i++) res.data[i*C + i] = 1;
+		return res;
+	}
+
+	// Constructors
+	MatN() { // Zero matrix
+		for(int i = 0; i < R*C; i++) data[i] = 0;
+	}
+	MatN(const double *components) { // Row after row
+		for(int i = 0; i < R*C; i++) data[i] = components[i];
+	}
+	explicit MatN(Mat mat) { // Throws error if dimensions mis-match
+		if(mat.height() != R || mat.width() != C) {
+			fprintf(
+				stderr,
+				"Dimension mismatch. "
+				"Cannot make %d by %d fixed matrix from %d by %d.\n",
+				R,
+				C,
+				mat.height(),
+				mat.width()
+			);
+			exit(1);
+		}
+		for(int r = 0; r < R; r++) {
+			for(int c = 0; c < C; c++) data[r*C + c] = mat.comp(r, c);
+		}
+	}
+
+	// Accessors
+	static constexpr int height() { return R; }
+	static constexpr int width() { return C; }
+
+	double comp(int r, int c) const { return data[r*C + c]; }
+	Mat toMat() const { // On the GPU
+		double *components = (double*)FinLin::allocHost(R*C * sizeof(double));
+		memcpy(components, data, R*C * sizeof(double));
+		return Mat(R, C, components);
+	}
+
+	// Unary operations
+	MatN operator-() const { return *this * -1.0; }
+	MatN<C, R> T() const { // Transpose
+		MatN<C, R> res;
+		for(int r = 0; r < R; r++) {
+			for(int c = 0; c < C; c++) res.setComp(c, r, data[r*C + c]);
+		}
+		return res;
+	}
+	double trace() const {
+		static_assert(R == C, "Trace needs a square matrix.");
+		double sum = 0;
+		for(int i = 0; i < R; i++) sum += data[i*C + i];
+		return sum;
+	}
+	double det() const { // Determinant, by elimination with partial pivoting
+		static_assert(R == C, "Determinant needs a square matrix.");
+		MatN a = *this;
+		double det = 1;
+		for(int c = 0; c < C; c++) {
+			int p = a.pivot(c);
+			if(a.data[p*C + c] == 0) return 0;
+			if(p != c) {
+				a.swapRows(p, c);
+				det = -det;
+			}
+			det *= a.data[c*C + c];
+			for(int r = c + 1; r < R; r++) {
+				double factor = a.data[r*C + c] / a.data[c*C + c];
+				for(int k = c; k < C; k++) {
+					a.data[r*C + k] -= factor * a.data[c*C + k];
+				}
+			}
+		}
+		return det;
+	}
+	MatN inv() const { // Inverse. Throws error if not invertible.
+		static_assert(R == C, "Inverse needs a square matrix.");
+		MatN a = *this;
+		MatN res = identity();
+		for(int c = 0; c < C; c++) {
+			int p = a.pivot(c);
+			if(a.data[p*C + c] == 0) {
+				fprintf(stderr, "Cannot take inverse of singular matrix.\n");
+				exit(1);
+			}
+			a.swapRows(p, c);
+			res.swapRows(p, c);
+			double scale = 1.0 / a.data[c*C + c];
+			for(int k = 0; k < C; k++) {
+				a.data[c*C + k] *= scale;
+				res.data[c*C + k] *= scale;
+			}
+			for(int r = 0; r < R; r++) {
+				if(r == c) continue;
+				double factor = a.data[r*C + c];
+				for(int k = 0; k < C; k++) {
+					a.data[r*C + k] -= factor * a.data[c*C + k];
+					res.data[r*C + k] -= factor * res.data[c*C + k];
+				}
+			}
+		}
+		return res;
+	}
+
+	// Misc operations
+	VecN<C> rowVec(int row) const {
+		return VecN<C>(data + row*C);
+	}
+	VecN<R> colVec(int col) const {
+		VecN<R> res;
+		for(int r = 0; r < R; r++) res.setComp(r, data[r*C + col]);
+		return res;
+	}
+
+	// Binary operations
+	MatN operator*(double scalar) const {
+		MatN res = *this;
+		return res *= scalar;
+	}
+	MatN operator/(double divisor) const {
+		MatN res = *this;
+		return res /= divisor;
+	}
+	VecN<R> operator*(VecN<C> multiplier) const {
+		VecN<R> res;
+		for(int r = 0; r < R; r++) {
+			double sum = 0;
+			for(int c = 0; c < C; c++) {
+				sum += data[r*C + c] * multiplier.comp(c);
+			}
+			res.setComp(r, sum);
+		}
+		return res;
+	}
+	template <int K>
+	MatN<R, K> operator*(MatN<C, K> multiplier) const {
+		MatN<R, K> res;
+		for(int r = 0; r < R; r++) {
+			for(int k = 0; k < K; k++) {
+				double sum = 0;
+				for(int c = 0; c < C; c++) {
+					sum += data[r*C + c] * multiplier.comp(c, k);
+				}
+				res.setComp(r, k, sum);
+			}
+		}
+		return res;
+	}
+	MatN operator&(MatN multiplier) const { // Hadamard product
+		MatN res = *this;
+		return res &= multiplier;
+	}
+	MatN operator+(MatN addend) const {
+		MatN res = *this;
+		return res += addend;
+	}
+	MatN operator-(MatN subtrahend) const {
+		MatN res = *this;
+		return res -= subtrahend;
+	}
+
+	// In-place operations
+	MatN operator*=(double scalar) {
+		for(int i = 0; i < R*C; i++) data[i] *= scalar;
+		return *this;
+	}
+	MatN operator/=(double divisor) {
+		return *this *= 1.0/divisor;
+	}
+	MatN operator&=(MatN multiplier) { // Hadamard product
+		for(int i = 0; i < R*C; i++) data[i] *= multiplier.data[i];
+		return *this;
+	}
+	MatN operator+=(MatN addend) {
+		for(int i = 0; i < R*C; i++) data[i] += addend.data[i];
+		return *this;
+	}
+	MatN operator-=(MatN subtrahend) {
+		for(int i = 0; i < R*C; i++) data[i] -= subtrahend.data[i];
+		return *this;
+	}
+
+	// Mutators
+	double setComp(int r, int c, double value) {	// Sets component.
+		double prev = data[r*C + c];				// Returns previous value.
+		data[r*C + c] = value;
+		return prev;
+	}
+
+	private:
+
+	int pivot(int col) const { // Row of largest magnitude at or below col
+		int p = col;
+		for(int r = col + 1; r < R; r++) {
+			if(fabs(data[r*C + col]) > fabs(data[p*C + col])) p = r;
+		}
+		return p;
+	}
+	void swapRows(int a, int b) {
+		for(int k = 0; k < C; k++) {
+			double x = data[a*C + k];
+			data[a*C + k] = data[b*C + k];
+			data[b*C + k] = x;
+		}
+	}
+};
+template <int R, int C>
+MatN<R, C> operator*(double scalar, MatN<R, C> matrix) {
+	return matrix * scalar;
+}
+
 #endif
@@ -0,0 +1,307 @@
+// Copyright (c) 2021 Thomas Kaldahl
+
+#include "finlin.hpp"
+
+// Helper functions
+
+// Makes room for one more element of a malloc'd array of count elements,
+// doubling its capacity whenever count reaches a power of two
+void *append(void *array, int count, size_t size) {
+	if(count != 0 && (count & (count - 1)) != 0) return array;
+	return realloc(array, (count == 0 ? 1 : 2*count) * size);
+}
+
+// Constructors
+FinLin::Graph::Graph() {
+	args = NULL;
+	numArgs = 0;
+	steps = NULL;
+	numSteps = 0;
+	retained = NULL;
+	numRetained = 0;
+	outputs = NULL;
+	numOutputs = 0;
+}
+
+// Recording
+void FinLin::Graph::retain(cl_mem buffer) {
+	clRetainMemObject(buffer);
+	retained = (cl_mem*)append(retained, numRetained, sizeof(cl_mem));
+	retained[numRetained++] = buffer;
+}
+void FinLin::Graph::recordArg(
+	cl_kernel kernel,
+	int argno,
+	size_t size,
+	const void *value,
+	bool buffer
+) {
+	// Temporaries may be released before replay
+	if(buffer) retain(*(const cl_mem*)value);
+
+	int i = 0;
+	while(i < numArgs && (args[i].kernel != kernel || args[i].argno != argno)) {
+		i++;
+	}
+	if(i == numArgs) {
+		args = (Arg*)append(args, numArgs, sizeof(Arg));
+		numArgs++;
+	}
+	args[i].kernel = kernel;
+	args[i].argno = argno;
+	args[i].size = size;
+	memcpy(args[i].value, value, size);
+}
+void FinLin::Graph::recordLaunch(
+	cl_kernel kernel,
+	int dims,
+	const size_t *offset,
+	const size_t *globalSize,
+	const size_t *localSize
+) {
+	// A kernel of its own, so its arguments stay bound
+	char name[64];
+	err = clGetKernelInfo(
+		kernel,
+		CL_KERNEL_FUNCTION_NAME,
+		sizeof(name),
+		name,
+		NULL
+	);
+	checkErr();
+	cl_program source; // Expression kernels have programs of their own
+	err = clGetKernelInfo(
+		kernel,
+		CL_KERNEL_PROGRAM,
+		sizeof(source),
+		&source,
+		NULL
+	);
+	checkErr();
+	cl_kernel bound = clCreateKernel(source, name, &err);
+	checkErr();
+	for(int i = 0; i < numArgs; i++) {
+		if(args[i].kernel != kernel) continue;
+		err = clSetKernelArg(bound, args[i].argno, args[i].size, args[i].value);
+		checkErr();
+	}
+
+	steps = (Step*)append(steps, numSteps, sizeof(Step));
+	Step *step = &steps[numSteps++];
+	step->kernel = bound;
+	step->src = NULL;
+	step->dst = NULL;
+	step->dims = dims;
+	for(int d = 0; d < dims; d++) {
+		step->offset[d] = offset[d];
+		step->globalSize[d] = globalSize[d];
+		step->localSize[d] = localSize[d];
+	}
+}
+void FinLin::Graph::recordCopy(
+	cl_mem src,
+	cl_mem dst,
+	size_t srcOffset,
+	size_t dstOffset,
+	size_t cb
+) {
+	retain(src);
+	retain(dst);
+	steps = (Step*)append(steps, numSteps, sizeof(Step));
+	Step *step = &steps[numSteps++];
+	step->kernel = NULL;
+	step->src = src;
+	step->dst = dst;
+	step->srcOffset = srcOffset;
+	step->dstOffset = dstOffset;
+	step->cb = cb;
+	step->rows = 0;
+}
+void FinLin::Graph::recordCopyRect(
+	cl_mem src,
+	cl_mem dst,
+	size_t srcOffset,
+	size_t srcPitch,
+	size_t dstOffset,
+	size_t dstPitch,
+	size_t cb,
+	size_t rows
+) {
+	recordCopy(src, dst, srcOffset, dstOffset, cb);
+	Step *step = &steps[numSteps - 1];
+	step->rows = rows;
+	step->srcPitch = srcPitch;
+	step->dstPitch = dstPitch;
+}
+void FinLin::Graph::recordFill(cl_mem buffer, size_t cb) {
+	retain(buffer);
+	steps = (Step*)append(steps, numSteps, sizeof(Step));
+	Step *step = &steps[numSteps++];
+	step->kernel = NULL;
+	step->src = NULL;
+	step->dst = buffer;
+	step->dstOffset = 0;
+	step->cb = cb;
+}
+
+// Capturing
+void FinLin::Graph::begin() {
+	if(capturing != NULL) {
+		fprintf(stderr, "Cannot capture two graphs at once.\n");
+		exit(1);
+	}
+	clear();
+	capturing = this;
+}
+void FinLin::Graph::end() {
+	capturing = NULL;
+	free(args);
+	args = NULL;
+	numArgs = 0;
+}
+
+// Replay
+void FinLin::Graph::replay() {
+	for(int i = 0; i < numSteps; i++) {
+		Step *step = &steps[i];
+		if(step->kernel != NULL) {
+			bool local = step->localSize[0] != 0;
+			err = clEnqueueNDRangeKernel(
+				commandQueue,
+				step->kernel,
+				step->dims,
+				step->offset,
+				step->globalSize,
+				local ? step->localSize : NULL,
+				0,
+				NULL,
+				NULL
+			);
+		} else if(step->src != NULL && step->rows > 0) {
+			size_t srcOrigin[3] = {step->srcOffset, 0, 0};
+			size_t dstOrigin[3] = {step->dstOffset, 0, 0};
+			size_t region[3] = {step->cb, step->rows, 1};
+			err = clEnqueueCopyBufferRect(
+				commandQueue,
+				step->src,
+				step->dst,
+				srcOrigin,
+				dstOrigin,
+				region,
+				step->srcPitch,
+				0,
+				step->dstPitch,
+				0,
+				0,
+				NULL,
+				NULL
+			);
+		} else if(step->src != NULL) {
+			err = clEnqueueCopyBuffer(
+				commandQueue,
+				step->src,
+				step->dst,
+				step->srcOffset,
+				step->dstOffset,
+				step->cb,
+				0,
+				NULL,
+				NULL
+			);
+		} else {
+			double zero = 0;
+			err = clEnqueueFillBuffer(
+				commandQueue,
+				step->dst,
+				&zero,
+				sizeof(double),
+				step->dstOffset,
+				step->cb,
+				0,
+				NULL,
+				NULL
+			);
+		}
+		checkErr();
+	}
+
+	for(int i = 0; i < numOutputs; i++) {
+		readBuffer(outputs[i].buffer, 0, outputs[i].cb, outputs[i].data);
+	}
+}
+
+// Binding
+void FinLin::Graph::rebind(Vec &input) {
+	input.update();
+}
+void FinLin::Graph::rebind(Mat &input) {
+	input.update();
+}
+void FinLin::Graph::rebind(Veci &input) {
+	input.update();
+}
+void FinLin::Graph::rebind(Mati &input) {
+	input.update();
+}
+void FinLin::Graph::rebind(Vecl &input) {
+	input.update();
+}
+void FinLin::Graph::rebind(Matl &input) {
+	input.update();
+}
+void FinLin::Graph::output(Vec &result) {
+	// Replays overwrite it, so it stops sharing with copies and makes no more
+	result.detach();
+	result.buffer->pinned = true;
+	outputs = (Output*)append(outputs, numOutputs, sizeof(Output));
+	outputs[numOutputs++] = {result.mem(), result.d * sizeof(double), result.data};
+}
+void FinLin::Graph::output(Mat &result) {
+	// Replays overwrite it, so it stops sharing with copies and makes no more
+	result.detach();
+	result.buffer->pinned = true;
+	outputs = (Output*)append(outputs, numOutputs, sizeof(Output));
+	outputs[numOutputs++] =
+		{result.mem(), result.w*result.h * sizeof(double), result.data};
+}
+void FinLin::Graph::output(Veci &result) {
+	outputs = (Output*)append(outputs, numOutputs, sizeof(Output));
+	outputs[numOutputs++] = {result.clmem, result.d * sizeof(int), result.data};
+}
+void FinLin::Graph::output(Mati &result) {
+	outputs = (Output*)append(outputs, numOutputs, sizeof(Output));
+	outputs[numOutputs++] =
+		{result.clmem, result.w*result.h * sizeof(int), result.data};
+}
+void FinLin::Graph::output(Vecl &result) {
+	outputs = (Output*)append(outputs, numOutputs, sizeof(Output));
+	outputs[numOutputs++] =
+		{result.clmem, result.d * sizeof(int64_t), result.data};
+}
+void FinLin::Graph::output(Matl &result) {
+	outputs = (Output*)append(outputs, numOutputs, sizeof(Output));
+	outputs[numOutputs++] =
+		{result.clmem, result.w*result.h * sizeof(int64_t), result.data};
+}
+
+// Technical methods
+void FinLin::Graph::clear() {
+	for(int i = 0; i < numSteps; i++) {
+		if(steps[i].kernel != NULL) clReleaseKernel(steps[i].kernel);
+	}
+	for(int i = 0; i < numRetained; i++) {
+		clReleaseMemObject(retained[i]);
+	}
+	free(args);
+	free(steps);
+	free(retained);
+	free(outputs);
+	args = NULL;
+	numArgs = 0;
+	steps = NULL;
+	numSteps = 0;
+	retained = NULL;
+	numRetained = 0;
+	outputs = NULL;
+	numOutputs = 0;
+}
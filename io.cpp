@@ -0,0 +1,478 @@
+// Copyright (c) 2021 Thomas Kaldahl
+
+#include "finlin.hpp"
+#include <charconv>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Helper functions
+
+// Writes an .npy file, version 1.0, of a C-order array of the given shape.
+// The header is padded so the payload starts 64-byte aligned.
+void saveNpy(
+	const char *path,
+	const char *descr,
+	int dims,
+	const int *shape,
+	const void *data,
+	size_t size
+) {
+	char dict[128];
+	int len;
+	if(dims == 1) {
+		len = snprintf(
+			dict,
+			sizeof(dict),
+			"{'descr': '%s', 'fortran_order': False, 'shape': (%d,), }",
+			descr,
+			shape[0]
+		);
+	} else {
+		len = snprintf(
+			dict,
+			sizeof(dict),
+			"{'descr': '%s', 'fortran_order': False, 'shape': (%d, %d), }",
+			descr,
+			shape[0],
+			shape[1]
+		);
+	}
+	int headerLen = (10 + len + 1 + 63) / 64 * 64 - 10;
+
+	char header[256];
+	memcpy(header, "\x93NUMPY\x01\x00", 8);
+	header[8] = headerLen & 0xff;
+	header[9] = headerLen >> 8;
+	memcpy(header + 10, dict, len);
+	memset(header + 10 + len, ' ', headerLen - len - 1);
+	header[10 + headerLen - 1] = '\n';
+
+	FILE *file = fopen(path, "wb");
+	if(file == NULL) {
+		fprintf(stderr, "Cannot open %s for writing.\n", path);
+		exit(1);
+	}
+	if(
+		fwrite(header, 1, 10 + headerLen, file) != (size_t)(10 + headerLen)
+		|| fwrite(data, 1, size, file) != size
+	) {
+		fprintf(stderr, "Cannot write to %s.\n", path);
+		exit(1);
+	}
+	fclose(file);
+}
+
+// Maps an .npy file copy-on-write and returns a pointer to its payload, after
+// checking its element type and number of dimensions. The mapping is never
+// released, as the host memory of vectors and matrices never is.
+void *loadNpy(
+	const char *path,
+	const char *descr,
+	size_t elemSize,
+	int dims,
+	int *shape
+) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		fprintf(stderr, "Cannot open %s for reading.\n", path);
+		exit(1);
+	}
+	struct stat info;
+	fstat(fd, &info);
+	size_t fileSize = info.st_size;
+	if(fileSize < 10) {
+		fprintf(stderr, "Cannot load %s. Not an .npy file.\n", path);
+		exit(1);
+	}
+	char *map = (char*)mmap(
+		NULL,
+		fileSize,
+		PROT_READ | PROT_WRITE,
+		MAP_PRIVATE,
+		fd,
+		0
+	);
+	close(fd);
+	if(map == MAP_FAILED) {
+		fprintf(stderr, "Cannot map %s into memory.\n", path);
+		exit(1);
+	}
+
+	const unsigned char *bytes = (const unsigned char*)map;
+	if(memcmp(map, "\x93NUMPY", 6) != 0 || bytes[6] < 1 || bytes[6] > 3) {
+		fprintf(stderr, "Cannot load %s. Not an .npy file.\n", path);
+		exit(1);
+	}
+	size_t offset;
+	size_t headerLen;
+	if(bytes[6] == 1) {
+		headerLen = bytes[8] | bytes[9] << 8;
+		offset = 10;
+	} else {
+		headerLen = bytes[8] | bytes[9] << 8 | bytes[10] << 16
+			| (size_t)bytes[11] << 24;
+		offset = 12;
+	}
+	if(offset + headerLen > fileSize) {
+		fprintf(stderr, "Cannot load %s. Header is truncated.\n", path);
+		exit(1);
+	}
+
+	// Parse the header dictionary
+	char *dict = (char*)malloc(headerLen + 1);
+	memcpy(dict, map + offset, headerLen);
+	dict[headerLen] = '\0';
+	offset += headerLen;
+
+	char type[16] = "";
+	char *entry = strstr(dict, "'descr'");
+	char *quote = entry == NULL ? NULL : strchr(entry + 7, '\'');
+	if(quote != NULL) sscanf(quote, "'%15[^']'", type);
+	if(strcmp(type, descr) != 0) {
+		fprintf(
+			stderr,
+			"Cannot load %s. Element type is %s, expected %s.\n",
+			path,
+			type,
+			descr
+		);
+		exit(1);
+	}
+
+	entry = strstr(dict, "'fortran_order'");
+	if(entry == NULL || strstr(entry, "False") == NULL) {
+		fprintf(stderr, "Cannot load %s. Array is not in C order.\n", path);
+		exit(1);
+	}
+
+	entry = strstr(dict, "'shape'");
+	char *paren = entry == NULL ? NULL : strchr(entry, '(');
+	int found = 0;
+	size_t count = 1;
+	if(paren != NULL) {
+		char *cur = paren + 1;
+		while(true) {
+			while(*cur == ' ' || *cur == ',') cur++;
+			if(*cur == ')' || *cur == '\0') break;
+			long dim = strtol(cur, &cur, 10);
+			if(found < dims) shape[found] = dim;
+			count *= dim;
+			found++;
+		}
+	}
+	free(dict);
+	if(found != dims) {
+		fprintf(
+			stderr,
+			"Cannot load %s. Array has %d dimensions, expected %d.\n",
+			path,
+			found,
+			dims
+		);
+		exit(1);
+	}
+	if(offset + count * elemSize > fileSize) {
+		fprintf(stderr, "Cannot load %s. Data is truncated.\n", path);
+		exit(1);
+	}
+
+	return map + offset;
+}
+
+// Maps a whole file read-only, setting its size
+const char *mapText(const char *path, size_t *size) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		fprintf(stderr, "Cannot open %s for reading.\n", path);
+		exit(1);
+	}
+	struct stat info;
+	fstat(fd, &info);
+	*size = info.st_size;
+	if(*size == 0) {
+		close(fd);
+		return NULL;
+	}
+	void *map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		fprintf(stderr, "Cannot map %s into memory.\n", path);
+		exit(1);
+	}
+	return (const char*)map;
+}
+
+// Number of threads for work of the given size, at least grain per thread
+int workerCount(size_t size, size_t grain) {
+	size_t threads = std::thread::hardware_concurrency();
+	if(threads < 1) threads = 1;
+	if(threads > size / grain + 1) threads = size / grain + 1;
+	return threads;
+}
+
+const char *lineEnd(const char *p, const char *end) {
+	const char *newline = (const char*)memchr(p, '\n', end - p);
+	return newline == NULL ? end : newline;
+}
+
+bool blankLine(const char *p, const char *end) {
+	for(; p < end; p++) {
+		if(*p != ' ' && *p != '\t' && *p != '\r') return false;
+	}
+	return true;
+}
+
+// Parses a line of comma-separated numbers into row, up to maxFields of them.
+// Returns the number of fields, or -1 if one is not a number.
+int parseLine(const char *p, const char *end, double *row, int maxFields) {
+	int fields = 0;
+	while(true) {
+		while(p < end && (*p == ' ' || *p == '\t')) p++;
+		if(p < end && *p == '+') p++;
+		double x;
+		std::from_chars_result res = std::from_chars(p, end, x);
+		if(res.ec != std::errc()) return -1;
+		if(fields < maxFields) row[fields] = x;
+		fields++;
+
+		p = res.ptr;
+		while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+		if(p == end) return fields;
+		if(*p != ',') return -1;
+		p++;
+	}
+}
+
+// Vec
+Vec Vec::load(const char *path) {
+	int shape[1];
+	double *components =
+		(double*)loadNpy(path, "<f8", sizeof(double), 1, shape);
+	Vec res = Vec(shape[0], components);
+	res.update();
+	return res;
+}
+void Vec::save(const char *path) const {
+	saveNpy(path, "<f8", 1, &d, data, d * sizeof(double));
+}
+
+// Mat
+Mat Mat::load(const char *path) {
+	int shape[2];
+	double *components =
+		(double*)loadNpy(path, "<f8", sizeof(double), 2, shape);
+	Mat res = Mat(shape[0], shape[1], components);
+	res.update();
+	return res;
+}
+void Mat::save(const char *path) const {
+	int shape[2] = {h, w};
+	saveNpy(path, "<f8", 2, shape, data, w*h * sizeof(double));
+}
+Mat Mat::fromCSV(const char *path) {
+	size_t size;
+	const char *text = mapText(path, &size);
+	const char *end = text + size;
+
+	// Skip blank lines and a header, found by its first field not being a
+	// number. The first row of data gives the width.
+	const char *p = text;
+	int width = -1;
+	bool header = false;
+	while(p < end) {
+		const char *next = lineEnd(p, end);
+		if(!blankLine(p, next)) {
+			width = parseLine(p, next, NULL, 0);
+			if(width > 0 || header) break;
+			header = true;
+		}
+		p = next + 1;
+	}
+	if(width <= 0) {
+		fprintf(stderr, "Cannot read %s. No rows of numbers found.\n", path);
+		exit(1);
+	}
+
+	// Split the rows into chunks at line boundaries, one per thread
+	int threads = workerCount(end - p, 1 << 16);
+	const char **bounds = (const char**)malloc((threads+1) * sizeof(char*));
+	bounds[0] = p;
+	bounds[threads] = end;
+	for(int t = 1; t < threads; t++) {
+		const char *guess = p + (end - p) * t / threads;
+		if(guess < bounds[t-1]) guess = bounds[t-1];
+		bounds[t] = guess == end ? end : lineEnd(guess, end) + 1;
+		if(bounds[t] > end) bounds[t] = end;
+	}
+
+	// Count each chunk's rows, then parse them into their place
+	int *firstRow = (int*)malloc((threads+1) * sizeof(int));
+	int *badRow = (int*)malloc(threads * sizeof(int));
+	std::thread *workers = new std::thread[threads];
+	for(int t = 0; t < threads; t++) {
+		workers[t] = std::thread([=]() {
+			int rows = 0;
+			for(const char *q = bounds[t]; q < bounds[t+1];) {
+				const char *next = lineEnd(q, bounds[t+1]);
+				if(!blankLine(q, next)) rows++;
+				q = next + 1;
+			}
+			firstRow[t+1] = rows;
+		});
+	}
+	firstRow[0] = 0;
+	for(int t = 0; t < threads; t++) {
+		workers[t].join();
+	}
+	for(int t = 0; t < threads; t++) {
+		firstRow[t+1] += firstRow[t];
+	}
+	int height = firstRow[threads];
+
+	double *components =
+		(double*)FinLin::allocHost((size_t)width*height * sizeof(double));
+	for(int t = 0; t < threads; t++) {
+		workers[t] = std::thread([=]() {
+			badRow[t] = -1;
+			int r = firstRow[t];
+			for(const char *q = bounds[t]; q < bounds[t+1];) {
+				const char *next = lineEnd(q, bounds[t+1]);
+				if(!blankLine(q, next)) {
+					double *row = components + (size_t)r*width;
+					if(parseLine(q, next, row, width) != width) {
+						badRow[t] = r;
+						return;
+					}
+					r++;
+				}
+				q = next + 1;
+			}
+		});
+	}
+	for(int t = 0; t < threads; t++) {
+		workers[t].join();
+	}
+	for(int t = 0; t < threads; t++) {
+		if(badRow[t] >= 0) {
+			fprintf(
+				stderr,
+				"Cannot read %s. Row %d does not have %d numbers.\n",
+				path,
+				badRow[t] + 1,
+				width
+			);
+			exit(1);
+		}
+	}
+
+	delete[] workers;
+	free(bounds);
+	free(firstRow);
+	free(badRow);
+	munmap((void*)text, size);
+
+	Mat res = Mat(height, width, components);
+	res.update();
+	return res;
+}
+void Mat::toCSV(const char *path) const {
+	FILE *file = fopen(path, "w");
+	if(file == NULL) {
+		fprintf(stderr, "Cannot open %s for writing.\n", path);
+		exit(1);
+	}
+
+	// Each thread formats a range of rows into its own buffer. Shortest
+	// round-trip formatting takes at most 24 characters per number.
+	int threads = workerCount((size_t)w*h, 1 << 14);
+	char **text = (char**)malloc(threads * sizeof(char*));
+	size_t *lengths = (size_t*)malloc(threads * sizeof(size_t));
+	std::thread *workers = new std::thread[threads];
+	for(int t = 0; t < threads; t++) {
+		workers[t] = std::thread([=]() {
+			int r0 = (long)h * t / threads;
+			int r1 = (long)h * (t+1) / threads;
+			char *buf = (char*)malloc((size_t)(r1 - r0) * w * 25 + 1);
+			char *q = buf;
+			for(int r = r0; r < r1; r++) {
+				for(int c = 0; c < w; c++) {
+					q = std::to_chars(q, q + 24, data[(size_t)r*w + c]).ptr;
+					*q++ = c + 1 < w ? ',' : '\n';
+				}
+			}
+			text[t] = buf;
+			lengths[t] = q - buf;
+		});
+	}
+	for(int t = 0; t < threads; t++) {
+		workers[t].join();
+	}
+
+	for(int t = 0; t < threads; t++) {
+		if(fwrite(text[t], 1, lengths[t], file) != lengths[t]) {
+			fprintf(stderr, "Cannot write to %s.\n", path);
+			exit(1);
+		}
+		free(text[t]);
+	}
+	fclose(file);
+
+	delete[] workers;
+	free(text);
+	free(lengths);
+}
+
+// Veci
+Veci Veci::load(const char *path) {
+	int shape[1];
+	int *components = (int*)loadNpy(path, "<i4", sizeof(int), 1, shape);
+	Veci res = Veci(shape[0], components);
+	res.update();
+	return res;
+}
+void Veci::save(const char *path) const {
+	saveNpy(path, "<i4", 1, &d, data, d * sizeof(int));
+}
+
+// Mati
+Mati Mati::load(const char *path) {
+	int shape[2];
+	int *components = (int*)loadNpy(path, "<i4", sizeof(int), 2, shape);
+	Mati res = Mati(shape[0], shape[1], components);
+	res.update();
+	return res;
+}
+void Mati::save(const char *path) const {
+	int shape[2] = {h, w};
+	saveNpy(path, "<i4", 2, shape, data, w*h * sizeof(int));
+}
+
+// Vecl
+Vecl Vecl::load(const char *path) {
+	int shape[1];
+	int64_t *components =
+		(int64_t*)loadNpy(path, "<i8", sizeof(int64_t), 1, shape);
+	Vecl res = Vecl(shape[0], components);
+	res.update();
+	return res;
+}
+void Vecl::save(const char *path) const {
+	saveNpy(path, "<i8", 1, &d, data, d * sizeof(int64_t));
+}
+
+// Matl
+Matl Matl::load(const char *path) {
+	int shape[2];
+	int64_t *components =
+		(int64_t*)loadNpy(path, "<i8", sizeof(int64_t), 2, shape);
+	Matl res = Matl(shape[0], shape[1], components);
+	res.update();
+	return res;
+}
+void Matl::save(const char *path) const {
+	int shape[2] = {h, w};
+	saveNpy(path, "<i8", 2, shape, data, w*h * sizeof(int64_t));
+}
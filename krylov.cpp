@@ -0,0 +1,870 @@
+// Copyright (c) 2021 Thomas Kaldahl
+
+#include "finlin.hpp"
+
+// Helper functions
+
+// Cyclic Jacobi eigenvalue algorithm for the symmetric n by n matrix a, which
+// is destroyed. Eigenvectors are written to the columns of vecs.
+void jacobiEigen(int n, double *a, double *vals, double *vecs) {
+	double total = 0;
+	for(int i = 0; i < n*n; i++) {
+		vecs[i] = i % (n+1) == 0 ? 1 : 0;
+		total += a[i] * a[i];
+	}
+
+	for(int sweep = 0; sweep < 64; sweep++) {
+		double off = 0;
+		for(int p = 0; p < n; p++) {
+			for(int q = p+1; q < n; q++) {
+				off += a[p*n + q] * a[p*n + q];
+			}
+		}
+		if(off <= 1e-32 * total) break;
+
+		for(int p = 0; p < n; p++) {
+			for(int q = p+1; q < n; q++) {
+				if(a[p*n + q] == 0) continue;
+
+				double theta = (a[q*n + q] - a[p*n + p]) / (2 * a[p*n + q]);
+				double t = 1 / (fabs(theta) + sqrt(theta*theta + 1));
+				if(theta < 0) t = -t;
+				double c = 1 / sqrt(t*t + 1);
+				double s = t * c;
+
+				for(int i = 0; i < n; i++) {
+					double ap = a[i*n + p];
+					double aq = a[i*n + q];
+					a[i*n + p] = c*ap - s*aq;
+					a[i*n + q] = s*ap + c*aq;
+				}
+				for(int i = 0; i < n; i++) {
+					double ap = a[p*n + i];
+					double aq = a[q*n + i];
+					a[p*n + i] = c*ap - s*aq;
+					a[q*n + i] = s*ap + c*aq;
+				}
+				for(int i = 0; i < n; i++) {
+					double vp = vecs[i*n + p];
+					double vq = vecs[i*n + q];
+					vecs[i*n + p] = c*vp - s*vq;
+					vecs[i*n + q] = s*vp + c*vq;
+				}
+			}
+		}
+	}
+
+	for(int i = 0; i < n; i++) {
+		vals[i] = a[i*n + i];
+	}
+}
+
+// One-sided Jacobi SVD of the n by n matrix a, which is replaced by the left
+// singular vectors. Right singular vectors are written to the columns of vecs.
+void jacobiSVD(int n, double *a, double *vals, double *vecs) {
+	for(int i = 0; i < n*n; i++) {
+		vecs[i] = i % (n+1) == 0 ? 1 : 0;
+	}
+
+	for(int sweep = 0; sweep < 64; sweep++) {
+		bool rotated = false;
+		for(int p = 0; p < n; p++) {
+			for(int q = p+1; q < n; q++) {
+				double alpha = 0;
+				double beta = 0;
+				double gamma = 0;
+				for(int i = 0; i < n; i++) {
+					alpha += a[i*n + p] * a[i*n + p];
+					beta += a[i*n + q] * a[i*n + q];
+					gamma += a[i*n + p] * a[i*n + q];
+				}
+				if(fabs(gamma) <= 1e-15 * sqrt(alpha * beta)) continue;
+				rotated = true;
+
+				double zeta = (beta - alpha) / (2 * gamma);
+				double t = 1 / (fabs(zeta) + sqrt(zeta*zeta + 1));
+				if(zeta < 0) t = -t;
+				double c = 1 / sqrt(t*t + 1);
+				double s = t * c;
+
+				for(int i = 0; i < n; i++) {
+					double ap = a[i*n + p];
+					double aq = a[i*n + q];
+					a[i*n + p] = c*ap - s*aq;
+					a[i*n + q] = s*ap + c*aq;
+				}
+				for(int i = 0; i < n; i++) {
+					double vp = vecs[i*n + p];
+					double vq = vecs[i*n + q];
+					vecs[i*n + p] = c*vp - s*vq;
+					vecs[i*n + q] = s*vp + c*vq;
+				}
+			}
+		}
+		if(!rotated) break;
+	}
+
+	for(int j = 0; j < n; j++) {
+		double norm = 0;
+		for(int i = 0; i < n; i++) {
+			norm += a[i*n + j] * a[i*n + j];
+		}
+		vals[j] = sqrt(norm);
+		for(int i = 0; i < n; i++) {
+			if(vals[j] != 0) a[i*n + j] /= vals[j];
+		}
+	}
+}
+
+// Indices of vals, sorted by decreasing magnitude
+int *magnitudeOrder(int n, const double *vals) {
+	int *order = (int*)malloc(n * sizeof(int));
+	for(int i = 0; i < n; i++) {
+		int j = i;
+		while(j > 0 && fabs(vals[order[j-1]]) < fabs(vals[i])) {
+			order[j] = order[j-1];
+			j--;
+		}
+		order[j] = i;
+	}
+	return order;
+}
+
+void ensureSquareSystem(int h, int w, int d, const char *solver) {
+	if(w != h) {
+		fprintf(
+			stderr,
+			"Cannot use %s on non-square matrix.\n",
+			solver
+		);
+		exit(1);
+	}
+	if(d != h) {
+		fprintf(
+			stderr,
+			"Dimension mismatch. "
+			"Cannot use %s on system of height %d with right-hand side "
+			"of dimension %d.\n",
+			solver,
+			h,
+			d
+		);
+		exit(1);
+	}
+}
+
+// Technical methods
+void Mat::mulVec(cl_mem vec, cl_mem prod) const {
+	FinLin::setArg(FinLin::matVec, 0, mem());
+	FinLin::setArg(FinLin::matVec, 1, vec);
+	FinLin::setArg(FinLin::matVec, 2, prod);
+	FinLin::setArg(FinLin::matVec, 3, w);
+	FinLin::execKernel(FinLin::matVec, 0, h, 0);
+}
+cl_mem Mat::invDiagonal() const {
+	cl_mem diag = FinLin::createBuffer(h * sizeof(double));
+	FinLin::setArg(FinLin::invDiagonal, 0, mem());
+	FinLin::setArg(FinLin::invDiagonal, 1, diag);
+	FinLin::setArg(FinLin::invDiagonal, 2, w);
+	FinLin::execKernel(FinLin::invDiagonal, 0, h, 0);
+	return diag;
+}
+
+void Mat::arnoldiStep(
+	cl_mem basis,
+	cl_mem hess,
+	cl_mem corr,
+	int ldh,
+	int j,
+	cl_mem diag,
+	cl_mem vec,
+	cl_mem prod
+) const {
+	int n = h;
+
+	FinLin::copyBuffer(basis, vec, j*n * sizeof(double), 0, n * sizeof(double));
+	if(diag != NULL) {
+		FinLin::setArg(FinLin::hadamard, 0, vec);
+		FinLin::setArg(FinLin::hadamard, 1, diag);
+		FinLin::execKernel(FinLin::hadamard, 0, n, 0);
+	}
+	mulVec(vec, prod);
+
+	// Classical Gram-Schmidt, twice
+	FinLin::gemm(
+		j+1, 1, n, 1.0,
+		basis, 0, n, false,
+		prod, 0, 1, false,
+		0.0, hess, j*ldh, 1
+	);
+	FinLin::gemm(
+		n, 1, j+1, -1.0,
+		basis, 0, n, true,
+		hess, j*ldh, 1, false,
+		1.0, prod, 0, 1
+	);
+	FinLin::gemm(
+		j+1, 1, n, 1.0,
+		basis, 0, n, false,
+		prod, 0, 1, false,
+		0.0, corr, j*ldh, 1
+	);
+	FinLin::gemm(
+		n, 1, j+1, -1.0,
+		basis, 0, n, true,
+		corr, j*ldh, 1, false,
+		1.0, prod, 0, 1
+	);
+	FinLin::setArg(FinLin::add, 0, hess);
+	FinLin::setArg(FinLin::add, 1, corr);
+	FinLin::execKernel(FinLin::add, j*ldh, j+1, 0);
+
+	FinLin::dot(prod, prod, n, hess, j*ldh + j+1, true);
+	FinLin::setArg(FinLin::divideBySlot, 0, basis);
+	FinLin::setArg(FinLin::divideBySlot, 1, prod);
+	FinLin::setArg(FinLin::divideBySlot, 2, hess);
+	FinLin::setArg(FinLin::divideBySlot, 3, j*ldh + j+1);
+	FinLin::setArg(FinLin::divideBySlot, 4, (j+1)*n);
+	FinLin::execKernel(FinLin::divideBySlot, 0, n, 0);
+}
+
+// Iterative solvers
+Vec Mat::cg(Vec rhs, double tol, int maxIter, bool jacobi) {
+	ensureSquareSystem(h, w, rhs.d, "conjugate gradient");
+	int n = h;
+	update();
+	rhs.update();
+
+	Vec x = Vec(n);
+	x.update();
+
+	// Scalars {r.z, r.z, p.Ap, r.r}, alternating between the first two
+	cl_mem s = FinLin::createBuffer(4 * sizeof(double));
+	cl_mem r = FinLin::createBuffer(n * sizeof(double));
+	cl_mem p = FinLin::createBuffer(n * sizeof(double));
+	cl_mem q = FinLin::createBuffer(n * sizeof(double));
+	cl_mem diag = jacobi ? invDiagonal() : NULL;
+	cl_mem z = jacobi ? FinLin::createBuffer(n * sizeof(double)) : r;
+
+	double sqrNorm;
+	FinLin::dot(rhs.mem(), rhs.mem(), n, s, 3, false);
+	FinLin::readBuffer(s, 3 * sizeof(double), sizeof(double), &sqrNorm);
+	double bound = tol*tol * sqrNorm;
+
+	// The initial guess is zero, so the residual is rhs
+	FinLin::copyBuffer(rhs.mem(), r, 0, 0, n * sizeof(double));
+	if(jacobi) {
+		FinLin::setArg(FinLin::hadamardOut, 0, z);
+		FinLin::setArg(FinLin::hadamardOut, 1, r);
+		FinLin::setArg(FinLin::hadamardOut, 2, diag);
+		FinLin::execKernel(FinLin::hadamardOut, 0, n, 0);
+	}
+	FinLin::copyBuffer(z, p, 0, 0, n * sizeof(double));
+	FinLin::dot(r, z, n, s, 0, false);
+
+	int cur = 0;
+	for(int it = 1; it <= maxIter && sqrNorm != 0; it++) {
+		mulVec(p, q);
+		FinLin::dot(p, q, n, s, 2, false);
+
+		FinLin::setArg(FinLin::axpyRatio, 0, x.mem());
+		FinLin::setArg(FinLin::axpyRatio, 1, p);
+		FinLin::setArg(FinLin::axpyRatio, 2, s);
+		FinLin::setArg(FinLin::axpyRatio, 3, cur);
+		FinLin::setArg(FinLin::axpyRatio, 4, 2);
+		FinLin::setArg(FinLin::axpyRatio, 5, 1.0);
+		FinLin::execKernel(FinLin::axpyRatio, 0, n, 0);
+
+		FinLin::setArg(FinLin::axpyRatio, 0, r);
+		FinLin::setArg(FinLin::axpyRatio, 1, q);
+		FinLin::setArg(FinLin::axpyRatio, 5, -1.0);
+		FinLin::execKernel(FinLin::axpyRatio, 0, n, 0);
+
+		if(it % CHECK_INTERVAL == 0 || it == maxIter) {
+			double sqrRes;
+			FinLin::dot(r, r, n, s, 3, false);
+			FinLin::readBuffer(s, 3 * sizeof(double), sizeof(double), &sqrRes);
+			if(sqrRes <= bound) break;
+		}
+
+		if(jacobi) {
+			FinLin::setArg(FinLin::hadamardOut, 0, z);
+			FinLin::setArg(FinLin::hadamardOut, 1, r);
+			FinLin::setArg(FinLin::hadamardOut, 2, diag);
+			FinLin::execKernel(FinLin::hadamardOut, 0, n, 0);
+		}
+		FinLin::dot(r, z, n, s, 1 - cur, false);
+
+		FinLin::setArg(FinLin::xpayRatio, 0, p);
+		FinLin::setArg(FinLin::xpayRatio, 1, z);
+		FinLin::setArg(FinLin::xpayRatio, 2, s);
+		FinLin::setArg(FinLin::xpayRatio, 3, 1 - cur);
+		FinLin::setArg(FinLin::xpayRatio, 4, cur);
+		FinLin::execKernel(FinLin::xpayRatio, 0, n, 0);
+
+		cur = 1 - cur;
+	}
+
+	FinLin::readBuffer(x.mem(), 0, n * sizeof(double), x.data);
+
+	clReleaseMemObject(s);
+	clReleaseMemObject(r);
+	clReleaseMemObject(p);
+	clReleaseMemObject(q);
+	if(jacobi) {
+		clReleaseMemObject(diag);
+		clReleaseMemObject(z);
+	}
+
+	return x;
+}
+
+Vec Mat::bicgstab(Vec rhs, double tol, int maxIter, bool jacobi) {
+	ensureSquareSystem(h, w, rhs.d, "BiCGSTAB");
+	int n = h;
+	update();
+	rhs.update();
+
+	Vec x = Vec(n);
+	x.update();
+
+	// Scalars {rho, rhoNew, alpha, omega, rhat.v, t.s, t.t, r.r}
+	double init[8] = {1, 0, 1, 1, 0, 0, 0, 0};
+	cl_mem s = FinLin::createBuffer(8 * sizeof(double));
+	FinLin::writeBuffer(s, 0, 8 * sizeof(double), init);
+
+	cl_mem r = FinLin::createBuffer(n * sizeof(double));
+	cl_mem rhat = FinLin::createBuffer(n * sizeof(double));
+	cl_mem p = FinLin::createBuffer(n * sizeof(double));
+	cl_mem v = FinLin::createBuffer(n * sizeof(double));
+	cl_mem half = FinLin::createBuffer(n * sizeof(double));
+	cl_mem t = FinLin::createBuffer(n * sizeof(double));
+	cl_mem diag = jacobi ? invDiagonal() : NULL;
+	cl_mem phat = jacobi ? FinLin::createBuffer(n * sizeof(double)) : p;
+	cl_mem shat = jacobi ? FinLin::createBuffer(n * sizeof(double)) : half;
+
+	double sqrNorm;
+	FinLin::dot(rhs.mem(), rhs.mem(), n, s, 7, false);
+	FinLin::readBuffer(s, 7 * sizeof(double), sizeof(double), &sqrNorm);
+	double bound = tol*tol * sqrNorm;
+
+	FinLin::copyBuffer(rhs.mem(), r, 0, 0, n * sizeof(double));
+	FinLin::copyBuffer(rhs.mem(), rhat, 0, 0, n * sizeof(double));
+	FinLin::zeroBuffer(p, n * sizeof(double));
+	FinLin::zeroBuffer(v, n * sizeof(double));
+
+	for(int it = 1; it <= maxIter && sqrNorm != 0; it++) {
+		FinLin::dot(rhat, r, n, s, 1, false);
+
+		FinLin::setArg(FinLin::bicgstabDirection, 0, p);
+		FinLin::setArg(FinLin::bicgstabDirection, 1, r);
+		FinLin::setArg(FinLin::bicgstabDirection, 2, v);
+		FinLin::setArg(FinLin::bicgstabDirection, 3, s);
+		FinLin::execKernel(FinLin::bicgstabDirection, 0, n, 0);
+
+		if(jacobi) {
+			FinLin::setArg(FinLin::hadamardOut, 0, phat);
+			FinLin::setArg(FinLin::hadamardOut, 1, p);
+			FinLin::setArg(FinLin::hadamardOut, 2, diag);
+			FinLin::execKernel(FinLin::hadamardOut, 0, n, 0);
+		}
+		mulVec(phat, v);
+		FinLin::dot(rhat, v, n, s, 4, false);
+
+		FinLin::setArg(FinLin::bicgstabHalf, 0, half);
+		FinLin::setArg(FinLin::bicgstabHalf, 1, r);
+		FinLin::setArg(FinLin::bicgstabHalf, 2, v);
+		FinLin::setArg(FinLin::bicgstabHalf, 3, s);
+		FinLin::execKernel(FinLin::bicgstabHalf, 0, n, 0);
+
+		if(jacobi) {
+			FinLin::setArg(FinLin::hadamardOut, 0, shat);
+			FinLin::setArg(FinLin::hadamardOut, 1, half);
+			FinLin::setArg(FinLin::hadamardOut, 2, diag);
+			FinLin::execKernel(FinLin::hadamardOut, 0, n, 0);
+		}
+		mulVec(shat, t);
+		FinLin::dot(t, half, n, s, 5, false);
+		FinLin::dot(t, t, n, s, 6, false);
+
+		FinLin::setArg(FinLin::bicgstabUpdate, 0, x.mem());
+		FinLin::setArg(FinLin::bicgstabUpdate, 1, r);
+		FinLin::setArg(FinLin::bicgstabUpdate, 2, phat);
+		FinLin::setArg(FinLin::bicgstabUpdate, 3, shat);
+		FinLin::setArg(FinLin::bicgstabUpdate, 4, half);
+		FinLin::setArg(FinLin::bicgstabUpdate, 5, t);
+		FinLin::setArg(FinLin::bicgstabUpdate, 6, s);
+		FinLin::execKernel(FinLin::bicgstabUpdate, 0, n, 0);
+
+		if(it % CHECK_INTERVAL == 0 || it == maxIter) {
+			double sqrRes;
+			FinLin::dot(r, r, n, s, 7, false);
+			FinLin::readBuffer(s, 7 * sizeof(double), sizeof(double), &sqrRes);
+			if(sqrRes <= bound) break;
+		}
+	}
+
+	FinLin::readBuffer(x.mem(), 0, n * sizeof(double), x.data);
+
+	clReleaseMemObject(s);
+	clReleaseMemObject(r);
+	clReleaseMemObject(rhat);
+	clReleaseMemObject(p);
+	clReleaseMemObject(v);
+	clReleaseMemObject(half);
+	clReleaseMemObject(t);
+	if(jacobi) {
+		clReleaseMemObject(diag);
+		clReleaseMemObject(phat);
+		clReleaseMemObject(shat);
+	}
+
+	return x;
+}
+
+Vec Mat::gmres(Vec rhs, int restart, double tol, int maxIter, bool jacobi) {
+	ensureSquareSystem(h, w, rhs.d, "GMRES");
+	int n = h;
+	int m = restart < n ? restart : n; // Krylov subspace dimension
+	int ldh = m + 1;
+	update();
+	rhs.update();
+
+	Vec x = Vec(n);
+	x.update();
+
+	// Basis vectors are the rows of basis. The Hessenberg matrix is stored
+	// column by column, and corr holds the second orthogonalization pass.
+	cl_mem basis = FinLin::createBuffer((m+1)*n * sizeof(double));
+	cl_mem hess = FinLin::createBuffer(m*ldh * sizeof(double));
+	cl_mem corr = FinLin::createBuffer(m*ldh * sizeof(double));
+	cl_mem g = FinLin::createBuffer(ldh * sizeof(double));
+	cl_mem rot = FinLin::createBuffer(2*m * sizeof(double));
+	cl_mem breakdown = FinLin::createBuffer(sizeof(int));
+	cl_mem y = FinLin::createBuffer(m * sizeof(double));
+	cl_mem vec = FinLin::createBuffer(n * sizeof(double));
+	cl_mem prod = FinLin::createBuffer(n * sizeof(double));
+	cl_mem diag = jacobi ? invDiagonal() : NULL;
+
+	double norm;
+	FinLin::dot(rhs.mem(), rhs.mem(), n, g, 0, true);
+	FinLin::readBuffer(g, 0, sizeof(double), &norm);
+	double bound = tol * norm;
+
+	bool converged = norm == 0;
+	int it = 0;
+	while(!converged && it < maxIter) {
+		// Residual of the current solution
+		if(it == 0) {
+			FinLin::copyBuffer(rhs.mem(), prod, 0, 0, n * sizeof(double));
+		} else {
+			mulVec(x.mem(), prod);
+			FinLin::setArg(FinLin::scale, 0, prod);
+			FinLin::setArg(FinLin::scale, 1, -1.0);
+			FinLin::execKernel(FinLin::scale, 0, n, 0);
+			FinLin::setArg(FinLin::add, 0, prod);
+			FinLin::setArg(FinLin::add, 1, rhs.mem());
+			FinLin::execKernel(FinLin::add, 0, n, 0);
+		}
+		FinLin::dot(prod, prod, n, g, 0, true);
+		FinLin::setArg(FinLin::divideBySlot, 0, basis);
+		FinLin::setArg(FinLin::divideBySlot, 1, prod);
+		FinLin::setArg(FinLin::divideBySlot, 2, g);
+		FinLin::setArg(FinLin::divideBySlot, 3, 0);
+		FinLin::setArg(FinLin::divideBySlot, 4, 0);
+		FinLin::execKernel(FinLin::divideBySlot, 0, n, 0);
+
+		// Arnoldi process
+		int j = 0;
+		while(j < m && it < maxIter) {
+			arnoldiStep(basis, hess, corr, ldh, j, diag, vec, prod);
+
+			FinLin::setArg(FinLin::gmresGivens, 0, hess);
+			FinLin::setArg(FinLin::gmresGivens, 1, rot);
+			FinLin::setArg(FinLin::gmresGivens, 2, g);
+			FinLin::setArg(FinLin::gmresGivens, 3, breakdown);
+			FinLin::setArg(FinLin::gmresGivens, 4, j);
+			FinLin::setArg(FinLin::gmresGivens, 5, ldh);
+			FinLin::execKernel(FinLin::gmresGivens, 0, 1, 0);
+
+			j++;
+			it++;
+			if(it % CHECK_INTERVAL == 0 || j == m || it == maxIter) {
+				// Columns after a breakdown are zero, so the cycle ends at it
+				int lucky;
+				FinLin::readBuffer(breakdown, 0, sizeof(int), &lucky);
+				if(lucky > 0) {
+					j = lucky;
+					converged = true;
+					break;
+				}
+				double res;
+				FinLin::readBuffer(g, j * sizeof(double), sizeof(double), &res);
+				if(fabs(res) <= bound) {
+					converged = true;
+					break;
+				}
+			}
+		}
+
+		// Minimize over the subspace: solve the rotated Hessenberg system,
+		// then move x by the corresponding combination of basis vectors
+		FinLin::copyBuffer(g, y, 0, 0, j * sizeof(double));
+		FinLin::setArg(FinLin::triSolve, 0, hess);
+		FinLin::setArg(FinLin::triSolve, 1, y);
+		FinLin::setArg(FinLin::triSolve, 2, 0);
+		FinLin::setArg(FinLin::triSolve, 3, ldh);
+		FinLin::setArg(FinLin::triSolve, 4, 0);
+		FinLin::setArg(FinLin::triSolve, 5, 1);
+		FinLin::setArg(FinLin::triSolve, 6, 1);
+		FinLin::setArg(FinLin::triSolve, 7, j);
+		FinLin::setArg(FinLin::triSolve, 8, 0);
+		FinLin::setArg(FinLin::triSolve, 9, 1);
+		FinLin::setArg(FinLin::triSolve, 10, 0);
+		FinLin::execKernel(FinLin::triSolve, 0, 1, 0);
+
+		FinLin::gemm(
+			n, 1, j, 1.0,
+			basis, 0, n, true,
+			y, 0, 1, false,
+			0.0, vec, 0, 1
+		);
+		if(jacobi) {
+			FinLin::setArg(FinLin::hadamard, 0, vec);
+			FinLin::setArg(FinLin::hadamard, 1, diag);
+			FinLin::execKernel(FinLin::hadamard, 0, n, 0);
+		}
+		FinLin::setArg(FinLin::add, 0, x.mem());
+		FinLin::setArg(FinLin::add, 1, vec);
+		FinLin::execKernel(FinLin::add, 0, n, 0);
+	}
+
+	FinLin::readBuffer(x.mem(), 0, n * sizeof(double), x.data);
+
+	clReleaseMemObject(basis);
+	clReleaseMemObject(hess);
+	clReleaseMemObject(corr);
+	clReleaseMemObject(g);
+	clReleaseMemObject(rot);
+	clReleaseMemObject(breakdown);
+	clReleaseMemObject(y);
+	clReleaseMemObject(vec);
+	clReleaseMemObject(prod);
+	if(jacobi) clReleaseMemObject(diag);
+
+	return x;
+}
+
+// Eigensolvers and SVD
+Mat *Mat::eigenSym(int k, double tol, int maxIter) {
+	if(w != h) {
+		fprintf(stderr, "Cannot find eigenvalues of non-square matrix.\n");
+		exit(1);
+	}
+	if(k < 1 || k > h) {
+		fprintf(
+			stderr,
+			"Cannot find %d eigenvalues of %d by %d matrix.\n",
+			k,
+			h,
+			w
+		);
+		exit(1);
+	}
+	int n = h;
+	int m = 3*k > k + 32 ? 3*k : k + 32; // Largest basis before restarting
+	if(m > n) m = n;
+	int ldh = m + 1;
+	update();
+
+	cl_mem basis = FinLin::createBuffer((m+1)*n * sizeof(double));
+	cl_mem restarted = FinLin::createBuffer(m*n * sizeof(double));
+	cl_mem hess = FinLin::createBuffer(m*ldh * sizeof(double));
+	cl_mem corr = FinLin::createBuffer(m*ldh * sizeof(double));
+	cl_mem ritz = FinLin::createBuffer(m*m * sizeof(double));
+	cl_mem vec = FinLin::createBuffer(n * sizeof(double));
+	cl_mem prod = FinLin::createBuffer(n * sizeof(double));
+	cl_mem s = FinLin::createBuffer(sizeof(double));
+
+	double *hostHess = (double*)malloc(m*ldh * sizeof(double));
+	double *proj = (double*)malloc(m*m * sizeof(double));
+	double *vals = (double*)malloc(m * sizeof(double));
+	double *vecs = (double*)malloc(m*m * sizeof(double));
+	double *kept = (double*)malloc(m*m * sizeof(double));
+	int *order = NULL;
+
+	// Random starting vector
+	FinLin::randomArgs(FinLin::randomUniform, prod, n);
+	FinLin::setArg(FinLin::randomUniform, 7, -1.0);
+	FinLin::setArg(FinLin::randomUniform, 8, 1.0);
+	FinLin::execKernel(FinLin::randomUniform, 0, (n + 1) / 2, 0);
+	FinLin::dot(prod, prod, n, s, 0, true);
+	FinLin::setArg(FinLin::divideBySlot, 0, basis);
+	FinLin::setArg(FinLin::divideBySlot, 1, prod);
+	FinLin::setArg(FinLin::divideBySlot, 2, s);
+	FinLin::setArg(FinLin::divideBySlot, 3, 0);
+	FinLin::setArg(FinLin::divideBySlot, 4, 0);
+	FinLin::execKernel(FinLin::divideBySlot, 0, n, 0);
+	FinLin::zeroBuffer(hess, m*ldh * sizeof(double));
+
+	// Lanczos with full reorthogonalization, so the Arnoldi process. The
+	// projected matrix is symmetric and its upper triangle is used.
+	int j = 0;
+	int it = 0;
+	bool done = false;
+	while(!done) {
+		arnoldiStep(basis, hess, corr, ldh, j, NULL, vec, prod);
+		j++;
+		it++;
+		bool check = j % CHECK_INTERVAL == 0 || j == m || it >= maxIter;
+		if(j < k || !check) continue;
+
+		FinLin::readBuffer(hess, 0, j*ldh * sizeof(double), hostHess);
+		for(int c = 0; c < j; c++) {
+			for(int r = 0; r <= c; r++) {
+				proj[r*j + c] = hostHess[c*ldh + r];
+				proj[c*j + r] = hostHess[c*ldh + r];
+			}
+		}
+		jacobiEigen(j, proj, vals, vecs);
+		free(order);
+		order = magnitudeOrder(j, vals);
+
+		// Residual of each Ritz pair is beta times its last component. It is
+		// measured against the largest Ritz value, so that those near zero
+		// converge too.
+		double beta = hostHess[(j-1)*ldh + j];
+		double largest = fabs(vals[order[0]]);
+		done = j == n || it >= maxIter;
+		if(!done) {
+			done = true;
+			for(int i = 0; i < k; i++) {
+				double res = fabs(beta * vecs[(j-1)*j + order[i]]);
+				if(res > tol * largest) done = false;
+			}
+		}
+		if(done || j < m) continue;
+
+		// Thick restart from the best Ritz vectors and the newest basis vector
+		int keep = k + (m - k) / 2;
+		if(keep > m - 1) keep = m - 1;
+		for(int r = 0; r < j; r++) {
+			for(int c = 0; c < keep; c++) {
+				kept[r*keep + c] = vecs[r*j + order[c]];
+			}
+		}
+		FinLin::writeBuffer(ritz, 0, j*keep * sizeof(double), kept);
+		FinLin::gemm(
+			keep, n, j, 1.0,
+			ritz, 0, keep, true,
+			basis, 0, n, false,
+			0.0, restarted, 0, n
+		);
+		FinLin::copyBuffer(
+			basis,
+			basis,
+			j*n * sizeof(double),
+			keep*n * sizeof(double),
+			n * sizeof(double)
+		);
+		FinLin::copyBuffer(restarted, basis, 0, 0, keep*n * sizeof(double));
+
+		memset(hostHess, 0, m*ldh * sizeof(double));
+		for(int i = 0; i < keep; i++) {
+			hostHess[i*ldh + i] = vals[order[i]];
+		}
+		FinLin::writeBuffer(hess, 0, m*ldh * sizeof(double), hostHess);
+		j = keep;
+	}
+
+	// Ritz vectors of the k wanted eigenvalues
+	Mat values = Mat(k, k);
+	for(int r = 0; r < j; r++) {
+		for(int c = 0; c < k; c++) {
+			kept[r*k + c] = vecs[r*j + order[c]];
+		}
+	}
+	for(int i = 0; i < k; i++) {
+		values.data[i*k + i] = vals[order[i]];
+	}
+	FinLin::writeBuffer(ritz, 0, j*k * sizeof(double), kept);
+	Mat vectors = Mat(n, k);
+	FinLin::gemm(
+		n, k, j, 1.0,
+		basis, 0, n, true,
+		ritz, 0, k, false,
+		0.0, vectors.mem(), 0, k
+	);
+	FinLin::readBuffer(vectors.mem(), 0, n*k * sizeof(double), vectors.data);
+	vectors.dirty = false;
+
+	clReleaseMemObject(basis);
+	clReleaseMemObject(restarted);
+	clReleaseMemObject(hess);
+	clReleaseMemObject(corr);
+	clReleaseMemObject(ritz);
+	clReleaseMemObject(vec);
+	clReleaseMemObject(prod);
+	clReleaseMemObject(s);
+	free(hostHess);
+	free(proj);
+	free(vals);
+	free(vecs);
+	free(kept);
+	free(order);
+
+	Mat *res = (Mat*)malloc(2 * sizeof(Mat));
+	res[0] = values;
+	res[1] = vectors;
+	return res;
+}
+Mat *Mat::svdRandomized(int k, int oversample, int powerIters) {
+	int small = h < w ? h : w;
+	if(k < 1 || k > small || oversample < 0 || powerIters < 0) {
+		fprintf(
+			stderr,
+			"Cannot find rank %d SVD of %d by %d matrix "
+			"with %d oversamples and %d power iterations.\n",
+			k,
+			h,
+			w,
+			oversample,
+			powerIters
+		);
+		exit(1);
+	}
+	int l = k + oversample; // Sample columns
+	if(l > small) l = small;
+	update();
+
+	cl_mem omega = FinLin::createBuffer(w*l * sizeof(double));
+	cl_mem y = FinLin::createBuffer(h*l * sizeof(double));
+	cl_mem z = FinLin::createBuffer(w*l * sizeof(double));
+	cl_mem qy = FinLin::createBuffer(h*l * sizeof(double));
+	cl_mem qz = FinLin::createBuffer(w*l * sizeof(double));
+	cl_mem vy = FinLin::createBuffer(h*l * sizeof(double));
+	cl_mem vz = FinLin::createBuffer(w*l * sizeof(double));
+	cl_mem t = FinLin::createBuffer(l*QR_BLOCK * sizeof(double));
+	cl_mem coef = FinLin::createBuffer(l*k * sizeof(double));
+
+	// Sample the range of the matrix
+	FinLin::randomArgs(FinLin::randomNormal, omega, w*l);
+	FinLin::setArg(FinLin::randomNormal, 7, 0.0);
+	FinLin::setArg(FinLin::randomNormal, 8, 1.0);
+	FinLin::execKernel(FinLin::randomNormal, 0, (w*l + 1) / 2, 0);
+	FinLin::gemm(
+		h, l, w, 1.0,
+		mem(), 0, w, false,
+		omega, 0, l, false,
+		0.0, y, 0, l
+	);
+
+	// Power iterations, orthonormalizing in between to keep small singular
+	// values from being lost to rounding
+	for(int i = 0; i < powerIters; i++) {
+		householderQR(y, h, l, vy, t);
+		householderQ(h, l, vy, t, qy);
+		FinLin::gemm(
+			w, l, h, 1.0,
+			mem(), 0, w, true,
+			qy, 0, l, false,
+			0.0, z, 0, l
+		);
+		householderQR(z, w, l, vz, t);
+		householderQ(w, l, vz, t, qz);
+		FinLin::gemm(
+			h, l, w, 1.0,
+			mem(), 0, w, false,
+			qz, 0, l, false,
+			0.0, y, 0, l
+		);
+	}
+	householderQR(y, h, l, vy, t);
+	householderQ(h, l, vy, t, qy);
+
+	// Project onto the sampled range, B = Qy^T A, and factor B^T = Qz R so
+	// that only the small l by l factor R leaves the GPU
+	FinLin::gemm(
+		w, l, h, 1.0,
+		mem(), 0, w, true,
+		qy, 0, l, false,
+		0.0, z, 0, l
+	);
+	householderQR(z, w, l, vz, t);
+	householderQ(w, l, vz, t, qz);
+
+	double *proj = (double*)malloc(l*l * sizeof(double));
+	double *factor = (double*)malloc(l*l * sizeof(double));
+	double *vals = (double*)malloc(l * sizeof(double));
+	double *vecs = (double*)malloc(l*l * sizeof(double));
+	double *kept = (double*)malloc(l*k * sizeof(double));
+	FinLin::readBuffer(z, 0, l*l * sizeof(double), factor);
+	for(int r = 0; r < l; r++) {
+		for(int c = 0; c < l; c++) {
+			proj[r*l + c] = c <= r ? factor[c*l + r] : 0;
+		}
+	}
+
+	// B = R^T Qz^T = Ub S Vb^T Qz^T, so A is near (Qy Ub) S (Qz Vb)^T
+	jacobiSVD(l, proj, vals, vecs);
+	int *order = magnitudeOrder(l, vals);
+
+	Mat u = Mat(h, k);
+	for(int r = 0; r < l; r++) {
+		for(int c = 0; c < k; c++) {
+			kept[r*k + c] = proj[r*l + order[c]];
+		}
+	}
+	FinLin::writeBuffer(coef, 0, l*k * sizeof(double), kept);
+	FinLin::gemm(
+		h, k, l, 1.0,
+		qy, 0, l, false,
+		coef, 0, k, false,
+		0.0, u.mem(), 0, k
+	);
+	FinLin::readBuffer(u.mem(), 0, h*k * sizeof(double), u.data);
+	u.dirty = false;
+
+	Mat v = Mat(w, k);
+	for(int r = 0; r < l; r++) {
+		for(int c = 0; c < k; c++) {
+			kept[r*k + c] = vecs[r*l + order[c]];
+		}
+	}
+	FinLin::writeBuffer(coef, 0, l*k * sizeof(double), kept);
+	FinLin::gemm(
+		w, k, l, 1.0,
+		qz, 0, l, false,
+		coef, 0, k, false,
+		0.0, v.mem(), 0, k
+	);
+	FinLin::readBuffer(v.mem(), 0, w*k * sizeof(double), v.data);
+	v.dirty = false;
+
+	Mat s = Mat(k, k);
+	for(int i = 0; i < k; i++) {
+		s.data[i*k + i] = vals[order[i]];
+	}
+
+	clReleaseMemObject(omega);
+	clReleaseMemObject(y);
+	clReleaseMemObject(z);
+	clReleaseMemObject(qy);
+	clReleaseMemObject(qz);
+	clReleaseMemObject(vy);
+	clReleaseMemObject(vz);
+	clReleaseMemObject(t);
+	clReleaseMemObject(coef);
+	free(proj);
+	free(factor);
+	free(vals);
+	free(vecs);
+	free(kept);
+	free(order);
+
+	Mat *res = (Mat*)malloc(3 * sizeof(Mat));
+	res[0] = u;
+	res[1] = s;
+	res[2] = v;
+	return res;
+}
@@ -1,6 +1,7 @@
 // Copyright (c) 2021 Thomas Kaldahl
 
 #include "finlin.hpp"
+#include <float.h>
 
 // Helper functions
 void ensureSameMatDim(int h1, int w1, int h2, int w2, const char *operation) {
@@ -57,6 +58,32 @@ void ensureNonzero(int h, int w, const char *operation) {
 		exit(1);
 	}
 }
+void ensureRhsHeight(int h1, int h2) {
+	if(h1 != h2) {
+		fprintf(
+			stderr,
+			"Dimension mismatch. "
+			"Cannot solve system of height %d with right-hand side of height %d.\n",
+			h1,
+			h2
+		);
+		exit(1);
+	}
+}
+void ensureOuterDims(int h, int w, int d1, int d2) {
+	if(d1 != h || d2 != w) {
+		fprintf(
+			stderr,
+			"Dimension mismatch. "
+			"Cannot add outer product of %d and %d to %d by %d matrix.\n",
+			d1,
+			d2,
+			h,
+			w
+		);
+		exit(1);
+	}
+}
 void ensureInbound(int r, int c, int h, int w, const char *operation) {
 	if(r < 0) {
 		fprintf(
@@ -102,29 +129,375 @@ void ensureInbound(int r, int c, int h, int w, const char *operation) {
 
 // Technical methods
 void Mat::createMem() {
-	clmem = clCreateBuffer(
-		FinLin::context,
-		CL_MEM_READ_WRITE,
-		w*h * sizeof(double),
-		NULL,
-		&FinLin::err
-	);
-	FinLin::checkErr();
+	// The OpenCL memory object waits for the first operation on the GPU, so
+	// that values only ever used on the host never allocate one
+	buffer = (FinLin::Buffer*)malloc(sizeof(FinLin::Buffer));
+	buffer->clmem = NULL;
+	buffer->refs = 1;
+	buffer->pinned = false;
 	dirty = true;
 }
+cl_mem Mat::mem() const {
+	if(buffer->clmem == NULL) {
+		buffer->clmem = FinLin::createBuffer(w*h * sizeof(double));
+	}
+	return buffer->clmem;
+}
+void Mat::release() {
+	if(--buffer->refs > 0) return; // Still shared by copies
+	if(buffer->clmem != NULL) clReleaseMemObject(buffer->clmem);
+	free(buffer);
+	free(data);
+}
+void Mat::detach() {
+	if(buffer->refs == 1) return;
+
+	// This matrix moves to components of its own but keeps its GPU memory,
+	// which graphs may have recorded. The copies get a copy of that memory,
+	// not recorded, so that replays do not overwrite them.
+	FinLin::Buffer *shared = buffer;
+	shared->refs--;
+	double *components = (double*)FinLin::allocHost(w*h * sizeof(double));
+	memcpy(components, data, w*h * sizeof(double));
+	data = components;
+	buffer = (FinLin::Buffer*)malloc(sizeof(FinLin::Buffer));
+	buffer->clmem = shared->clmem;
+	buffer->refs = 1;
+	buffer->pinned = false;
+	if(shared->clmem != NULL) {
+		shared->clmem = FinLin::createBuffer(w*h * sizeof(double));
+		FinLin::err = clEnqueueCopyBuffer(
+			FinLin::commandQueue,
+			buffer->clmem,
+			shared->clmem,
+			0,
+			0,
+			w*h * sizeof(double),
+			0,
+			NULL,
+			NULL
+		);
+		FinLin::checkErr();
+	}
+}
 
 Mat Mat::copy() const {
-	Mat res = Mat(h, w);
+	// Shares these components and memory until one of the two is written,
+	// except for graph outputs, which replays overwrite, and while capturing
+	if(!buffer->pinned && FinLin::capturing == NULL) {
+		buffer->refs++;
+		return *this;
+	}
+
+	Mat res = Mat(h, w, (double*)FinLin::allocHost(w*h * sizeof(double)));
 	memcpy(res.data, data, w*h * sizeof(double));
+	// Copied on the GPU too rather than uploading again, and always while
+	// capturing, so that replays copy inputs that have been rebound
+	if(!dirty || FinLin::capturing != NULL) {
+		sync();
+		FinLin::copyBuffer(mem(), res.mem(), 0, 0, w*h * sizeof(double));
+		res.dirty = false;
+	}
+	return res;
+}
+Mat Mat::deviceCopy() const {
+	Mat res = Mat(h, w, (double*)FinLin::allocHost(w*h * sizeof(double)));
+	if(hostPath()) {
+		memcpy(res.data, data, w*h * sizeof(double));
+		return res;
+	}
+	// Uploaded straight from these components, except while capturing, when
+	// they are uploaded first so that the copy is recorded for replays
+	if(dirty && FinLin::capturing == NULL) {
+		FinLin::writeBuffer(res.mem(), 0, w*h * sizeof(double), data);
+	} else {
+		sync();
+		FinLin::copyBuffer(mem(), res.mem(), 0, 0, w*h * sizeof(double));
+	}
+	res.dirty = false;
 	return res;
 }
+bool Mat::hostPath() const {
+	// The device reads the result back, after uploading it if necessary
+	return FinLin::onHost(w*h, dirty ? 2*w*h : w*h);
+}
+void Mat::sync() const {
+	if(!dirty) return;
+	FinLin::writeBuffer(mem(), 0, w*h * sizeof(double), data);
+	dirty = false;
+}
 bool Mat::update() {
 	if(!dirty) return false;
-	FinLin::writeBuffer(clmem, 0, w*h * sizeof(double), data);
-	dirty = false;
+	sync();
 	return true;
 }
 
+void Mat::householderQR(
+	cl_mem a,
+	int height,
+	int width,
+	cl_mem v,
+	cl_mem t
+) {
+	int h = height;
+	int w = width;
+	int k = h < w ? h : w;
+	cl_mem tau = FinLin::createBuffer(k * sizeof(double));
+	cl_mem work = FinLin::createBuffer(2*QR_BLOCK*w * sizeof(double));
+
+	for(int j0 = 0; j0 < k; j0 += QR_BLOCK) {
+		int nb = k - j0 < QR_BLOCK ? k - j0 : QR_BLOCK;
+
+		// Unblocked factorization of the panel
+		for(int j = j0; j < j0 + nb; j++) {
+			FinLin::setArg(FinLin::householder, 0, a);
+			FinLin::setArg(FinLin::householder, 1, v);
+			FinLin::setArg(FinLin::householder, 2, tau);
+			FinLin::setArg(FinLin::householder, 3, w);
+			FinLin::setArg(FinLin::householder, 4, k);
+			FinLin::setArg(FinLin::householder, 5, h);
+			FinLin::setArg(FinLin::householder, 6, j);
+			FinLin::execKernel(
+				FinLin::householder,
+				0,
+				FinLin::GROUP_SIZE,
+				FinLin::GROUP_SIZE
+			);
+
+			if(j + 1 == j0 + nb) break;
+			FinLin::setArg(FinLin::applyHouseholder, 0, a);
+			FinLin::setArg(FinLin::applyHouseholder, 1, v);
+			FinLin::setArg(FinLin::applyHouseholder, 2, tau);
+			FinLin::setArg(FinLin::applyHouseholder, 3, w);
+			FinLin::setArg(FinLin::applyHouseholder, 4, k);
+			FinLin::setArg(FinLin::applyHouseholder, 5, h);
+			FinLin::setArg(FinLin::applyHouseholder, 6, j);
+			FinLin::execKernel(FinLin::applyHouseholder, j+1, j0+nb - j-1, 0);
+		}
+
+		// Compact WY form of the panel's reflectors
+		FinLin::gemm(
+			nb, nb, h - j0, 1.0,
+			v, j0*k + j0, k, true,
+			v, j0*k + j0, k, false,
+			0.0, t, j0*QR_BLOCK, QR_BLOCK
+		);
+		FinLin::setArg(FinLin::householderT, 0, t);
+		FinLin::setArg(FinLin::householderT, 1, tau);
+		FinLin::setArg(FinLin::householderT, 2, QR_BLOCK);
+		FinLin::setArg(FinLin::householderT, 3, j0);
+		FinLin::setArg(FinLin::householderT, 4, nb);
+		FinLin::execKernel(FinLin::householderT, 0, 1, 0);
+
+		// Update the trailing columns with three matrix multiplications
+		if(j0 + nb < w) {
+			applyBlockReflector(
+				h, k, j0, nb, v, t,
+				a, j0*w + j0+nb, w, w - j0-nb,
+				true,
+				work
+			);
+		}
+	}
+
+	clReleaseMemObject(tau);
+	clReleaseMemObject(work);
+}
+void Mat::householderQ(int height, int k, cl_mem v, cl_mem t, cl_mem q) {
+	cl_mem work = FinLin::createBuffer(2*QR_BLOCK*k * sizeof(double));
+
+	// Accumulate the reflectors into the first k columns of the identity
+	FinLin::zeroBuffer(q, height*k * sizeof(double));
+	FinLin::setArg(FinLin::fillDiagonal, 0, q);
+	FinLin::setArg(FinLin::fillDiagonal, 1, 0);
+	FinLin::setArg(FinLin::fillDiagonal, 2, k);
+	FinLin::setArg(FinLin::fillDiagonal, 3, 1.0);
+	FinLin::execKernel(FinLin::fillDiagonal, 0, k, 0);
+	for(int j0 = (k-1) / QR_BLOCK * QR_BLOCK; j0 >= 0; j0 -= QR_BLOCK) {
+		int nb = k - j0 < QR_BLOCK ? k - j0 : QR_BLOCK;
+		applyBlockReflector(height, k, j0, nb, v, t, q, j0*k, k, k, false, work);
+	}
+
+	clReleaseMemObject(work);
+}
+void Mat::choleskyInPlace() {
+	int status = 0;
+	cl_mem memStatus = FinLin::createBuffer(sizeof(int));
+	FinLin::writeBuffer(memStatus, 0, sizeof(int), &status);
+
+	for(int j0 = 0; j0 < h; j0 += TRI_BLOCK) {
+		int nb = h - j0 < TRI_BLOCK ? h - j0 : TRI_BLOCK;
+		int rest = h - j0 - nb;
+
+		FinLin::setArg(FinLin::choleskyBlock, 0, mem());
+		FinLin::setArg(FinLin::choleskyBlock, 1, memStatus);
+		FinLin::setArg(FinLin::choleskyBlock, 2, h);
+		FinLin::setArg(FinLin::choleskyBlock, 3, j0);
+		FinLin::setArg(FinLin::choleskyBlock, 4, nb);
+		FinLin::execKernel(
+			FinLin::choleskyBlock,
+			0,
+			FinLin::GROUP_SIZE,
+			FinLin::GROUP_SIZE
+		);
+		if(rest == 0) break;
+
+		// Panel below the block: L21 L11^T = A21, one row per work item
+		FinLin::setArg(FinLin::triSolve, 0, mem());
+		FinLin::setArg(FinLin::triSolve, 1, mem());
+		FinLin::setArg(FinLin::triSolve, 2, j0*h + j0);
+		FinLin::setArg(FinLin::triSolve, 3, h);
+		FinLin::setArg(FinLin::triSolve, 4, (j0+nb)*h + j0);
+		FinLin::setArg(FinLin::triSolve, 5, 1);
+		FinLin::setArg(FinLin::triSolve, 6, h);
+		FinLin::setArg(FinLin::triSolve, 7, nb);
+		FinLin::setArg(FinLin::triSolve, 8, 0);
+		FinLin::setArg(FinLin::triSolve, 9, 0);
+		FinLin::setArg(FinLin::triSolve, 10, 0);
+		FinLin::execKernel(FinLin::triSolve, 0, rest, 0);
+
+		// Trailing update A22 -= L21 L21^T
+		FinLin::gemm(
+			rest, rest, nb, -1.0,
+			mem(), (j0+nb)*h + j0, h, false,
+			mem(), (j0+nb)*h + j0, h, true,
+			1.0, mem(), (j0+nb)*h + j0+nb, h
+		);
+	}
+
+	FinLin::readBuffer(memStatus, 0, sizeof(int), &status);
+	clReleaseMemObject(memStatus);
+	if(status != 0) {
+		fprintf(
+			stderr,
+			"Cannot take Cholesky factorization of matrix "
+			"that is not positive definite (pivot %d).\n",
+			status - 1
+		);
+		exit(1);
+	}
+}
+void Mat::triangularSolve(
+	cl_mem t,
+	int size,
+	bool upper,
+	bool transpose,
+	bool unit,
+	cl_mem b,
+	int bw
+) {
+	bool forward = upper == transpose;
+	int blocks = (size + TRI_BLOCK - 1) / TRI_BLOCK;
+
+	for(int n = 0; n < blocks; n++) {
+		int j0 = (forward ? n : blocks-1 - n) * TRI_BLOCK;
+		int nb = size - j0 < TRI_BLOCK ? size - j0 : TRI_BLOCK;
+
+		FinLin::setArg(FinLin::triSolve, 0, t);
+		FinLin::setArg(FinLin::triSolve, 1, b);
+		FinLin::setArg(FinLin::triSolve, 2, j0*size + j0);
+		FinLin::setArg(FinLin::triSolve, 3, size);
+		FinLin::setArg(FinLin::triSolve, 4, j0*bw);
+		FinLin::setArg(FinLin::triSolve, 5, bw);
+		FinLin::setArg(FinLin::triSolve, 6, 1);
+		FinLin::setArg(FinLin::triSolve, 7, nb);
+		FinLin::setArg(FinLin::triSolve, 8, (int)upper);
+		FinLin::setArg(FinLin::triSolve, 9, (int)transpose);
+		FinLin::setArg(FinLin::triSolve, 10, (int)unit);
+		FinLin::execKernel(FinLin::triSolve, 0, bw, 0);
+
+		// Eliminate the solved block from the rows still to be solved
+		int r0 = forward ? j0 + nb : 0;
+		int rows = forward ? size - j0 - nb : j0;
+		if(rows == 0) continue;
+		FinLin::gemm(
+			rows, bw, nb, -1.0,
+			t, transpose ? j0*size + r0 : r0*size + j0, size, transpose,
+			b, j0*bw, bw, false,
+			1.0, b, r0*bw, bw
+		);
+	}
+}
+void Mat::applyBlockReflector(
+	int height,
+	int k,
+	int j0,
+	int nb,
+	cl_mem v,
+	cl_mem t,
+	cl_mem b, int offB, int ldb, int bw,
+	bool transpose,
+	cl_mem work
+) {
+	// b -= V op(T) V^T b
+	FinLin::gemm(
+		nb, bw, height - j0, 1.0,
+		v, j0*k + j0, k, true,
+		b, offB, ldb, false,
+		0.0, work, 0, bw
+	);
+	FinLin::gemm(
+		nb, bw, nb, 1.0,
+		t, j0*QR_BLOCK, QR_BLOCK, transpose,
+		work, 0, bw, false,
+		0.0, work, nb*bw, bw
+	);
+	FinLin::gemm(
+		height - j0, bw, nb, -1.0,
+		v, j0*k + j0, k, false,
+		work, nb*bw, bw, false,
+		1.0, b, offB, ldb
+	);
+}
+int *Mat::gaussJordan(cl_mem a, int height, int width, double tolerance) {
+	int *pivots = (int*)malloc(width * sizeof(int));
+	if(height*width == 0) {
+		for(int c = 0; c < width; c++) pivots[c] = -1;
+		return pivots;
+	}
+
+	// Each step reads one buffer and writes the other, so that no group
+	// overwrites the pivot row or column while another reads it
+	cl_mem other = FinLin::createBuffer(height*width * sizeof(double));
+	cl_mem memPivots = FinLin::createBuffer(width * sizeof(int));
+	cl_mem src = a;
+	cl_mem dst = other;
+	for(int c = 0; c < width; c++) {
+		FinLin::setArg(FinLin::rrefStep, 0, src);
+		FinLin::setArg(FinLin::rrefStep, 1, dst);
+		FinLin::setArg(FinLin::rrefStep, 2, memPivots);
+		FinLin::setArg(FinLin::rrefStep, 3, height);
+		FinLin::setArg(FinLin::rrefStep, 4, width);
+		FinLin::setArg(FinLin::rrefStep, 5, c);
+		FinLin::setArg(FinLin::rrefStep, 6, tolerance);
+		FinLin::execKernel(
+			FinLin::rrefStep,
+			0,
+			width * FinLin::GROUP_SIZE,
+			FinLin::GROUP_SIZE
+		);
+		cl_mem swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if(src != a) {
+		FinLin::copyBuffer(src, a, 0, 0, height*width * sizeof(double));
+	}
+	FinLin::readBuffer(memPivots, 0, width * sizeof(int), pivots);
+
+	clReleaseMemObject(other);
+	clReleaseMemObject(memPivots);
+
+	return pivots;
+}
+double Mat::rankTolerance() const {
+	double max = 0;
+	for(int i = 0; i < w*h; i++) {
+		max = fmax(max, fabs(data[i]));
+	}
+	return max * (h > w ? h : w) * DBL_EPSILON;
+}
+
 // Constructors
 Mat::Mat(int height, int width, double *components) {
 	h = height;
@@ -135,14 +508,14 @@ Mat::Mat(int height, int width, double *components) {
 Mat::Mat(int height, int width) {
 	h = height;
 	w = width;
-	data = (double*)malloc(w*h * sizeof(double));
+	data = (double*)FinLin::allocHost(w*h * sizeof(double));
 	memset(data, 0, w*h * sizeof(double));
 	createMem();
 }
 Mat::Mat(int size, double scalar) {
 	h = size;
 	w = size;
-	data = (double*)malloc(w*h * sizeof(double));
+	data = (double*)FinLin::allocHost(w*h * sizeof(double));
 	memset(data, 0, w*h * sizeof(double));
 	for(int i = 0; i < w*h; i += w+1) {
 		data[i] = scalar;
@@ -153,35 +526,157 @@ Mat::Mat(int size) : Mat(size, 1.0) {}
 
 // Statics
 Mat Mat::randomUniform(int height, int width, double min, double max) {
-	double *components = (double*)malloc(width*height * sizeof(double));
-	for(int i = 0; i < width*height; i++) {
-		components[i] = (max - min) * rand() / RAND_MAX + min;
-	}
-	return Mat(height, width, components);
+	int len = width*height;
+	double *components = (double*)FinLin::allocHost(len * sizeof(double));
+	Mat res = Mat(height, width, components);
+	if(len == 0) return res;
+	FinLin::randomArgs(FinLin::randomUniform, res.mem(), len);
+	FinLin::setArg(FinLin::randomUniform, 7, min);
+	FinLin::setArg(FinLin::randomUniform, 8, max);
+	FinLin::execKernel(FinLin::randomUniform, 0, (len + 1) / 2, 0);
+	FinLin::readBuffer(res.mem(), 0, len * sizeof(double), res.data);
+	res.dirty = false;
+	return res;
+}
+Mat Mat::randomNormal(int height, int width, double mean, double stddev) {
+	int len = width*height;
+	double *components = (double*)FinLin::allocHost(len * sizeof(double));
+	Mat res = Mat(height, width, components);
+	if(len == 0) return res;
+	FinLin::randomArgs(FinLin::randomNormal, res.mem(), len);
+	FinLin::setArg(FinLin::randomNormal, 7, mean);
+	FinLin::setArg(FinLin::randomNormal, 8, stddev);
+	FinLin::execKernel(FinLin::randomNormal, 0, (len + 1) / 2, 0);
+	FinLin::readBuffer(res.mem(), 0, len * sizeof(double), res.data);
+	res.dirty = false;
+	return res;
 }
 Mat Mat::fromRowVec(Vec row) {
-	return Mat(1, row.d, row.data);
+	// Takes over a copy, so that writing either leaves the other alone
+	Vec components = row.copy();
+	Mat res = Mat(1, components.d, components.data);
+	free(res.buffer);
+	res.buffer = components.buffer;
+	res.dirty = components.dirty;
+	return res;
 }
 Mat Mat::fromColVec(Vec col) {
-	return Mat(col.d, 1, col.data);
+	// Takes over a copy, so that writing either leaves the other alone
+	Vec components = col.copy();
+	Mat res = Mat(components.d, 1, components.data);
+	free(res.buffer);
+	res.buffer = components.buffer;
+	res.dirty = components.dirty;
+	return res;
 }
 Mat Mat::fromRowVecs(int numVecs, Vec *vecs) {
 	if(numVecs == 0) return Mat(0);
 	int width = vecs[0].d;
-	double *components = (double*)malloc(numVecs*width * sizeof(double));
+	Mat res = Mat(numVecs, width);
 	for(int row = 0; row < numVecs; row++) {
 		if(vecs[row].d != width) {
 			fprintf(stderr, "Cannot construct matrix from vectors"
 				" of varying dimension.\n");
 			exit(1);
 		}
-		memcpy(components + row*width, vecs[row].data, width * sizeof(double));
 	}
-	return Mat(numVecs, width, components);
+	if(width == 0) return res;
+
+	// Rows are copied on the GPU, where the vectors usually are already
+	for(int row = 0; row < numVecs; row++) {
+		vecs[row].update();
+		FinLin::copyBuffer(
+			vecs[row].mem(),
+			res.mem(),
+			0,
+			row*width * sizeof(double),
+			width * sizeof(double)
+		);
+	}
+	FinLin::readBuffer(res.mem(), 0, numVecs*width * sizeof(double), res.data);
+	res.dirty = false;
+	return res;
 }
 Mat Mat::fromColVecs(int numVecs, Vec *vecs) {
 	return fromRowVecs(numVecs, vecs).T();
 }
+Mat Mat::block(int rows, int cols, const Mat *blocks) {
+	// Heights of the block rows are those of the first block column, and
+	// widths of the block columns those of the first block row
+	int height = 0;
+	int width = 0;
+	for(int i = 0; i < rows; i++) {
+		height += blocks[i*cols].h;
+	}
+	for(int j = 0; j < cols; j++) {
+		width += blocks[j].w;
+	}
+	for(int i = 0; i < rows; i++) {
+		for(int j = 0; j < cols; j++) {
+			const Mat &part = blocks[i*cols + j];
+			if(part.h != blocks[i*cols].h || part.w != blocks[j].w) {
+				fprintf(
+					stderr,
+					"Dimension mismatch. Cannot place %d by %d matrix "
+					"in block row of height %d and block column of width %d.\n",
+					part.h,
+					part.w,
+					blocks[i*cols].h,
+					blocks[j].w
+				);
+				exit(1);
+			}
+		}
+	}
+
+	Mat res = Mat(height, width);
+	if(height*width == 0) return res;
+
+	int r0 = 0;
+	for(int i = 0; i < rows; i++) {
+		int c0 = 0;
+		for(int j = 0; j < cols; j++) {
+			Mat part = blocks[i*cols + j];
+			if(part.h*part.w != 0) {
+				part.update();
+				FinLin::copyRect(
+					part.mem(),
+					res.mem(),
+					0,
+					part.w * sizeof(double),
+					(r0*width + c0) * sizeof(double),
+					width * sizeof(double),
+					part.w * sizeof(double),
+					part.h
+				);
+			}
+			c0 += part.w;
+		}
+		r0 += blocks[i*cols].h;
+	}
+
+	FinLin::readBuffer(res.mem(), 0, height*width * sizeof(double), res.data);
+	res.dirty = false;
+	return res;
+}
+Mat Mat::kron(Mat a, Mat b) {
+	Mat res = Mat(a.h * b.h, a.w * b.w);
+	if(res.h*res.w == 0) return res;
+	a.update();
+	b.update();
+
+	FinLin::setArg(FinLin::kron, 0, a.mem());
+	FinLin::setArg(FinLin::kron, 1, b.mem());
+	FinLin::setArg(FinLin::kron, 2, res.mem());
+	FinLin::setArg(FinLin::kron, 3, a.w);
+	FinLin::setArg(FinLin::kron, 4, b.h);
+	FinLin::setArg(FinLin::kron, 5, b.w);
+	FinLin::execKernel(FinLin::kron, 0, res.h, res.w, 0);
+	FinLin::readBuffer(res.mem(), 0, res.h*res.w * sizeof(double), res.data);
+	res.dirty = false;
+
+	return res;
+}
 
 // Accessors
 int Mat::height() const {
@@ -215,12 +710,18 @@ char *Mat::string() const {
 
 // In-place operations
 Mat Mat::operator*=(double scalar) {
+	detach();
+	if(hostPath()) {
+		for(int i = 0; i < w*h; i++) data[i] *= scalar;
+		dirty = true;
+		return *this;
+	}
 	update();
 
-	FinLin::setArg(FinLin::scale, 0, clmem);
+	FinLin::setArg(FinLin::scale, 0, mem());
 	FinLin::setArg(FinLin::scale, 1, scalar);
 	FinLin::execKernel(FinLin::scale, 0, w*h, 0);
-	FinLin::readBuffer(clmem, 0, w*h * sizeof(double), data);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
 
 	return *this;
 }
@@ -236,104 +737,234 @@ Mat Mat::operator^=(int exponent) {
 
 Mat Mat::operator&=(Mat multiplier) {
 	ensureSameMatDim(h, w, multiplier.h, multiplier.w, "multiply");
+	detach();
+	if(hostPath()) {
+		for(int i = 0; i < w*h; i++) data[i] *= multiplier.data[i];
+		dirty = true;
+		return *this;
+	}
 
 	update();
 	multiplier.update();
 
-	FinLin::setArg(FinLin::hadamard, 0, clmem);
-	FinLin::setArg(FinLin::hadamard, 1, multiplier.clmem);
+	FinLin::setArg(FinLin::hadamard, 0, mem());
+	FinLin::setArg(FinLin::hadamard, 1, multiplier.mem());
 	FinLin::execKernel(FinLin::hadamard, 0, w*h, 0);
-	FinLin::readBuffer(clmem, 0, w*h * sizeof(double), data);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
 
 	return *this;
 }
 Mat Mat::operator+=(Mat addend) {
 	ensureSameMatDim(h, w, addend.h, addend.w, "add");
+	detach();
+	if(hostPath()) {
+		for(int i = 0; i < w*h; i++) data[i] += addend.data[i];
+		dirty = true;
+		return *this;
+	}
 
 	update();
 	addend.update();
 
-	FinLin::setArg(FinLin::add, 0, clmem);
-	FinLin::setArg(FinLin::add, 1, addend.clmem);
+	FinLin::setArg(FinLin::add, 0, mem());
+	FinLin::setArg(FinLin::add, 1, addend.mem());
 	FinLin::execKernel(FinLin::add, 0, w*h, 0);
-	FinLin::readBuffer(clmem, 0, w*h * sizeof(double), data);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
 
 	return *this;
 }
 Mat Mat::operator-=(Mat subtrahend) {
 	ensureSameMatDim(h, w, subtrahend.h, subtrahend.w, "subtract");
+	detach();
+	if(hostPath()) {
+		for(int i = 0; i < w*h; i++) data[i] -= subtrahend.data[i];
+		dirty = true;
+		return *this;
+	}
 
 	update();
 	subtrahend.update();
 
-	FinLin::setArg(FinLin::addScaled, 0, clmem);
-	FinLin::setArg(FinLin::addScaled, 1, subtrahend.clmem);
+	FinLin::setArg(FinLin::addScaled, 0, mem());
+	FinLin::setArg(FinLin::addScaled, 1, subtrahend.mem());
 	FinLin::setArg(FinLin::addScaled, 2, -1.0);
 	FinLin::execKernel(FinLin::addScaled, 0, w*h, 0);
 
-	FinLin::readBuffer(clmem, 0, w*h * sizeof(double), data);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
+
+	return *this;
+}
+Mat Mat::rank1Update(double alpha, Vec u, Vec v) {
+	ensureOuterDims(h, w, u.d, v.d);
+	if(w*h == 0) return *this;
+	detach();
+	update();
+	u.update();
+	v.update();
+
+	FinLin::setArg(FinLin::ger, 0, mem());
+	FinLin::setArg(FinLin::ger, 1, u.mem());
+	FinLin::setArg(FinLin::ger, 2, v.mem());
+	FinLin::setArg(FinLin::ger, 3, alpha);
+	FinLin::execKernel(FinLin::ger, 0, h, w, 0);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
+
+	return *this;
+}
+Mat Mat::syrk(Mat a) {
+	ensureSquare(h, w, "take Gram update");
+	ensureSameMatDim(h, h, a.h, a.h, "take Gram update with");
+	if(h == 0) return *this;
+	detach();
+	update();
+	a.update();
+
+	FinLin::setArg(FinLin::syrkUpdate, 0, mem());
+	FinLin::setArg(FinLin::syrkUpdate, 1, a.mem());
+	FinLin::setArg(FinLin::syrkUpdate, 2, h);
+	FinLin::setArg(FinLin::syrkUpdate, 3, a.w);
+	FinLin::execKernel(FinLin::syrkUpdate, 0, h * (h + 1) / 2, 0);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
+
+	return *this;
+}
+Mat Mat::setRelu() {
+	detach();
+	update();
+
+	FinLin::setArg(FinLin::relu, 0, mem());
+	FinLin::setArg(FinLin::relu, 1, 0.0);
+	FinLin::execKernel(FinLin::relu, 0, w*h, 0);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
+
+	return *this;
+}
+Mat Mat::setLeakyRelu(double slope) {
+	detach();
+	update();
+
+	FinLin::setArg(FinLin::relu, 0, mem());
+	FinLin::setArg(FinLin::relu, 1, slope);
+	FinLin::execKernel(FinLin::relu, 0, w*h, 0);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
+
+	return *this;
+}
+Mat Mat::setTanh() {
+	detach();
+	update();
+
+	FinLin::setArg(FinLin::tanhActivation, 0, mem());
+	FinLin::execKernel(FinLin::tanhActivation, 0, w*h, 0);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
+
+	return *this;
+}
+Mat Mat::setGelu() {
+	detach();
+	update();
+
+	FinLin::setArg(FinLin::gelu, 0, mem());
+	FinLin::execKernel(FinLin::gelu, 0, w*h, 0);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
+
+	return *this;
+}
+Mat Mat::setLogistic() {
+	detach();
+	update();
+
+	FinLin::setArg(FinLin::logistic, 0, mem());
+	FinLin::execKernel(FinLin::logistic, 0, w*h, 0);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
+
+	return *this;
+}
+Mat Mat::setSoftmax() {
+	if(w*h == 0) return *this;
+	detach();
+	update();
+
+	FinLin::setArg(FinLin::softmaxRows, 0, mem());
+	FinLin::setArg(FinLin::softmaxRows, 1, w);
+	FinLin::setArg(FinLin::softmaxRows, 2, 0);
+	FinLin::execKernel(
+		FinLin::softmaxRows,
+		0,
+		h * FinLin::GROUP_SIZE,
+		FinLin::GROUP_SIZE
+	);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
+
+	return *this;
+}
+Mat Mat::setLogSoftmax() {
+	if(w*h == 0) return *this;
+	detach();
+	update();
+
+	FinLin::setArg(FinLin::softmaxRows, 0, mem());
+	FinLin::setArg(FinLin::softmaxRows, 1, w);
+	FinLin::setArg(FinLin::softmaxRows, 2, 1);
+	FinLin::execKernel(
+		FinLin::softmaxRows,
+		0,
+		h * FinLin::GROUP_SIZE,
+		FinLin::GROUP_SIZE
+	);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
+
+	return *this;
+}
+Mat Mat::setMap(const char *expr) {
+	cl_kernel kernel = FinLin::userKernel(expr, false);
+	if(w*h == 0) return *this;
+	detach();
+	update();
+
+	FinLin::setArg(kernel, 0, mem());
+	FinLin::execKernel(kernel, 0, w*h, 0);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
+
+	return *this;
+}
+Mat Mat::setZip(Mat other, const char *expr) {
+	ensureSameMatDim(h, w, other.h, other.w, "zip");
+	cl_kernel kernel = FinLin::userKernel(expr, true);
+	if(w*h == 0) return *this;
+	detach();
+	update();
+	other.update();
+
+	FinLin::setArg(kernel, 0, mem());
+	FinLin::setArg(kernel, 1, other.mem());
+	FinLin::execKernel(kernel, 0, w*h, 0);
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
 
 	return *this;
 }
 
 Mat Mat::RREF() {
-	for(int c = 0; c < h; c++) {
-		for(int r = c; r < h; r++) {
-			if(comp(r, c) == 0) {
-				Vec badRow = rowVec(r);
-				bool found = false;
-				for(int s = r; s < h; s++) {
-					if(comp(s, c) != 0) {
-						badRow += rowVec(s);
-						memcpy(data + r*w, badRow.data, w*sizeof(double));
-						found = true;
-						break;
-					}
-				}
-				if(!found) {
-					fprintf(stderr, "This limited implementation of RREF does "
-						"not support singular matrices.");
-					exit(1);
-				}
-			}
-		}
-		Vec initialCol = colVec(c);
-		Vec firstRow = rowVec(c);
-		firstRow /= initialCol.comp(c);
-		memcpy(data + c*w, firstRow.data, w*sizeof(double));
-		for(int r = c+1; r < h; r++) {
-			Vec row = rowVec(r);
-			row /= initialCol.comp(r);
-			row -= firstRow;
-			memcpy(data + r*w, row.data, w*sizeof(double));
-		}
-	}
-	for(int c = h-2; c >= 0; c--) {
-		Vec minuend = rowVec(c);
-		for(int r = h-1; r > c; r--) {
-			Vec subtrahend = rowVec(r);
-			subtrahend *= minuend.comp(r);
-			minuend -= subtrahend;
-		}
-		memcpy(data + c*w, minuend.data, w*sizeof(double));
-	}
+	detach();
+	update();
+	free(gaussJordan(mem(), h, w, rankTolerance()));
+	FinLin::readBuffer(mem(), 0, w*h * sizeof(double), data);
 
 	return *this;
 }
 
 // Binary operations
 Mat Mat::operator*(double scalar) const {
-	Mat matrix = copy();
+	Mat matrix = deviceCopy();
 	matrix *= scalar;
 	return matrix;
 }
 Mat operator*(double scalar, Mat matrix) {
-	Mat product = matrix.copy();
-	product *= scalar;
-	return product;
+	const Mat &multiplicand = matrix; // So only the const product matches
+	return multiplicand * scalar;
 }
 Mat Mat::operator/(double divisor) const {
-	Mat dividend = copy();
+	Mat dividend = deviceCopy();
 	dividend /= divisor;
 	return dividend;
 }
@@ -345,85 +976,305 @@ Mat Mat::operator^(int exponent) const {
 
 Vec Mat::operator*(Vec vector) {
 	ensureMulMatDims(w, vector.d, "multiply");
-	update();
-	vector.update();
+	Vec res = Vec(h);
 
-	cl_mem resBuff = clCreateBuffer(
-		FinLin::context,
-		CL_MEM_READ_WRITE,
-		h * sizeof(double),
-		NULL,
-		&FinLin::err
-	);
-	FinLin::checkErr();
+	// The product is read back, after uploading operands if necessary
+	size_t transferred = h + (dirty ? w*h : 0) + (vector.dirty ? w : 0);
+	if(FinLin::onHost(w*h, transferred)) {
+		for(int r = 0; r < h; r++) {
+			double sum = 0;
+			for(int c = 0; c < w; c++) sum += data[r*w + c] * vector.data[c];
+			res.data[r] = sum;
+		}
+		return res;
+	}
 
-	FinLin::setArg(FinLin::matVec, 0, clmem);
-	FinLin::setArg(FinLin::matVec, 1, vector.clmem);
-	FinLin::setArg(FinLin::matVec, 2, resBuff);
-	FinLin::setArg(FinLin::matVec, 3, w);
-	FinLin::execKernel(FinLin::matVec, 0, h, 0);
+	update();
+	vector.update();
+	mulVec(vector.mem(), res.mem());
 
-	double *resData = (double*)malloc(h * sizeof(double));
-	FinLin::readBuffer(resBuff, 0, h * sizeof(double), resData);
+	FinLin::readBuffer(res.mem(), 0, h * sizeof(double), res.data);
+	res.dirty = false;
 
-	return Vec(h, resData);
+	return res;
 }
 
 Mat Mat::operator*(Mat multiplier) {
 	ensureMulMatDims(w, multiplier.h, "multiply");
+	int mw = multiplier.w;
+	Mat res = Mat(h, mw);
+
+	// '', for a product with w multiplications per component
+	size_t transferred =
+		h*mw + (dirty ? w*h : 0) + (multiplier.dirty ? w*mw : 0);
+	if(FinLin::onHost((double)w*h*mw, transferred)) {
+		for(int r = 0; r < h; r++) {
+			for(int k = 0; k < w; k++) {
+				double x = data[r*w + k];
+				for(int c = 0; c < mw; c++) {
+					res.data[r*mw + c] += x * multiplier.data[k*mw + c];
+				}
+			}
+		}
+		return res;
+	}
+
 	update();
 	multiplier.update();
 
-	cl_mem resBuff = clCreateBuffer(
-		FinLin::context,
-		CL_MEM_READ_WRITE,
-		h * multiplier.w * sizeof(double),
-		NULL,
-		&FinLin::err
-	);
-	FinLin::checkErr();
-
-	FinLin::setArg(FinLin::matMul, 0, clmem);
-	FinLin::setArg(FinLin::matMul, 1, multiplier.clmem);
-	FinLin::setArg(FinLin::matMul, 2, resBuff);
+	FinLin::setArg(FinLin::matMul, 0, mem());
+	FinLin::setArg(FinLin::matMul, 1, multiplier.mem());
+	FinLin::setArg(FinLin::matMul, 2, res.mem());
 	FinLin::setArg(FinLin::matMul, 3, w);
 	FinLin::execKernel(FinLin::matMul, 0, h, multiplier.w, 0);
 
-	double *resData = (double*)malloc(h * multiplier.w * sizeof(double));
-	FinLin::readBuffer(resBuff, 0, h * multiplier.w * sizeof(double), resData);
+	FinLin::readBuffer(res.mem(), 0, h * multiplier.w * sizeof(double), res.data);
+	res.dirty = false;
+
+	return res;
+}
+
+Vec Mat::lstsq(Vec rhs) const {
+	Mat sol = lstsq(fromColVec(rhs));
+	return Vec(sol.h, sol.data);
+}
+Mat Mat::lstsq(Mat rhs) const {
+	if(h < w) {
+		fprintf(
+			stderr,
+			"Cannot find least squares solution of %d by %d matrix. "
+			"Matrix must not be wider than it is tall.\n",
+			h,
+			w
+		);
+		exit(1);
+	}
+	ensureRhsHeight(h, rhs.h);
+	ensureNonzero(h, w, "find least squares solution");
+
+	Mat factored = deviceCopy();
+	factored.update();
+	Mat prod = rhs.deviceCopy();
+	prod.update();
+
+	cl_mem v = FinLin::createBuffer(h*w * sizeof(double));
+	cl_mem t = FinLin::createBuffer(w*QR_BLOCK * sizeof(double));
+	cl_mem work = FinLin::createBuffer(2*QR_BLOCK*rhs.w * sizeof(double));
+	householderQR(factored.mem(), h, w, v, t);
+
+	// Q^T rhs, then back substitution with R
+	for(int j0 = 0; j0 < w; j0 += QR_BLOCK) {
+		int nb = w - j0 < QR_BLOCK ? w - j0 : QR_BLOCK;
+		applyBlockReflector(
+			h, w, j0, nb, v, t,
+			prod.mem(), j0*rhs.w, rhs.w, rhs.w,
+			true,
+			work
+		);
+	}
+	triangularSolve(factored.mem(), w, true, false, false, prod.mem(), rhs.w);
+
+	Mat sol = Mat(w, rhs.w);
+	FinLin::copyBuffer(prod.mem(), sol.mem(), 0, 0, w*rhs.w * sizeof(double));
+	FinLin::readBuffer(sol.mem(), 0, w*rhs.w * sizeof(double), sol.data);
+	sol.dirty = false;
+
+	clReleaseMemObject(v);
+	clReleaseMemObject(t);
+	clReleaseMemObject(work);
+	factored.release();
+	prod.release();
+
+	return sol;
+}
+
+Vec Mat::solveSPD(Vec rhs) const {
+	Mat sol = solveSPD(fromColVec(rhs));
+	return Vec(sol.h, sol.data);
+}
+Mat Mat::solveSPD(Mat rhs) const {
+	ensureSquare(h, w, "solve system");
+	ensureRhsHeight(h, rhs.h);
+	ensureNonzero(h, w, "solve system");
+
+	Mat factor = deviceCopy();
+	factor.update();
+	factor.choleskyInPlace();
+
+	// L L^T x = rhs
+	Mat sol = rhs.deviceCopy();
+	sol.update();
+	triangularSolve(factor.mem(), h, false, false, false, sol.mem(), rhs.w);
+	triangularSolve(factor.mem(), h, false, true, false, sol.mem(), rhs.w);
+	FinLin::readBuffer(sol.mem(), 0, h*rhs.w * sizeof(double), sol.data);
+
+	factor.release();
+
+	return sol;
+}
+
+Vec Mat::solveRefined(Vec rhs) {
+	ensureSquare(h, w, "solve system");
+	ensureRhsHeight(h, rhs.d);
+	ensureNonzero(h, w, "solve system");
+	update();
+	rhs.update();
+
+	cl_mem lu = FinLin::createBuffer(h*h * sizeof(double));
+	cl_mem perm = FinLin::createBuffer(h * sizeof(int));
+	if(!luSingle(lu, perm)) {
+		clReleaseMemObject(lu);
+		clReleaseMemObject(perm);
+		return lstsq(rhs);
+	}
+
+	Vec sol = Vec(h);
+	sol.update();
+	cl_mem res = FinLin::createBuffer(h * sizeof(double));
+	cl_mem prod = FinLin::createBuffer(h * sizeof(double));
+	cl_mem corr = FinLin::createBuffer(h * sizeof(double));
+	cl_mem norms = FinLin::createBuffer(3 * sizeof(double));
+	double norm[3]; // |res|, |sol|, |this|
+	FinLin::dot(mem(), mem(), h*h, norms, 2, true);
+	FinLin::copyBuffer(rhs.mem(), res, 0, 0, h * sizeof(double));
+
+	bool converged = false;
+	double prev = INFINITY;
+	for(int iter = 0; iter < REFINE_MAX; iter++) {
+		// Correction from the single precision factors, applied in double
+		FinLin::setArg(FinLin::gather, 0, corr);
+		FinLin::setArg(FinLin::gather, 1, res);
+		FinLin::setArg(FinLin::gather, 2, perm);
+		FinLin::execKernel(FinLin::gather, 0, h, 0);
+		triangularSolve(lu, h, false, false, true, corr, 1);
+		triangularSolve(lu, h, true, false, false, corr, 1);
+		FinLin::setArg(FinLin::add, 0, sol.mem());
+		FinLin::setArg(FinLin::add, 1, corr);
+		FinLin::execKernel(FinLin::add, 0, h, 0);
+
+		// res = rhs - this * sol, in double
+		mulVec(sol.mem(), prod);
+		FinLin::copyBuffer(rhs.mem(), res, 0, 0, h * sizeof(double));
+		FinLin::setArg(FinLin::addScaled, 0, res);
+		FinLin::setArg(FinLin::addScaled, 1, prod);
+		FinLin::setArg(FinLin::addScaled, 2, -1.0);
+		FinLin::execKernel(FinLin::addScaled, 0, h, 0);
+
+		FinLin::dot(res, res, h, norms, 0, true);
+		FinLin::dot(sol.mem(), sol.mem(), h, norms, 1, true);
+		FinLin::readBuffer(norms, 0, 3 * sizeof(double), norm);
+		if(norm[0] <= norm[1] * norm[2] * sqrt(h) * DBL_EPSILON) {
+			converged = true;
+			break;
+		}
+		// Stalled: single precision is too coarse for this matrix
+		if(!(norm[0] < prev / 2)) break;
+		prev = norm[0];
+	}
+
+	clReleaseMemObject(lu);
+	clReleaseMemObject(perm);
+	clReleaseMemObject(res);
+	clReleaseMemObject(prod);
+	clReleaseMemObject(corr);
+	clReleaseMemObject(norms);
+	if(!converged) return lstsq(rhs);
+
+	FinLin::readBuffer(sol.mem(), 0, h * sizeof(double), sol.data);
+	return sol;
+}
+bool Mat::luSingle(cl_mem lu, cl_mem perm) const {
+	int *order = (int*)malloc(h * sizeof(int));
+	for(int i = 0; i < h; i++) {
+		order[i] = i;
+	}
+	FinLin::writeBuffer(perm, 0, h * sizeof(int), order);
+	free(order);
+
+	int status = 0;
+	cl_mem memStatus = FinLin::createBuffer(sizeof(int));
+	FinLin::writeBuffer(memStatus, 0, sizeof(int), &status);
+	cl_mem single = FinLin::createBuffer(h*h * sizeof(float));
+	FinLin::setArg(FinLin::toSingle, 0, single);
+	FinLin::setArg(FinLin::toSingle, 1, mem());
+	FinLin::execKernel(FinLin::toSingle, 0, h*h, 0);
+
+	for(int k = 0; k < h; k++) {
+		FinLin::setArg(FinLin::luPivot, 0, single);
+		FinLin::setArg(FinLin::luPivot, 1, perm);
+		FinLin::setArg(FinLin::luPivot, 2, memStatus);
+		FinLin::setArg(FinLin::luPivot, 3, h);
+		FinLin::setArg(FinLin::luPivot, 4, k);
+		FinLin::execKernel(
+			FinLin::luPivot,
+			0,
+			FinLin::GROUP_SIZE,
+			FinLin::GROUP_SIZE
+		);
+		int rest = h - k - 1;
+		if(rest == 0) break;
+
+		FinLin::setArg(FinLin::luEliminate, 0, single);
+		FinLin::setArg(FinLin::luEliminate, 1, h);
+		FinLin::setArg(FinLin::luEliminate, 2, k);
+		FinLin::execKernel(FinLin::luEliminate, 0, rest, rest, 0);
+		FinLin::setArg(FinLin::luScale, 0, single);
+		FinLin::setArg(FinLin::luScale, 1, h);
+		FinLin::setArg(FinLin::luScale, 2, k);
+		FinLin::execKernel(FinLin::luScale, 0, rest, 0);
+	}
 
-	return Mat(h, multiplier.w, resData);
+	FinLin::setArg(FinLin::toDouble, 0, lu);
+	FinLin::setArg(FinLin::toDouble, 1, single);
+	FinLin::execKernel(FinLin::toDouble, 0, h*h, 0);
+	FinLin::readBuffer(memStatus, 0, sizeof(int), &status);
+	clReleaseMemObject(single);
+	clReleaseMemObject(memStatus);
+	return status == 0;
 }
 
 Mat Mat::operator&(Mat multiplier) const {
-	Mat multiplicand = copy();
+	Mat multiplicand = deviceCopy();
 	multiplicand &= multiplier;
 	return multiplicand;
 }
 Mat Mat::operator+(Mat addend) const {
-	Mat augend = copy();
+	Mat augend = deviceCopy();
 	augend += addend;
 	return augend;
 }
 Mat Mat::operator-(Mat subtrahend) const {
-	Mat minuend = copy();
+	Mat minuend = deviceCopy();
 	minuend -= subtrahend;
 	return minuend;
 }
+Mat Mat::zip(Mat other, const char *expr) const {
+	Mat res = deviceCopy();
+	res.setZip(other, expr);
+	return res;
+}
 
 // Misc operations
 Vec Mat::rowVec(int row) const {
-	double *components = (double*)malloc(w * sizeof(double));
+	double *components = (double*)FinLin::allocHost(w * sizeof(double));
 	memcpy(components, data + row*w, w * sizeof(double));
 	return Vec(w, components);
 }
 Vec Mat::colVec(int col) const {
-	double *components = (double*)malloc(h * sizeof(double));
+	double *components = (double*)FinLin::allocHost(h * sizeof(double));
 	for(int r = 0; r < h; r++) {
 		components[r] = comp(r, col);
 	}
 	return Vec(h, components);
 }
+Mat Mat::hcat(Mat right) const {
+	Mat blocks[2] = {*this, right};
+	return block(1, 2, blocks);
+}
+Mat Mat::vcat(Mat below) const {
+	Mat blocks[2] = {*this, below};
+	return block(2, 1, blocks);
+}
 
 // Unary operations
 double Mat::det() const {
@@ -458,23 +1309,79 @@ double Mat::trace() const {
 	}
 	return sum;
 }
+int Mat::rank() const {
+	ensureNonzero(h, w, "find rank");
+	Mat reduced = deviceCopy();
+	reduced.update();
+	int *pivots = gaussJordan(reduced.mem(), h, w, rankTolerance());
+
+	int rank = 0;
+	for(int c = 0; c < w; c++) {
+		if(pivots[c] >= 0) rank++;
+	}
+
+	free(pivots);
+	reduced.release();
+
+	return rank;
+}
 
 Mat Mat::operator-() const {
 	return -1.0 * *this;
 }
 Mat Mat::operator~() const {
-	Mat negated = copy();
+	Mat negated = deviceCopy();
 	negated.update();
 
-	FinLin::setArg(FinLin::compNot, 0, negated.clmem);
+	FinLin::setArg(FinLin::compNot, 0, negated.mem());
 	FinLin::execKernel(FinLin::compNot, 0, w*h, 0);
-	FinLin::readBuffer(negated.clmem, 0, w*h * sizeof(double), negated.data);
+	FinLin::readBuffer(negated.mem(), 0, w*h * sizeof(double), negated.data);
 
 	return negated;
 }
+Mat Mat::relu() const {
+	Mat res = deviceCopy();
+	res.setRelu();
+	return res;
+}
+Mat Mat::leakyRelu(double slope) const {
+	Mat res = deviceCopy();
+	res.setLeakyRelu(slope);
+	return res;
+}
+Mat Mat::tanh() const {
+	Mat res = deviceCopy();
+	res.setTanh();
+	return res;
+}
+Mat Mat::gelu() const {
+	Mat res = deviceCopy();
+	res.setGelu();
+	return res;
+}
+Mat Mat::logistic() const {
+	Mat res = deviceCopy();
+	res.setLogistic();
+	return res;
+}
+Mat Mat::softmax() const {
+	Mat res = deviceCopy();
+	res.setSoftmax();
+	return res;
+}
+Mat Mat::logSoftmax() const {
+	Mat res = deviceCopy();
+	res.setLogSoftmax();
+	return res;
+}
+Mat Mat::map(const char *expr) const {
+	Mat res = deviceCopy();
+	res.setMap(expr);
+	return res;
+}
 
 Mat Mat::T() const {
-	double *res = (double*)malloc(w*h * sizeof(double));
+	double *res = (double*)FinLin::allocHost(w*h * sizeof(double));
 	for(int r = 0; r < h; r++) {
 		for(int c = 0; c < w; c++) {
 			res[c*h + r] = data[r*w + c];
@@ -484,17 +1391,181 @@ Mat Mat::T() const {
 }
 Mat Mat::inv() const {
 	ensureSquare(h, w, "take inverse");
-	double *augmented = (double*)malloc(2*w*h * sizeof(double));
-	for(int r = 0; r < h; r++) {
-		memcpy(augmented + 2*w*r, data + r*w, w * sizeof(double));
-		memset(augmented + 2*w*r + w, 0, w * sizeof(double));
-		augmented[2*w*r + w + r] = 1;
+	sync();
+
+	// The matrix beside the identity, assembled on the GPU
+	cl_mem augMat = FinLin::createBuffer(2*w*h * sizeof(double));
+	FinLin::zeroBuffer(augMat, 2*w*h * sizeof(double));
+	FinLin::copyRect(
+		mem(),
+		augMat,
+		0,
+		w * sizeof(double),
+		0,
+		2*w * sizeof(double),
+		w * sizeof(double),
+		h
+	);
+	FinLin::setArg(FinLin::fillDiagonal, 0, augMat);
+	FinLin::setArg(FinLin::fillDiagonal, 1, w);
+	FinLin::setArg(FinLin::fillDiagonal, 2, 2*w);
+	FinLin::setArg(FinLin::fillDiagonal, 3, 1.0);
+	FinLin::execKernel(FinLin::fillDiagonal, 0, h, 0);
+
+	int *pivots = gaussJordan(augMat, h, 2*w, rankTolerance());
+	for(int c = 0; c < w; c++) {
+		if(pivots[c] < 0) {
+			fprintf(stderr, "Cannot take inverse of singular matrix.\n");
+			exit(1);
+		}
 	}
-	Mat augMat = Mat(h, 2*w, augmented);
-	augMat.RREF();
-	double *resData = (double*)malloc(w*h * sizeof(double));
-	for(int r = 0; r < h; r++) {
-		memcpy(resData + w*r, augmented + 2*w*r + w, w * sizeof(double));
+	free(pivots);
+
+	// The inverse is the right half of the reduced matrix
+	Mat res = Mat(h, w);
+	if(h != 0) {
+		FinLin::copyRect(
+			augMat,
+			res.mem(),
+			w * sizeof(double),
+			2*w * sizeof(double),
+			0,
+			w * sizeof(double),
+			w * sizeof(double),
+			h
+		);
+		FinLin::readBuffer(res.mem(), 0, w*h * sizeof(double), res.data);
+		res.dirty = false;
+	}
+
+	clReleaseMemObject(augMat);
+
+	return res;
+}
+Mat *Mat::QR() const {
+	ensureNonzero(h, w, "find QR decomposition");
+	int k = h < w ? h : w;
+
+	Mat factored = deviceCopy();
+	factored.update();
+	cl_mem v = FinLin::createBuffer(h*k * sizeof(double));
+	cl_mem t = FinLin::createBuffer(k*QR_BLOCK * sizeof(double));
+	householderQR(factored.mem(), h, w, v, t);
+
+	Mat q = Mat(h, k);
+	householderQ(h, k, v, t, q.mem());
+	FinLin::readBuffer(q.mem(), 0, h*k * sizeof(double), q.data);
+	q.dirty = false;
+
+	// The factored matrix is zero below the diagonal
+	Mat r = Mat(k, w);
+	FinLin::copyBuffer(factored.mem(), r.mem(), 0, 0, k*w * sizeof(double));
+	FinLin::readBuffer(r.mem(), 0, k*w * sizeof(double), r.data);
+	r.dirty = false;
+
+	clReleaseMemObject(v);
+	clReleaseMemObject(t);
+	factored.release();
+
+	Mat *res = (Mat*)malloc(2 * sizeof(Mat));
+	res[0] = q;
+	res[1] = r;
+	return res;
+}
+Mat Mat::cholesky() const {
+	ensureSquare(h, w, "take Cholesky factorization");
+	ensureNonzero(h, w, "take Cholesky factorization");
+
+	Mat factor = deviceCopy();
+	factor.update();
+	factor.choleskyInPlace();
+	FinLin::readBuffer(factor.mem(), 0, w*h * sizeof(double), factor.data);
+
+	return factor;
+}
+Mat Mat::nullspace() const {
+	ensureNonzero(h, w, "find nullspace");
+	Mat reduced = deviceCopy();
+	reduced.update();
+	int *pivots = gaussJordan(reduced.mem(), h, w, rankTolerance());
+	FinLin::readBuffer(reduced.mem(), 0, w*h * sizeof(double), reduced.data);
+
+	int rank = 0;
+	for(int c = 0; c < w; c++) {
+		if(pivots[c] >= 0) rank++;
+	}
+
+	// Each free column gives one solution, with a one in its own place and
+	// the negated column of the reduced matrix in the pivot places. A
+	// trivial nullspace is spanned by a single zero column.
+	int dim = rank < w ? w - rank : 1;
+	Mat res = Mat(w, dim);
+	int n = 0;
+	for(int c = 0; c < w; c++) {
+		if(pivots[c] >= 0) continue;
+		res.data[c*dim + n] = 1;
+		for(int p = 0; p < c; p++) {
+			if(pivots[p] >= 0) {
+				res.data[p*dim + n] = -reduced.data[pivots[p]*w + c];
+			}
+		}
+		n++;
+	}
+
+	free(pivots);
+	reduced.release();
+
+	return res;
+}
+Mat Mat::columnSpace() const {
+	ensureNonzero(h, w, "find column space");
+	Mat reduced = deviceCopy();
+	reduced.update();
+	int *pivots = gaussJordan(reduced.mem(), h, w, rankTolerance());
+	reduced.release();
+
+	int rank = 0;
+	for(int c = 0; c < w; c++) {
+		if(pivots[c] >= 0) rank++;
+	}
+
+	// A zero matrix has only the zero column
+	if(rank == 0) {
+		free(pivots);
+		return Mat(h, 1);
 	}
-	return Mat(h, w, resData);
+
+	// The pivot columns of the original matrix
+	sync();
+	Mat res = Mat(h, rank);
+	int n = 0;
+	for(int c = 0; c < w; c++) {
+		if(pivots[c] < 0) continue;
+		FinLin::copyRect(
+			mem(),
+			res.mem(),
+			c * sizeof(double),
+			w * sizeof(double),
+			n * sizeof(double),
+			rank * sizeof(double),
+			sizeof(double),
+			h
+		);
+		n++;
+	}
+	FinLin::readBuffer(res.mem(), 0, h*rank * sizeof(double), res.data);
+	res.dirty = false;
+
+	free(pivots);
+
+	return res;
+}
+
+// Mutators
+double Mat::setComp(int r, int c, double value) {
+	detach();
+	double prev = data[r*w + c];
+	data[r*w + c] = value;
+	dirty = true;
+	return prev;
 }
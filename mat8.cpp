@@ -0,0 +1,186 @@
+// Copyright (c) 2021 Thomas Kaldahl
+
+#include "finlin.hpp"
+
+// Helper functions
+void ensureMulMat8Dims(int w1, int h2) {
+	if(w1 != h2) {
+		fprintf(
+			stderr,
+			"Dimension mismatch. "
+			"Cannot multiply 8-bit matrix of width %d with height %d.\n",
+			w1,
+			h2
+		);
+		exit(1);
+	}
+}
+void quantParams(const double *x, int len, double *scale, int *zero) {
+	// The range covers zero, so that zero is represented exactly
+	double min = 0;
+	double max = 0;
+	for(int i = 0; i < len; i++) {
+		if(x[i] < min) min = x[i];
+		if(x[i] > max) max = x[i];
+	}
+	*scale = max > min ? (max - min) / 255 : 1;
+	int z = (int)round(-128 - min / *scale);
+	*zero = z < -128 ? -128 : z > 127 ? 127 : z;
+}
+
+// Constructors
+Mat8::Mat8(Mat mat, bool perRow) {
+	h = mat.h;
+	w = mat.w;
+	ld = (w + 3) / 4 * 4;
+	this->perRow = perRow;
+
+	scales = (double*)malloc(h * sizeof(double));
+	zeros = (int*)malloc(h * sizeof(int));
+	if(perRow) {
+		for(int r = 0; r < h; r++) {
+			quantParams(mat.data + r*w, w, scales + r, zeros + r);
+		}
+	} else {
+		double scale;
+		int zero;
+		quantParams(mat.data, h*w, &scale, &zero);
+		for(int r = 0; r < h; r++) {
+			scales[r] = scale;
+			zeros[r] = zero;
+		}
+	}
+
+	data = (int8_t*)FinLin::allocHost(h*ld);
+	clmem = FinLin::createBuffer(h*ld);
+	scalemem = FinLin::createBuffer(h * sizeof(double));
+	zeromem = FinLin::createBuffer(h * sizeof(int));
+	FinLin::writeBuffer(scalemem, 0, h * sizeof(double), scales);
+	FinLin::writeBuffer(zeromem, 0, h * sizeof(int), zeros);
+
+	mat.update();
+	FinLin::setArg(FinLin::quantize8, 0, mat.mem());
+	FinLin::setArg(FinLin::quantize8, 1, clmem);
+	FinLin::setArg(FinLin::quantize8, 2, scalemem);
+	FinLin::setArg(FinLin::quantize8, 3, zeromem);
+	FinLin::setArg(FinLin::quantize8, 4, w);
+	FinLin::setArg(FinLin::quantize8, 5, ld);
+	FinLin::execKernel(FinLin::quantize8, 0, h, ld, 0);
+	FinLin::readBuffer(clmem, 0, h*ld, data);
+}
+
+// Accessors
+int Mat8::height() const {
+	return h;
+}
+int Mat8::width() const {
+	return w;
+}
+
+double Mat8::comp(int r, int c) const {
+	return scales[r] * (data[r*ld + c] - zeros[r]);
+}
+Mat Mat8::dequantize() const {
+	Mat res = Mat(h, w);
+
+	FinLin::setArg(FinLin::dequantize8, 0, clmem);
+	FinLin::setArg(FinLin::dequantize8, 1, res.mem());
+	FinLin::setArg(FinLin::dequantize8, 2, scalemem);
+	FinLin::setArg(FinLin::dequantize8, 3, zeromem);
+	FinLin::setArg(FinLin::dequantize8, 4, ld);
+	FinLin::execKernel(FinLin::dequantize8, 0, h, w, 0);
+
+	FinLin::readBuffer(res.mem(), 0, h*w * sizeof(double), res.data);
+	res.dirty = false;
+
+	return res;
+}
+
+// Binary operations
+Vec Mat8::operator*(Vec vec) {
+	ensureMulMat8Dims(w, vec.d);
+	vec.update();
+
+	// The vector is quantized as a single column, with one scale
+	double scale;
+	int zero;
+	quantParams(vec.data, vec.d, &scale, &zero);
+	cl_mem codes = FinLin::createBuffer(ld);
+	cl_mem memScale = FinLin::createBuffer(sizeof(double));
+	cl_mem memZero = FinLin::createBuffer(sizeof(int));
+	FinLin::writeBuffer(memScale, 0, sizeof(double), &scale);
+	FinLin::writeBuffer(memZero, 0, sizeof(int), &zero);
+
+	FinLin::setArg(FinLin::quantize8, 0, vec.mem());
+	FinLin::setArg(FinLin::quantize8, 1, codes);
+	FinLin::setArg(FinLin::quantize8, 2, memScale);
+	FinLin::setArg(FinLin::quantize8, 3, memZero);
+	FinLin::setArg(FinLin::quantize8, 4, w);
+	FinLin::setArg(FinLin::quantize8, 5, ld);
+	FinLin::execKernel(FinLin::quantize8, 0, 1, ld, 0);
+
+	Vec res = Vec(h);
+	FinLin::setArg(FinLin::matMul8, 0, clmem);
+	FinLin::setArg(FinLin::matMul8, 1, codes);
+	FinLin::setArg(FinLin::matMul8, 2, res.mem());
+	FinLin::setArg(FinLin::matMul8, 3, scalemem);
+	FinLin::setArg(FinLin::matMul8, 4, zeromem);
+	FinLin::setArg(FinLin::matMul8, 5, memScale);
+	FinLin::setArg(FinLin::matMul8, 6, memZero);
+	FinLin::setArg(FinLin::matMul8, 7, w);
+	FinLin::setArg(FinLin::matMul8, 8, ld);
+	FinLin::execKernel(FinLin::matMul8, 0, h, 1, 0);
+
+	FinLin::readBuffer(res.mem(), 0, h * sizeof(double), res.data);
+	res.dirty = false;
+
+	clReleaseMemObject(codes);
+	clReleaseMemObject(memScale);
+	clReleaseMemObject(memZero);
+
+	return res;
+}
+Mat Mat8::operator*(Mat8 multiplier) {
+	ensureMulMat8Dims(w, multiplier.h);
+	if(multiplier.perRow) {
+		// Scales along the summed dimension cannot be taken out of the sum
+		fprintf(
+			stderr,
+			"Cannot multiply by an 8-bit matrix quantized per row.\n"
+		);
+		exit(1);
+	}
+
+	// Rows of the transpose are the columns to take dot products with
+	cl_mem columns = FinLin::createBuffer(multiplier.w * ld);
+	FinLin::setArg(FinLin::packColumns8, 0, multiplier.clmem);
+	FinLin::setArg(FinLin::packColumns8, 1, columns);
+	FinLin::setArg(FinLin::packColumns8, 2, multiplier.h);
+	FinLin::setArg(FinLin::packColumns8, 3, multiplier.ld);
+	FinLin::setArg(FinLin::packColumns8, 4, ld);
+	FinLin::execKernel(FinLin::packColumns8, 0, multiplier.w, ld, 0);
+
+	Mat res = Mat(h, multiplier.w);
+	FinLin::setArg(FinLin::matMul8, 0, clmem);
+	FinLin::setArg(FinLin::matMul8, 1, columns);
+	FinLin::setArg(FinLin::matMul8, 2, res.mem());
+	FinLin::setArg(FinLin::matMul8, 3, scalemem);
+	FinLin::setArg(FinLin::matMul8, 4, zeromem);
+	FinLin::setArg(FinLin::matMul8, 5, multiplier.scalemem);
+	FinLin::setArg(FinLin::matMul8, 6, multiplier.zeromem);
+	FinLin::setArg(FinLin::matMul8, 7, w);
+	FinLin::setArg(FinLin::matMul8, 8, ld);
+	FinLin::execKernel(FinLin::matMul8, 0, h, multiplier.w, 0);
+
+	FinLin::readBuffer(
+		res.mem(),
+		0,
+		h*multiplier.w * sizeof(double),
+		res.data
+	);
+	res.dirty = false;
+
+	clReleaseMemObject(columns);
+
+	return res;
+}
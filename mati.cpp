@@ -116,12 +116,23 @@ void Mati::createMem() {
 Mati Mati::copy() const {
 	Mati res = Mati(h, w);
 	memcpy(res.data, data, w*h * sizeof(int));
+	// Copied on the GPU too rather than uploading again, and always while
+	// capturing, so that replays copy inputs that have been rebound
+	if(!dirty || FinLin::capturing != NULL) {
+		sync();
+		FinLin::copyBuffer(clmem, res.clmem, 0, 0, w*h * sizeof(int));
+		res.dirty = false;
+	}
 	return res;
 }
-bool Mati::update() {
-	if(!dirty) return false;
+void Mati::sync() const {
+	if(!dirty) return;
 	FinLin::writeBuffer(clmem, 0, w*h * sizeof(int), data);
 	dirty = false;
+}
+bool Mati::update() {
+	if(!dirty) return false;
+	sync();
 	return true;
 }
 
@@ -135,14 +146,14 @@ Mati::Mati(int height, int width, int *components) {
 Mati::Mati(int height, int width) {
 	h = height;
 	w = width;
-	data = (int*)malloc(w*h * sizeof(int));
+	data = (int*)FinLin::allocHost(w*h * sizeof(int));
 	memset(data, 0, w*h * sizeof(int));
 	createMem();
 }
 Mati::Mati(int size) {
 	h = size;
 	w = size;
-	data = (int*)malloc(w*h * sizeof(int));
+	data = (int*)FinLin::allocHost(w*h * sizeof(int));
 	memset(data, 0, w*h * sizeof(int));
 	for(int i = 0; i < w*h; i += w+1) {
 		data[i] = 1;
@@ -152,7 +163,7 @@ Mati::Mati(int size) {
 Mati::Mati(Mat mat) {
 	w = mat.w;
 	h = mat.h;
-	data = (int*)malloc(w*h * sizeof(int));
+	data = (int*)FinLin::allocHost(w*h * sizeof(int));
 	for(int i = 0; i < w*h; i++) {
 		data[i] = (int)mat.data[i];
 	}
@@ -161,11 +172,17 @@ Mati::Mati(Mat mat) {
 
 // Statics
 Mati Mati::randomUniform(int height, int width, int min, int max) {
-	int *components = (int*)malloc(width*height * sizeof(int));
-	for(int i = 0; i < width*height; i++) {
-		components[i] = (max - min) * rand() / RAND_MAX + min;
-	}
-	return Mati(height, width, components);
+	int len = width*height;
+	int *components = (int*)FinLin::allocHost(len * sizeof(int));
+	Mati res = Mati(height, width, components);
+	if(len == 0) return res;
+	FinLin::randomArgs(FinLin::randomInt, res.clmem, len);
+	FinLin::setArg(FinLin::randomInt, 7, min);
+	FinLin::setArg(FinLin::randomInt, 8, (int)((unsigned int)max - min));
+	FinLin::execKernel(FinLin::randomInt, 0, (len + 1) / 2, 0);
+	FinLin::readBuffer(res.clmem, 0, len * sizeof(int), res.data);
+	res.dirty = false;
+	return res;
 }
 Mati Mati::fromRowVec(Veci row) {
 	return Mati(1, row.d, row.data);
@@ -176,7 +193,7 @@ Mati Mati::fromColVec(Veci col) {
 Mati Mati::fromRowVecs(int numVecs, Veci *vecs) {
 	if(numVecs == 0) return Mati(0);
 	int width = vecs[0].d;
-	int *components = (int*)malloc(numVecs*width * sizeof(int));
+	int *components = (int*)FinLin::allocHost(numVecs*width * sizeof(int));
 	for(int row = 0; row < numVecs; row++) {
 		if(vecs[row].d != width) {
 			fprintf(stderr, "Cannot construct matrix from vectors"
@@ -333,25 +350,18 @@ Veci Mati::operator*(Veci vector) {
 	update();
 	vector.update();
 
-	cl_mem resBuff = clCreateBuffer(
-		FinLin::context,
-		CL_MEM_READ_WRITE,
-		h * sizeof(int),
-		NULL,
-		&FinLin::err
-	);
-	FinLin::checkErr();
+	Veci res = Veci(h);
 
 	FinLin::setArg(FinLin::matVeci, 0, clmem);
 	FinLin::setArg(FinLin::matVeci, 1, vector.clmem);
-	FinLin::setArg(FinLin::matVeci, 2, resBuff);
+	FinLin::setArg(FinLin::matVeci, 2, res.clmem);
 	FinLin::setArg(FinLin::matVeci, 3, w);
 	FinLin::execKernel(FinLin::matVeci, 0, h, 0);
 
-	int *resData = (int*)malloc(h * sizeof(int));
-	FinLin::readBuffer(resBuff, 0, h * sizeof(int), resData);
+	FinLin::readBuffer(res.clmem, 0, h * sizeof(int), res.data);
+	res.dirty = false;
 
-	return Veci(h, resData);
+	return res;
 }
 
 Mati Mati::operator*(Mati multiplier) {
@@ -359,25 +369,18 @@ Mati Mati::operator*(Mati multiplier) {
 	update();
 	multiplier.update();
 
-	cl_mem resBuff = clCreateBuffer(
-		FinLin::context,
-		CL_MEM_READ_WRITE,
-		h * multiplier.w * sizeof(int),
-		NULL,
-		&FinLin::err
-	);
-	FinLin::checkErr();
+	Mati res = Mati(h, multiplier.w);
 
 	FinLin::setArg(FinLin::matMuli, 0, clmem);
 	FinLin::setArg(FinLin::matMuli, 1, multiplier.clmem);
-	FinLin::setArg(FinLin::matMuli, 2, resBuff);
+	FinLin::setArg(FinLin::matMuli, 2, res.clmem);
 	FinLin::setArg(FinLin::matMuli, 3, w);
 	FinLin::execKernel(FinLin::matMuli, 0, h, multiplier.w, 0);
 
-	int *resData = (int*)malloc(h * multiplier.w * sizeof(int));
-	FinLin::readBuffer(resBuff, 0, h * multiplier.w * sizeof(int), resData);
+	FinLin::readBuffer(res.clmem, 0, h * multiplier.w * sizeof(int), res.data);
+	res.dirty = false;
 
-	return Mati(h, multiplier.w, resData);
+	return res;
 }
 
 Mati Mati::operator&(Mati multiplier) const {
@@ -421,7 +424,7 @@ Mati Mati::operator~() const {
 	return negated;
 }
 Mati Mati::T() const {
-	int *res = (int*)malloc(w*h * sizeof(int));
+	int *res = (int*)FinLin::allocHost(w*h * sizeof(int));
 	for(int r = 0; r < h; r++) {
 		for(int c = 0; c < w; c++) {
 			res[c*h + r] = data[r*w + c];
@@ -432,12 +435,12 @@ Mati Mati::T() const {
 
 // Misc operations
 Veci Mati::rowVeci(int row) const {
-	int *components = (int*)malloc(w * sizeof(int));
+	int *components = (int*)FinLin::allocHost(w * sizeof(int));
 	memcpy(components, data + row*w, w * sizeof(int));
 	return Veci(w, components);
 }
 Veci Mati::colVeci(int col) const {
-	int *components = (int*)malloc(h * sizeof(int));
+	int *components = (int*)FinLin::allocHost(h * sizeof(int));
 	for(int r = 0; r < h; r++) {
 		components[r] = comp(r, col);
 	}
@@ -0,0 +1,431 @@
+// Copyright (c) 2021 Thomas Kaldahl
+
+#include "finlin.hpp"
+
+// Helper functions
+void ensureSameMatlDim(int h1, int w1, int h2, int w2, const char *operation) {
+	if(w1 != w2) {
+		fprintf(
+			stderr,
+			"Dimension mismatch. Cannot %s matrices of width %d and %d.\n",
+			operation,
+			w1,
+			w2
+		);
+		exit(1);
+	} else if(h1 != h2) {
+		fprintf(
+			stderr,
+			"Dimension mismatch. Cannot %s matrices of height %d and %d.\n",
+			operation,
+			h1,
+			h2
+		);
+		exit(1);
+	}
+}
+void ensureMulMatlDims(int w1, int h2, const char *operation) {
+	if(w1 != h2) {
+		fprintf(
+			stderr,
+			"Dimension mismatch. "
+			"Cannot %s matrix of width %d with matrix of height %d.\n",
+			operation,
+			w1,
+			h2
+		);
+		exit(1);
+	}
+}
+void ensureSquareMatl(int h, int w, const char *operation) {
+	if(w != h) {
+		fprintf(
+			stderr,
+			"Cannot %s of non-square matrix.\n",
+			operation
+		);
+		exit(1);
+	}
+}
+void ensureInboundMatl(int r, int c, int h, int w, const char *operation) {
+	if(r < 0 || r >= h || c < 0 || c >= w) {
+		fprintf(
+			stderr,
+			"Cannot %s in row %d, column %d of %d by %d matrix.\n",
+			operation,
+			r,
+			c,
+			h,
+			w
+		);
+		exit(1);
+	}
+}
+
+// Technical methods
+void Matl::createMem() {
+	clmem = clCreateBuffer(
+		FinLin::context,
+		CL_MEM_READ_WRITE,
+		w*h * sizeof(int64_t),
+		NULL,
+		&FinLin::err
+	);
+	FinLin::checkErr();
+	dirty = true;
+}
+
+Matl Matl::copy() const {
+	Matl res = Matl(h, w);
+	memcpy(res.data, data, w*h * sizeof(int64_t));
+	// Copied on the GPU too rather than uploading again, and always while
+	// capturing, so that replays copy inputs that have been rebound
+	if(!dirty || FinLin::capturing != NULL) {
+		sync();
+		FinLin::copyBuffer(clmem, res.clmem, 0, 0, w*h * sizeof(int64_t));
+		res.dirty = false;
+	}
+	return res;
+}
+void Matl::sync() const {
+	if(!dirty) return;
+	FinLin::writeBuffer(clmem, 0, w*h * sizeof(int64_t), data);
+	dirty = false;
+}
+bool Matl::update() {
+	if(!dirty) return false;
+	sync();
+	return true;
+}
+
+// Constructors
+Matl::Matl(int height, int width, int64_t *components) {
+	h = height;
+	w = width;
+	data = components;
+	createMem();
+}
+Matl::Matl(int height, int width) {
+	h = height;
+	w = width;
+	data = (int64_t*)FinLin::allocHost(w*h * sizeof(int64_t));
+	memset(data, 0, w*h * sizeof(int64_t));
+	createMem();
+}
+Matl::Matl(int size) {
+	h = size;
+	w = size;
+	data = (int64_t*)FinLin::allocHost(w*h * sizeof(int64_t));
+	memset(data, 0, w*h * sizeof(int64_t));
+	for(int i = 0; i < w*h; i += w+1) {
+		data[i] = 1;
+	}
+	createMem();
+}
+Matl::Matl(Mati mat) {
+	w = mat.w;
+	h = mat.h;
+	data = (int64_t*)FinLin::allocHost(w*h * sizeof(int64_t));
+	for(int i = 0; i < w*h; i++) {
+		data[i] = mat.data[i];
+	}
+	createMem();
+}
+
+// Statics
+Matl Matl::randomUniform(int height, int width, int64_t min, int64_t max) {
+	int len = width*height;
+	int64_t *components = (int64_t*)FinLin::allocHost(len * sizeof(int64_t));
+	Matl res = Matl(height, width, components);
+	if(len == 0) return res;
+	FinLin::randomArgs(FinLin::randomLong, res.clmem, len);
+	FinLin::setArg(FinLin::randomLong, 7, min);
+	FinLin::setArg(FinLin::randomLong, 8, (int64_t)((uint64_t)max - min));
+	FinLin::execKernel(FinLin::randomLong, 0, (len + 1) / 2, 0);
+	FinLin::readBuffer(res.clmem, 0, len * sizeof(int64_t), res.data);
+	res.dirty = false;
+	return res;
+}
+Matl Matl::fromRowVec(Vecl row) {
+	return Matl(1, row.d, row.data);
+}
+Matl Matl::fromColVec(Vecl col) {
+	return Matl(col.d, 1, col.data);
+}
+Matl Matl::fromRowVecs(int numVecs, Vecl *vecs) {
+	if(numVecs == 0) return Matl(0);
+	int width = vecs[0].d;
+	int64_t *components =
+		(int64_t*)FinLin::allocHost(numVecs*width * sizeof(int64_t));
+	for(int row = 0; row < numVecs; row++) {
+		if(vecs[row].d != width) {
+			fprintf(stderr, "Cannot construct matrix from vectors"
+				" of varying dimension.\n");
+			exit(1);
+		}
+		memcpy(
+			components + row*width,
+			vecs[row].data,
+			width * sizeof(int64_t)
+		);
+	}
+	return Matl(numVecs, width, components);
+}
+Matl Matl::fromColVecs(int numVecs, Vecl *vecs) {
+	return fromRowVecs(numVecs, vecs).T();
+}
+
+// Accessors
+int Matl::height() const {
+	return h;
+}
+int Matl::width() const {
+	return w;
+}
+
+int64_t Matl::comp(int r, int c) const {
+	ensureInboundMatl(r, c, h, w, "access component");
+	return data[w*r + c];
+}
+
+char *Matl::string() const {
+	const int MAXLEN = 23;
+	char *res = (char*)malloc(MAXLEN * w*h * sizeof(char) + h + 4);
+	snprintf(res, MAXLEN, "(\n");
+	char *resp = res + 2;
+	for(int r = 0; r < h; r++) {
+		for(int c = 0; c < w; c++) {
+			snprintf(resp, MAXLEN, "\t%lld", (long long)data[w*r + c]);
+			resp += strlen(resp);
+		}
+		*resp = '\n';
+		resp++;
+	}
+	snprintf(resp, 2, ")");
+	return res;
+}
+
+// In-place operations
+Matl Matl::operator*=(int64_t scalar) {
+	update();
+
+	FinLin::setArg(FinLin::scalel, 0, clmem);
+	FinLin::setArg(FinLin::scalel, 1, scalar);
+	FinLin::execKernel(FinLin::scalel, 0, w*h, 0);
+	FinLin::readBuffer(clmem, 0, w*h * sizeof(int64_t), data);
+
+	return *this;
+}
+Matl Matl::operator/=(int64_t divisor) {
+	update();
+
+	FinLin::setArg(FinLin::dividel, 0, clmem);
+	FinLin::setArg(FinLin::dividel, 1, divisor);
+	FinLin::execKernel(FinLin::dividel, 0, w*h, 0);
+	FinLin::readBuffer(clmem, 0, w*h * sizeof(int64_t), data);
+
+	return *this;
+}
+Matl Matl::operator%=(int64_t modulus) {
+	update();
+
+	FinLin::setArg(FinLin::modulol, 0, clmem);
+	FinLin::setArg(FinLin::modulol, 1, modulus);
+	FinLin::execKernel(FinLin::modulol, 0, w*h, 0);
+	FinLin::readBuffer(clmem, 0, w*h * sizeof(int64_t), data);
+
+	return *this;
+}
+Matl Matl::operator^=(int exponent) {
+	ensureSquareMatl(h, w, "take power");
+	Matl base = copy();
+	for(int i = 1; i < exponent; i++) {
+		*this = *this * base;
+	}
+	return *this;
+}
+
+Matl Matl::operator&=(Matl multiplier) {
+	ensureSameMatlDim(h, w, multiplier.h, multiplier.w, "multiply");
+
+	update();
+	multiplier.update();
+
+	FinLin::setArg(FinLin::hadamardl, 0, clmem);
+	FinLin::setArg(FinLin::hadamardl, 1, multiplier.clmem);
+	FinLin::execKernel(FinLin::hadamardl, 0, w*h, 0);
+	FinLin::readBuffer(clmem, 0, w*h * sizeof(int64_t), data);
+
+	return *this;
+}
+Matl Matl::operator+=(Matl addend) {
+	ensureSameMatlDim(h, w, addend.h, addend.w, "add");
+
+	update();
+	addend.update();
+
+	FinLin::setArg(FinLin::addl, 0, clmem);
+	FinLin::setArg(FinLin::addl, 1, addend.clmem);
+	FinLin::execKernel(FinLin::addl, 0, w*h, 0);
+	FinLin::readBuffer(clmem, 0, w*h * sizeof(int64_t), data);
+
+	return *this;
+}
+Matl Matl::operator-=(Matl subtrahend) {
+	ensureSameMatlDim(h, w, subtrahend.h, subtrahend.w, "subtract");
+
+	update();
+	subtrahend.update();
+
+	FinLin::setArg(FinLin::addScaledl, 0, clmem);
+	FinLin::setArg(FinLin::addScaledl, 1, subtrahend.clmem);
+	FinLin::setArg(FinLin::addScaledl, 2, (int64_t)-1);
+	FinLin::execKernel(FinLin::addScaledl, 0, w*h, 0);
+
+	FinLin::readBuffer(clmem, 0, w*h * sizeof(int64_t), data);
+
+	return *this;
+}
+
+// Binary operations
+Matl Matl::operator*(int64_t scalar) const {
+	Matl matrix = copy();
+	matrix *= scalar;
+	return matrix;
+}
+Matl operator*(int64_t scalar, Matl matrix) {
+	Matl product = matrix.copy();
+	product *= scalar;
+	return product;
+}
+Matl Matl::operator/(int64_t divisor) const {
+	Matl dividend = copy();
+	dividend /= divisor;
+	return dividend;
+}
+Matl Matl::operator%(int64_t modulus) const {
+	Matl dividend = copy();
+	dividend %= modulus;
+	return dividend;
+}
+Matl Matl::operator^(int exponent) const {
+	Matl base = copy();
+	base ^= exponent;
+	return base;
+}
+
+Vecl Matl::operator*(Vecl vector) {
+	ensureMulMatlDims(w, vector.d, "multiply");
+	update();
+	vector.update();
+
+	Vecl res = Vecl(h);
+
+	FinLin::setArg(FinLin::matVecl, 0, clmem);
+	FinLin::setArg(FinLin::matVecl, 1, vector.clmem);
+	FinLin::setArg(FinLin::matVecl, 2, res.clmem);
+	FinLin::setArg(FinLin::matVecl, 3, w);
+	FinLin::execKernel(FinLin::matVecl, 0, h, 0);
+
+	FinLin::readBuffer(res.clmem, 0, h * sizeof(int64_t), res.data);
+	res.dirty = false;
+
+	return res;
+}
+
+Matl Matl::operator*(Matl multiplier) {
+	ensureMulMatlDims(w, multiplier.h, "multiply");
+	update();
+	multiplier.update();
+
+	Matl res = Matl(h, multiplier.w);
+
+	FinLin::setArg(FinLin::matMull, 0, clmem);
+	FinLin::setArg(FinLin::matMull, 1, multiplier.clmem);
+	FinLin::setArg(FinLin::matMull, 2, res.clmem);
+	FinLin::setArg(FinLin::matMull, 3, w);
+	FinLin::execKernel(FinLin::matMull, 0, h, multiplier.w, 0);
+
+	FinLin::readBuffer(
+		res.clmem,
+		0,
+		h * multiplier.w * sizeof(int64_t),
+		res.data
+	);
+	res.dirty = false;
+
+	return res;
+}
+
+Matl Matl::operator&(Matl multiplier) const {
+	Matl multiplicand = copy();
+	multiplicand &= multiplier;
+	return multiplicand;
+}
+Matl Matl::operator+(Matl addend) const {
+	Matl augend = copy();
+	augend += addend;
+	return augend;
+}
+Matl Matl::operator-(Matl subtrahend) const {
+	Matl minuend = copy();
+	minuend -= subtrahend;
+	return minuend;
+}
+
+// Unary operations
+
+int64_t Matl::trace() const {
+	ensureSquareMatl(h, w, "find trace");
+	int64_t sum = 0;
+	for(int i = 0; i < h; i++) {
+		sum += data[i*w + i];
+	}
+	return sum;
+}
+
+Matl Matl::operator-() const {
+	return (int64_t)-1 * *this;
+}
+Matl Matl::operator~() const {
+	Matl negated = copy();
+	negated.update();
+
+	FinLin::setArg(FinLin::compNotl, 0, negated.clmem);
+	FinLin::execKernel(FinLin::compNotl, 0, w*h, 0);
+	FinLin::readBuffer(negated.clmem, 0, w*h * sizeof(int64_t), negated.data);
+
+	return negated;
+}
+Matl Matl::T() const {
+	int64_t *res = (int64_t*)FinLin::allocHost(w*h * sizeof(int64_t));
+	for(int r = 0; r < h; r++) {
+		for(int c = 0; c < w; c++) {
+			res[c*h + r] = data[r*w + c];
+		}
+	}
+	return Matl(w, h, res);
+}
+
+// Misc operations
+Vecl Matl::rowVecl(int row) const {
+	int64_t *components = (int64_t*)FinLin::allocHost(w * sizeof(int64_t));
+	memcpy(components, data + row*w, w * sizeof(int64_t));
+	return Vecl(w, components);
+}
+Vecl Matl::colVecl(int col) const {
+	int64_t *components = (int64_t*)FinLin::allocHost(h * sizeof(int64_t));
+	for(int r = 0; r < h; r++) {
+		components[r] = data[r*w + col];
+	}
+	return Vecl(h, components);
+}
+
+// Mutators
+int64_t Matl::setComp(int r, int c, int64_t value) {
+	ensureInboundMatl(r, c, h, w, "set component");
+	int64_t prev = data[r*w + c];
+	data[r*w + c] = value;
+	dirty = true;
+	return prev;
+}
@@ -0,0 +1,470 @@
+// Copyright (c) 2021 Thomas Kaldahl
+
+#include "finlin.hpp"
+
+// Helper functions
+void ensureStructuredDims(int n, int d, const char *operation) {
+	if(n != d) {
+		fprintf(
+			stderr,
+			"Dimension mismatch. "
+			"Cannot %s structured matrix of size %d with dimension %d.\n",
+			operation,
+			n,
+			d
+		);
+		exit(1);
+	}
+}
+void ensureStructuredSquare(int h, int w) {
+	if(h != w) {
+		fprintf(
+			stderr,
+			"Cannot take structured matrix of non-square matrix "
+			"of %d by %d.\n",
+			h,
+			w
+		);
+		exit(1);
+	}
+}
+
+// Constructors
+ScalarMat::ScalarMat(int size, double scalar) {
+	n = size;
+	x = scalar;
+}
+DiagMat::DiagMat(Vec diagonal) : diag(diagonal) {}
+DiagMat::DiagMat(Mat mat) : diag(mat.h) {
+	ensureStructuredSquare(mat.h, mat.w);
+	for(int i = 0; i < mat.h; i++) {
+		diag.data[i] = mat.data[i*mat.w + i];
+	}
+}
+TriMat::TriMat(Mat mat, bool upper) : tri(mat.copy()) {
+	ensureStructuredSquare(mat.h, mat.w);
+	this->upper = upper;
+	tri.detach(); // Clearing the other triangle must not reach mat
+	for(int r = 0; r < tri.h; r++) {
+		for(int c = 0; c < tri.w; c++) {
+			if(upper ? c < r : c > r) tri.data[r*tri.w + c] = 0;
+		}
+	}
+	tri.dirty = true;
+}
+SymMat::SymMat(Mat mat) : packed(mat.h * (mat.h + 1) / 2) {
+	ensureStructuredSquare(mat.h, mat.w);
+	n = mat.h;
+	if(n == 0) return;
+	mat.update();
+
+	FinLin::setArg(FinLin::packSym, 0, mat.mem());
+	FinLin::setArg(FinLin::packSym, 1, packed.mem());
+	FinLin::execKernel(FinLin::packSym, 0, n, n, 0);
+	FinLin::readBuffer(packed.mem(), 0, packed.d * sizeof(double), packed.data);
+	packed.dirty = false;
+}
+
+// Accessors
+int ScalarMat::size() const {
+	return n;
+}
+double ScalarMat::scalar() const {
+	return x;
+}
+double ScalarMat::comp(int r, int c) const {
+	return r == c ? x : 0;
+}
+Mat ScalarMat::toMat() const {
+	return Mat(n, x);
+}
+
+int DiagMat::size() const {
+	return diag.d;
+}
+Vec DiagMat::diagonal() const {
+	return diag;
+}
+double DiagMat::comp(int r, int c) const {
+	return r == c ? diag.data[r] : 0;
+}
+Mat DiagMat::toMat() const {
+	return Mat(diag.d, diag.d) + *this;
+}
+
+int TriMat::size() const {
+	return tri.h;
+}
+bool TriMat::isUpper() const {
+	return upper;
+}
+double TriMat::comp(int r, int c) const {
+	return tri.data[r*tri.w + c];
+}
+Mat TriMat::toMat() const {
+	return tri.copy();
+}
+
+int SymMat::size() const {
+	return n;
+}
+double SymMat::comp(int r, int c) const {
+	if(c > r) return comp(c, r);
+	return packed.data[r*(r + 1)/2 + c];
+}
+Mat SymMat::toMat() const {
+	Mat res = Mat(n, n);
+	if(n == 0) return res;
+	packed.sync();
+
+	FinLin::setArg(FinLin::unpackSym, 0, packed.mem());
+	FinLin::setArg(FinLin::unpackSym, 1, res.mem());
+	FinLin::setArg(FinLin::unpackSym, 2, 0);
+	FinLin::execKernel(FinLin::unpackSym, 0, n, n, 0);
+	FinLin::readBuffer(res.mem(), 0, n*n * sizeof(double), res.data);
+	res.dirty = false;
+
+	return res;
+}
+
+// Binary operations
+Vec ScalarMat::operator*(Vec multiplier) const {
+	ensureStructuredDims(n, multiplier.dim(), "multiply");
+	return multiplier * x;
+}
+Mat ScalarMat::operator*(Mat multiplier) const {
+	ensureStructuredDims(n, multiplier.height(), "multiply");
+
+	// Through a const reference, as x converts to the operands of the
+	// non-const overloads too, by the Mat(int) and Vec(int) constructors
+	const Mat &multiplicand = multiplier;
+	return multiplicand * x;
+}
+ScalarMat ScalarMat::operator*(ScalarMat multiplier) const {
+	ensureStructuredDims(n, multiplier.n, "multiply");
+	return ScalarMat(n, x * multiplier.x);
+}
+Mat ScalarMat::operator+(Mat addend) const {
+	return addend + *this;
+}
+ScalarMat ScalarMat::operator+(ScalarMat addend) const {
+	ensureStructuredDims(n, addend.n, "add");
+	return ScalarMat(n, x + addend.x);
+}
+Vec ScalarMat::solve(Vec rhs) const {
+	ensureStructuredDims(n, rhs.dim(), "solve system of");
+	return rhs / x;
+}
+Mat ScalarMat::solve(Mat rhs) const {
+	ensureStructuredDims(n, rhs.height(), "solve system of");
+	return rhs / x;
+}
+
+Vec DiagMat::operator*(Vec multiplier) const {
+	ensureStructuredDims(diag.d, multiplier.d, "multiply");
+	return diag & multiplier;
+}
+Mat DiagMat::operator*(Mat multiplier) const {
+	ensureStructuredDims(diag.d, multiplier.h, "multiply");
+	Mat res = multiplier.deviceCopy();
+	if(res.h*res.w == 0) return res;
+	res.update();
+	diag.sync();
+
+	FinLin::setArg(FinLin::scaleRows, 0, res.mem());
+	FinLin::setArg(FinLin::scaleRows, 1, diag.mem());
+	FinLin::setArg(FinLin::scaleRows, 2, 0);
+	FinLin::execKernel(FinLin::scaleRows, 0, res.h, res.w, 0);
+	FinLin::readBuffer(res.mem(), 0, res.h*res.w * sizeof(double), res.data);
+
+	return res;
+}
+DiagMat DiagMat::operator*(DiagMat multiplier) const {
+	ensureStructuredDims(diag.d, multiplier.diag.d, "multiply");
+	return DiagMat(diag & multiplier.diag);
+}
+Mat DiagMat::operator+(Mat addend) const {
+	return addend + *this;
+}
+DiagMat DiagMat::operator+(DiagMat addend) const {
+	ensureStructuredDims(diag.d, addend.diag.d, "add");
+	return DiagMat(diag + addend.diag);
+}
+Vec DiagMat::solve(Vec rhs) const {
+	ensureStructuredDims(diag.d, rhs.d, "solve system of");
+	Vec sol = rhs.deviceCopy();
+	if(sol.d == 0) return sol;
+	sol.update();
+	diag.sync();
+
+	FinLin::setArg(FinLin::scaleRows, 0, sol.mem());
+	FinLin::setArg(FinLin::scaleRows, 1, diag.mem());
+	FinLin::setArg(FinLin::scaleRows, 2, 1);
+	FinLin::execKernel(FinLin::scaleRows, 0, sol.d, 1, 0);
+	FinLin::readBuffer(sol.mem(), 0, sol.d * sizeof(double), sol.data);
+
+	return sol;
+}
+Mat DiagMat::solve(Mat rhs) const {
+	ensureStructuredDims(diag.d, rhs.h, "solve system of");
+	Mat sol = rhs.deviceCopy();
+	if(sol.h*sol.w == 0) return sol;
+	sol.update();
+	diag.sync();
+
+	FinLin::setArg(FinLin::scaleRows, 0, sol.mem());
+	FinLin::setArg(FinLin::scaleRows, 1, diag.mem());
+	FinLin::setArg(FinLin::scaleRows, 2, 1);
+	FinLin::execKernel(FinLin::scaleRows, 0, sol.h, sol.w, 0);
+	FinLin::readBuffer(sol.mem(), 0, sol.h*sol.w * sizeof(double), sol.data);
+
+	return sol;
+}
+
+Vec TriMat::operator*(Vec multiplier) const {
+	ensureStructuredDims(tri.h, multiplier.d, "multiply");
+	Vec res = Vec(tri.h);
+	if(tri.h == 0) return res;
+	tri.sync();
+	multiplier.update();
+
+	FinLin::setArg(FinLin::triMul, 0, tri.mem());
+	FinLin::setArg(FinLin::triMul, 1, multiplier.mem());
+	FinLin::setArg(FinLin::triMul, 2, res.mem());
+	FinLin::setArg(FinLin::triMul, 3, tri.w);
+	FinLin::setArg(FinLin::triMul, 4, upper ? 2 : 1);
+	FinLin::execKernel(FinLin::triMul, 0, tri.h, 1, 0);
+	FinLin::readBuffer(res.mem(), 0, res.d * sizeof(double), res.data);
+	res.dirty = false;
+
+	return res;
+}
+Mat TriMat::operator*(Mat multiplier) const {
+	ensureStructuredDims(tri.h, multiplier.h, "multiply");
+	Mat res = Mat(tri.h, multiplier.w);
+	if(tri.h*multiplier.w == 0) return res;
+	tri.sync();
+	multiplier.update();
+
+	FinLin::setArg(FinLin::triMul, 0, tri.mem());
+	FinLin::setArg(FinLin::triMul, 1, multiplier.mem());
+	FinLin::setArg(FinLin::triMul, 2, res.mem());
+	FinLin::setArg(FinLin::triMul, 3, tri.w);
+	FinLin::setArg(FinLin::triMul, 4, upper ? 2 : 1);
+	FinLin::execKernel(FinLin::triMul, 0, res.h, res.w, 0);
+	FinLin::readBuffer(res.mem(), 0, res.h*res.w * sizeof(double), res.data);
+	res.dirty = false;
+
+	return res;
+}
+Mat TriMat::operator+(Mat addend) const {
+	return addend + *this;
+}
+TriMat TriMat::operator+(TriMat addend) const {
+	ensureStructuredDims(tri.h, addend.tri.h, "add");
+	if(upper != addend.upper) {
+		fprintf(stderr, "Cannot add upper and lower triangular matrices.\n");
+		exit(1);
+	}
+	return TriMat(tri + addend.tri, upper);
+}
+Vec TriMat::solve(Vec rhs) const {
+	ensureStructuredDims(tri.h, rhs.d, "solve system of");
+	Vec sol = rhs.deviceCopy();
+	if(sol.d == 0) return sol;
+	sol.update();
+	tri.sync();
+
+	Mat::triangularSolve(tri.mem(), tri.h, upper, false, false, sol.mem(), 1);
+	FinLin::readBuffer(sol.mem(), 0, sol.d * sizeof(double), sol.data);
+
+	return sol;
+}
+Mat TriMat::solve(Mat rhs) const {
+	ensureStructuredDims(tri.h, rhs.h, "solve system of");
+	Mat sol = rhs.deviceCopy();
+	if(sol.h*sol.w == 0) return sol;
+	sol.update();
+	tri.sync();
+
+	Mat::triangularSolve(
+		tri.mem(),
+		tri.h,
+		upper,
+		false,
+		false,
+		sol.mem(),
+		sol.w
+	);
+	FinLin::readBuffer(sol.mem(), 0, sol.h*sol.w * sizeof(double), sol.data);
+
+	return sol;
+}
+
+Vec SymMat::operator*(Vec multiplier) const {
+	ensureStructuredDims(n, multiplier.d, "multiply");
+	Vec res = Vec(n);
+	if(n == 0) return res;
+	packed.sync();
+	multiplier.update();
+
+	FinLin::setArg(FinLin::symMul, 0, packed.mem());
+	FinLin::setArg(FinLin::symMul, 1, multiplier.mem());
+	FinLin::setArg(FinLin::symMul, 2, res.mem());
+	FinLin::setArg(FinLin::symMul, 3, n);
+	FinLin::setArg(FinLin::symMul, 4, 0);
+	FinLin::execKernel(FinLin::symMul, 0, n, 1, 0);
+	FinLin::readBuffer(res.mem(), 0, n * sizeof(double), res.data);
+	res.dirty = false;
+
+	return res;
+}
+Mat SymMat::operator*(Mat multiplier) const {
+	ensureStructuredDims(n, multiplier.h, "multiply");
+	Mat res = Mat(n, multiplier.w);
+	if(n*multiplier.w == 0) return res;
+	packed.sync();
+	multiplier.update();
+
+	FinLin::setArg(FinLin::symMul, 0, packed.mem());
+	FinLin::setArg(FinLin::symMul, 1, multiplier.mem());
+	FinLin::setArg(FinLin::symMul, 2, res.mem());
+	FinLin::setArg(FinLin::symMul, 3, n);
+	FinLin::setArg(FinLin::symMul, 4, 0);
+	FinLin::execKernel(FinLin::symMul, 0, res.h, res.w, 0);
+	FinLin::readBuffer(res.mem(), 0, res.h*res.w * sizeof(double), res.data);
+	res.dirty = false;
+
+	return res;
+}
+Mat SymMat::operator+(Mat addend) const {
+	return addend + *this;
+}
+SymMat SymMat::operator+(SymMat addend) const {
+	ensureStructuredDims(n, addend.n, "add");
+	SymMat res = *this;
+	res.packed = packed + addend.packed;
+	return res;
+}
+Vec SymMat::solve(Vec rhs) const {
+	ensureStructuredDims(n, rhs.d, "solve system of");
+	Mat factor = toMat();
+	Vec sol = factor.solveSPD(rhs);
+	factor.release();
+	return sol;
+}
+Mat SymMat::solve(Mat rhs) const {
+	ensureStructuredDims(n, rhs.h, "solve system of");
+	Mat factor = toMat();
+	Mat sol = factor.solveSPD(rhs);
+	factor.release();
+	return sol;
+}
+
+// Dense matrices with structured ones
+Mat Mat::operator*(ScalarMat multiplier) const {
+	ensureStructuredDims(multiplier.size(), w, "multiply");
+	return *this * multiplier.scalar();
+}
+Mat Mat::operator*(DiagMat multiplier) const {
+	ensureStructuredDims(multiplier.diag.d, w, "multiply");
+	Mat res = deviceCopy();
+	if(h*w == 0) return res;
+	res.update();
+	multiplier.diag.sync();
+
+	FinLin::setArg(FinLin::scaleCols, 0, res.mem());
+	FinLin::setArg(FinLin::scaleCols, 1, multiplier.diag.mem());
+	FinLin::execKernel(FinLin::scaleCols, 0, h, w, 0);
+	FinLin::readBuffer(res.mem(), 0, h*w * sizeof(double), res.data);
+
+	return res;
+}
+Mat Mat::operator*(TriMat multiplier) const {
+	ensureStructuredDims(multiplier.tri.h, w, "multiply");
+	Mat res = Mat(h, w);
+	if(h*w == 0) return res;
+	sync();
+	multiplier.tri.sync();
+
+	FinLin::setArg(FinLin::triMul, 0, mem());
+	FinLin::setArg(FinLin::triMul, 1, multiplier.tri.mem());
+	FinLin::setArg(FinLin::triMul, 2, res.mem());
+	FinLin::setArg(FinLin::triMul, 3, w);
+	FinLin::setArg(FinLin::triMul, 4, multiplier.upper ? 4 : 3);
+	FinLin::execKernel(FinLin::triMul, 0, h, w, 0);
+	FinLin::readBuffer(res.mem(), 0, h*w * sizeof(double), res.data);
+	res.dirty = false;
+
+	return res;
+}
+Mat Mat::operator*(SymMat multiplier) const {
+	ensureStructuredDims(multiplier.n, w, "multiply");
+	Mat res = Mat(h, w);
+	if(h*w == 0) return res;
+	sync();
+	multiplier.packed.sync();
+
+	FinLin::setArg(FinLin::symMul, 0, multiplier.packed.mem());
+	FinLin::setArg(FinLin::symMul, 1, mem());
+	FinLin::setArg(FinLin::symMul, 2, res.mem());
+	FinLin::setArg(FinLin::symMul, 3, w);
+	FinLin::setArg(FinLin::symMul, 4, 1);
+	FinLin::execKernel(FinLin::symMul, 0, h, w, 0);
+	FinLin::readBuffer(res.mem(), 0, h*w * sizeof(double), res.data);
+	res.dirty = false;
+
+	return res;
+}
+Mat Mat::operator+(ScalarMat addend) const {
+	ensureStructuredDims(addend.size(), h, "add");
+	ensureStructuredDims(addend.size(), w, "add");
+	Mat res = deviceCopy();
+	if(h == 0) return res;
+	res.update();
+
+	FinLin::setArg(FinLin::shiftDiagonal, 0, res.mem());
+	FinLin::setArg(FinLin::shiftDiagonal, 1, w);
+	FinLin::setArg(FinLin::shiftDiagonal, 2, addend.scalar());
+	FinLin::execKernel(FinLin::shiftDiagonal, 0, h, 0);
+	FinLin::readBuffer(res.mem(), 0, h*w * sizeof(double), res.data);
+
+	return res;
+}
+Mat Mat::operator+(DiagMat addend) const {
+	ensureStructuredDims(addend.diag.d, h, "add");
+	ensureStructuredDims(addend.diag.d, w, "add");
+	Mat res = deviceCopy();
+	if(h == 0) return res;
+	res.update();
+	addend.diag.sync();
+
+	FinLin::setArg(FinLin::addDiagonal, 0, res.mem());
+	FinLin::setArg(FinLin::addDiagonal, 1, addend.diag.mem());
+	FinLin::setArg(FinLin::addDiagonal, 2, w);
+	FinLin::execKernel(FinLin::addDiagonal, 0, h, 0);
+	FinLin::readBuffer(res.mem(), 0, h*w * sizeof(double), res.data);
+
+	return res;
+}
+Mat Mat::operator+(TriMat addend) const {
+	ensureStructuredDims(addend.tri.h, h, "add");
+	ensureStructuredDims(addend.tri.h, w, "add");
+	return *this + addend.tri;
+}
+Mat Mat::operator+(SymMat addend) const {
+	ensureStructuredDims(addend.n, h, "add");
+	ensureStructuredDims(addend.n, w, "add");
+	Mat res = deviceCopy();
+	if(h == 0) return res;
+	res.update();
+	addend.packed.sync();
+
+	FinLin::setArg(FinLin::unpackSym, 0, addend.packed.mem());
+	FinLin::setArg(FinLin::unpackSym, 1, res.mem());
+	FinLin::setArg(FinLin::unpackSym, 2, 1);
+	FinLin::execKernel(FinLin::unpackSym, 0, h, w, 0);
+	FinLin::readBuffer(res.mem(), 0, h*w * sizeof(double), res.data);
+
+	return res;
+}
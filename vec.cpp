@@ -18,26 +18,106 @@ void ensureSameVecDim(int d1, int d2, const char *operation) {
 
 // Technical methods
 void Vec::createMem() {
-	clmem = clCreateBuffer(
-		FinLin::context,
-		CL_MEM_READ_WRITE,
-		d * sizeof(double),
-		NULL,
-		&FinLin::err
-	);
-	FinLin::checkErr();
+	// The OpenCL memory object waits for the first operation on the GPU, so
+	// that values only ever used on the host never allocate one
+	buffer = (FinLin::Buffer*)malloc(sizeof(FinLin::Buffer));
+	buffer->clmem = NULL;
+	buffer->refs = 1;
+	buffer->pinned = false;
 	dirty = true;
 }
+cl_mem Vec::mem() const {
+	if(buffer->clmem == NULL) {
+		buffer->clmem = FinLin::createBuffer(d * sizeof(double));
+	}
+	return buffer->clmem;
+}
+void Vec::release() {
+	if(--buffer->refs > 0) return; // Still shared by copies
+	if(buffer->clmem != NULL) clReleaseMemObject(buffer->clmem);
+	free(buffer);
+	free(data);
+}
+void Vec::detach() {
+	if(buffer->refs == 1) return;
+
+	// This vector moves to components of its own but keeps its GPU memory,
+	// which graphs may have recorded. The copies get a copy of that memory,
+	// not recorded, so that replays do not overwrite them.
+	FinLin::Buffer *shared = buffer;
+	shared->refs--;
+	double *components = (double*)FinLin::allocHost(d * sizeof(double));
+	memcpy(components, data, d * sizeof(double));
+	data = components;
+	buffer = (FinLin::Buffer*)malloc(sizeof(FinLin::Buffer));
+	buffer->clmem = shared->clmem;
+	buffer->refs = 1;
+	buffer->pinned = false;
+	if(shared->clmem != NULL) {
+		shared->clmem = FinLin::createBuffer(d * sizeof(double));
+		FinLin::err = clEnqueueCopyBuffer(
+			FinLin::commandQueue,
+			buffer->clmem,
+			shared->clmem,
+			0,
+			0,
+			d * sizeof(double),
+			0,
+			NULL,
+			NULL
+		);
+		FinLin::checkErr();
+	}
+}
 
 Vec Vec::copy() const {
-	Vec res = Vec(d);
+	// Shares these components and memory until one of the two is written,
+	// except for graph outputs, which replays overwrite, and while capturing
+	if(!buffer->pinned && FinLin::capturing == NULL) {
+		buffer->refs++;
+		return *this;
+	}
+
+	Vec res = Vec(d, (double*)FinLin::allocHost(d * sizeof(double)));
 	memcpy(res.data, data, d * sizeof(double));
+	// Copied on the GPU too rather than uploading again, and always while
+	// capturing, so that replays copy inputs that have been rebound
+	if(!dirty || FinLin::capturing != NULL) {
+		sync();
+		FinLin::copyBuffer(mem(), res.mem(), 0, 0, d * sizeof(double));
+		res.dirty = false;
+	}
 	return res;
 }
+Vec Vec::deviceCopy() const {
+	Vec res = Vec(d, (double*)FinLin::allocHost(d * sizeof(double)));
+	if(hostPath()) {
+		memcpy(res.data, data, d * sizeof(double));
+		return res;
+	}
+	// Uploaded straight from these components, except while capturing, when
+	// they are uploaded first so that the copy is recorded for replays
+	if(dirty && FinLin::capturing == NULL) {
+		FinLin::writeBuffer(res.mem(), 0, d * sizeof(double), data);
+	} else {
+		sync();
+		FinLin::copyBuffer(mem(), res.mem(), 0, 0, d * sizeof(double));
+	}
+	res.dirty = false;
+	return res;
+}
+bool Vec::hostPath() const {
+	// The device reads the result back, after uploading it if necessary
+	return FinLin::onHost(d, dirty ? 2*d : d);
+}
+void Vec::sync() const {
+	if(!dirty) return;
+	FinLin::writeBuffer(mem(), 0, d*sizeof(double), data);
+	dirty = false;
+}
 bool Vec::update() {
 	if(!dirty) return false;
-	FinLin::writeBuffer(clmem, 0, d*sizeof(double), data);
-	dirty = false;
+	sync();
 	return true;
 }
 
@@ -49,13 +129,13 @@ Vec::Vec(int dimension, double* components) {
 }
 Vec::Vec(int dimension) {
 	d = dimension;
-	data = (double*)malloc(d * sizeof(double));
+	data = (double*)FinLin::allocHost(d * sizeof(double));
 	memset(data, 0, d * sizeof(double));
 	createMem();
 }
 Vec::Vec(Veci vec) {
 	d = vec.d;
-	data = (double*)malloc(d * sizeof(double));
+	data = (double*)FinLin::allocHost(d * sizeof(double));
 	for(int i = 0; i < d; i++) {
 		data[i] = (double)vec.data[i];
 	}
@@ -64,11 +144,26 @@ Vec::Vec(Veci vec) {
 
 // Statics
 Vec Vec::randomUniform(int dim, double min, double max) {
-	double *components = (double*)malloc(dim * sizeof(double));
-	for(int i = 0; i < dim; i++) {
-		components[i] = (max - min) * rand() / RAND_MAX + min;
-	}
-	return Vec(dim, components);
+	Vec res = Vec(dim, (double*)FinLin::allocHost(dim * sizeof(double)));
+	if(dim == 0) return res;
+	FinLin::randomArgs(FinLin::randomUniform, res.mem(), dim);
+	FinLin::setArg(FinLin::randomUniform, 7, min);
+	FinLin::setArg(FinLin::randomUniform, 8, max);
+	FinLin::execKernel(FinLin::randomUniform, 0, (dim + 1) / 2, 0);
+	FinLin::readBuffer(res.mem(), 0, dim * sizeof(double), res.data);
+	res.dirty = false;
+	return res;
+}
+Vec Vec::randomNormal(int dim, double mean, double stddev) {
+	Vec res = Vec(dim, (double*)FinLin::allocHost(dim * sizeof(double)));
+	if(dim == 0) return res;
+	FinLin::randomArgs(FinLin::randomNormal, res.mem(), dim);
+	FinLin::setArg(FinLin::randomNormal, 7, mean);
+	FinLin::setArg(FinLin::randomNormal, 8, stddev);
+	FinLin::execKernel(FinLin::randomNormal, 0, (dim + 1) / 2, 0);
+	FinLin::readBuffer(res.mem(), 0, dim * sizeof(double), res.data);
+	res.dirty = false;
+	return res;
 }
 
 Vec *Vec::gramSchmidt(int numVecs, Vec *vecs) {
@@ -106,12 +201,18 @@ char *Vec::string() const {
 
 // In-place operations
 Vec Vec::operator*=(double scalar) {
+	detach();
+	if(hostPath()) {
+		for(int i = 0; i < d; i++) data[i] *= scalar;
+		dirty = true;
+		return *this;
+	}
 	update();
 
-	FinLin::setArg(FinLin::scale, 0, clmem);
+	FinLin::setArg(FinLin::scale, 0, mem());
 	FinLin::setArg(FinLin::scale, 1, scalar);
 	FinLin::execKernel(FinLin::scale, 0, d, 0);
-	FinLin::readBuffer(clmem, 0, d*sizeof(double), data);
+	FinLin::readBuffer(mem(), 0, d*sizeof(double), data);
 
 	return *this;
 }
@@ -122,43 +223,61 @@ Vec Vec::operator/=(double divisor) {
 
 Vec Vec::operator+=(Vec addend) {
 	ensureSameVecDim(d, addend.d, "add");
+	detach();
+	if(hostPath()) {
+		for(int i = 0; i < d; i++) data[i] += addend.data[i];
+		dirty = true;
+		return *this;
+	}
 
 	update();
 	addend.update();
 
-	FinLin::setArg(FinLin::add, 0, clmem);
-	FinLin::setArg(FinLin::add, 1, addend.clmem);
+	FinLin::setArg(FinLin::add, 0, mem());
+	FinLin::setArg(FinLin::add, 1, addend.mem());
 	FinLin::execKernel(FinLin::add, 0, d, 0);
-	FinLin::readBuffer(clmem, 0, d*sizeof(double), data);
+	FinLin::readBuffer(mem(), 0, d*sizeof(double), data);
 
 	return *this;
 }
 
 Vec Vec::operator-=(Vec subtrahend) {
 	ensureSameVecDim(d, subtrahend.d, "subtract");
+	detach();
+	if(hostPath()) {
+		for(int i = 0; i < d; i++) data[i] -= subtrahend.data[i];
+		dirty = true;
+		return *this;
+	}
 
 	update();
 	subtrahend.update();
 
-	FinLin::setArg(FinLin::addScaled, 0, clmem);
-	FinLin::setArg(FinLin::addScaled, 1, subtrahend.clmem);
+	FinLin::setArg(FinLin::addScaled, 0, mem());
+	FinLin::setArg(FinLin::addScaled, 1, subtrahend.mem());
 	FinLin::setArg(FinLin::addScaled, 2, -1.0);
 	FinLin::execKernel(FinLin::addScaled, 0, d, 0);
 
-	FinLin::readBuffer(clmem, 0, d*sizeof(double), data);
+	FinLin::readBuffer(mem(), 0, d*sizeof(double), data);
 
 	return *this;
 }
 
 Vec Vec::operator&=(Vec multiplier) {
 	ensureSameVecDim(d, multiplier.d, "multiply");
+	detach();
+	if(hostPath()) {
+		for(int i = 0; i < d; i++) data[i] *= multiplier.data[i];
+		dirty = true;
+		return *this;
+	}
 	update();
 	multiplier.update();
 
-	FinLin::setArg(FinLin::hadamard, 0, clmem);
-	FinLin::setArg(FinLin::hadamard, 1, multiplier.clmem);
+	FinLin::setArg(FinLin::hadamard, 0, mem());
+	FinLin::setArg(FinLin::hadamard, 1, multiplier.mem());
 	FinLin::execKernel(FinLin::hadamard, 0, d, 0);
-	FinLin::readBuffer(clmem, 0, d*sizeof(double), data);
+	FinLin::readBuffer(mem(), 0, d*sizeof(double), data);
 
 	return *this;
 }
@@ -167,27 +286,108 @@ Vec Vec::normalize() {
 	return *this /= norm();
 }
 Vec Vec::setSigmoid() {
+	detach();
 	update();
 
-	FinLin::setArg(FinLin::sigmoid, 0, clmem);
+	FinLin::setArg(FinLin::sigmoid, 0, mem());
 	FinLin::execKernel(FinLin::sigmoid, 0, d, 0);
-	FinLin::readBuffer(clmem, 0, d*sizeof(double), data);
+	FinLin::readBuffer(mem(), 0, d*sizeof(double), data);
 
 	return *this;
 }
 Vec Vec::setDsigmoid() {
+	detach();
 	update();
 
-	FinLin::setArg(FinLin::dsigmoid, 0, clmem);
+	FinLin::setArg(FinLin::dsigmoid, 0, mem());
 	FinLin::execKernel(FinLin::dsigmoid, 0, d, 0);
-	FinLin::readBuffer(clmem, 0, d*sizeof(double), data);
+	FinLin::readBuffer(mem(), 0, d*sizeof(double), data);
+
+	return *this;
+}
+Vec Vec::setRelu() {
+	detach();
+	update();
+
+	FinLin::setArg(FinLin::relu, 0, mem());
+	FinLin::setArg(FinLin::relu, 1, 0.0);
+	FinLin::execKernel(FinLin::relu, 0, d, 0);
+	FinLin::readBuffer(mem(), 0, d*sizeof(double), data);
+
+	return *this;
+}
+Vec Vec::setLeakyRelu(double slope) {
+	detach();
+	update();
+
+	FinLin::setArg(FinLin::relu, 0, mem());
+	FinLin::setArg(FinLin::relu, 1, slope);
+	FinLin::execKernel(FinLin::relu, 0, d, 0);
+	FinLin::readBuffer(mem(), 0, d*sizeof(double), data);
+
+	return *this;
+}
+Vec Vec::setTanh() {
+	detach();
+	update();
+
+	FinLin::setArg(FinLin::tanhActivation, 0, mem());
+	FinLin::execKernel(FinLin::tanhActivation, 0, d, 0);
+	FinLin::readBuffer(mem(), 0, d*sizeof(double), data);
+
+	return *this;
+}
+Vec Vec::setGelu() {
+	detach();
+	update();
+
+	FinLin::setArg(FinLin::gelu, 0, mem());
+	FinLin::execKernel(FinLin::gelu, 0, d, 0);
+	FinLin::readBuffer(mem(), 0, d*sizeof(double), data);
+
+	return *this;
+}
+Vec Vec::setLogistic() {
+	detach();
+	update();
+
+	FinLin::setArg(FinLin::logistic, 0, mem());
+	FinLin::execKernel(FinLin::logistic, 0, d, 0);
+	FinLin::readBuffer(mem(), 0, d*sizeof(double), data);
+
+	return *this;
+}
+Vec Vec::setMap(const char *expr) {
+	cl_kernel kernel = FinLin::userKernel(expr, false);
+	if(d == 0) return *this;
+	detach();
+	update();
+
+	FinLin::setArg(kernel, 0, mem());
+	FinLin::execKernel(kernel, 0, d, 0);
+	FinLin::readBuffer(mem(), 0, d*sizeof(double), data);
+
+	return *this;
+}
+Vec Vec::setZip(Vec other, const char *expr) {
+	ensureSameVecDim(d, other.d, "zip");
+	cl_kernel kernel = FinLin::userKernel(expr, true);
+	if(d == 0) return *this;
+	detach();
+	update();
+	other.update();
+
+	FinLin::setArg(kernel, 0, mem());
+	FinLin::setArg(kernel, 1, other.mem());
+	FinLin::execKernel(kernel, 0, d, 0);
+	FinLin::readBuffer(mem(), 0, d*sizeof(double), data);
 
 	return *this;
 }
 
 // Binary operations
 Vec Vec::operator*(double scalar) const {
-	Vec vector = copy();
+	Vec vector = deviceCopy();
 	vector *= scalar;
 	return vector;
 }
@@ -195,7 +395,7 @@ Vec operator*(double scalar, Vec vector) {
 	return vector * scalar;
 }
 Vec Vec::operator/(double divisor) const {
-	Vec dividend = copy();
+	Vec dividend = deviceCopy();
 	dividend /= divisor;
 	return dividend;
 }
@@ -205,64 +405,65 @@ double Vec::operator^(double exponent) const {
 
 Vec Vec::operator+(Vec addend) const {
 	ensureSameVecDim(d, addend.d, "add");
-	Vec augend = copy();
+	Vec augend = deviceCopy();
 	augend += addend;
 	return augend;
 }
 Vec Vec::operator-(Vec subtrahend) const {
 	ensureSameVecDim(d, subtrahend.d, "subtract");
-	Vec minuend = copy();
+	Vec minuend = deviceCopy();
 	minuend -= subtrahend;
 	return minuend;
 }
 Vec Vec::operator&(Vec multiplier) const {
 	ensureSameVecDim(d, multiplier.d, "multiply");
-	Vec multiplicand = copy();
+	Vec multiplicand = deviceCopy();
 	multiplicand &= multiplier;
 	return multiplicand;
 }
+Vec Vec::zip(Vec other, const char *expr) const {
+	Vec res = deviceCopy();
+	res.setZip(other, expr);
+	return res;
+}
 double Vec::operator*(Vec multiplier) const {
-	if(d == 0 || multiplier.d == 0) return 0;
+	ensureSameVecDim(d, multiplier.d, "multiply");
+	if(d == 0) return 0;
+
+	// Only the operands not already on the device are transferred
+	size_t transferred = (dirty ? d : 0) + (multiplier.dirty ? d : 0);
+	if(FinLin::onHost(d, transferred)) {
+		double sum = 0;
+		for(int i = 0; i < d; i++) sum += data[i] * multiplier.data[i];
+		return sum;
+	}
 
-	Vec hdm = *this & multiplier; // hdm is for Hadamard
+	sync();
+	multiplier.update();
 
-	return hdm.sum();
+	return FinLin::total(FinLin::dotPartial, mem(), multiplier.mem(), d);
 }
 
 // Unary operations
 double Vec::sum() const {
-	Vec mutated = copy();
-	mutated.update();
-
-	int len = d; // Is cut in half until down to 1.
-
-	FinLin::setArg(FinLin::reduce, 0, mutated.clmem);
-
-	while(len != 1) {
-		// Include the last element in the event of an odd length
-		if(len % 2 == 1) {
-			mutated.data[0] += mutated.data[len - 1]; // Add it to the first component
-			FinLin::writeBuffer(mutated.clmem, 0, sizeof(double), mutated.data);
-		}
-
-		len /= 2;
-		FinLin::setArg(FinLin::reduce, 1, len);
-
-		FinLin::execKernel(FinLin::reduce, 0, len, 0);
+	if(d == 0) return 0;
+	if(FinLin::onHost(d, dirty ? d : 0)) {
+		double sum = 0;
+		for(int i = 0; i < d; i++) sum += data[i];
+		return sum;
 	}
 
-	// Only the first element is read. It should equal the result.
-	FinLin::readBuffer(mutated.clmem, 0, sizeof(double), mutated.data);
+	sync();
 
-	return mutated.data[0];
+	return FinLin::total(FinLin::sumPartial, mem(), NULL, d);
 }
 Vec Vec::operator~() const {
-	Vec negated = copy();
+	Vec negated = deviceCopy();
 	negated.update();
 
-	FinLin::setArg(FinLin::compNot, 0, negated.clmem);
+	FinLin::setArg(FinLin::compNot, 0, negated.mem());
 	FinLin::execKernel(FinLin::compNot, 0, d, 0);
-	FinLin::readBuffer(negated.clmem, 0, d*sizeof(double), negated.data);
+	FinLin::readBuffer(negated.mem(), 0, d*sizeof(double), negated.data);
 
 	return negated;
 }
@@ -272,25 +473,56 @@ Vec Vec::operator-() const {
 }
 
 double Vec::norm() const {
-	return sqrt(*this ^ 2);
+	return sqrt(*this * *this);
 }
 Vec Vec::normal() const {
 	return *this / norm();
 }
 
 Vec Vec::sigmoid() const {
-	Vec res = copy();
+	Vec res = deviceCopy();
 	res.setSigmoid();
 	return res;
 }
 Vec Vec::dsigmoid() const {
-	Vec res = copy();
+	Vec res = deviceCopy();
 	res.setDsigmoid();
 	return res;
 }
+Vec Vec::relu() const {
+	Vec res = deviceCopy();
+	res.setRelu();
+	return res;
+}
+Vec Vec::leakyRelu(double slope) const {
+	Vec res = deviceCopy();
+	res.setLeakyRelu(slope);
+	return res;
+}
+Vec Vec::tanh() const {
+	Vec res = deviceCopy();
+	res.setTanh();
+	return res;
+}
+Vec Vec::gelu() const {
+	Vec res = deviceCopy();
+	res.setGelu();
+	return res;
+}
+Vec Vec::logistic() const {
+	Vec res = deviceCopy();
+	res.setLogistic();
+	return res;
+}
+Vec Vec::map(const char *expr) const {
+	Vec res = deviceCopy();
+	res.setMap(expr);
+	return res;
+}
 
 // Mutators
 double Vec::setComp(int index, double value) {
+	detach();
 	double prev = data[index];
 	data[index] = value;
 	dirty = true;
@@ -32,12 +32,23 @@ void Veci::createMem() {
 Veci Veci::copy() const {
 	Veci res = Veci(d);
 	memcpy(res.data, data, d * sizeof(int));
+	// Copied on the GPU too rather than uploading again, and always while
+	// capturing, so that replays copy inputs that have been rebound
+	if(!dirty || FinLin::capturing != NULL) {
+		sync();
+		FinLin::copyBuffer(clmem, res.clmem, 0, 0, d * sizeof(int));
+		res.dirty = false;
+	}
 	return res;
 }
-bool Veci::update() {
-	if(!dirty) return false;
+void Veci::sync() const {
+	if(!dirty) return;
 	FinLin::writeBuffer(clmem, 0, d*sizeof(int), data);
 	dirty = false;
+}
+bool Veci::update() {
+	if(!dirty) return false;
+	sync();
 	return true;
 }
 
@@ -49,13 +60,13 @@ Veci::Veci(int dimension, int* components) {
 }
 Veci::Veci(int dimension) {
 	d = dimension;
-	data = (int*)malloc(d * sizeof(int));
+	data = (int*)FinLin::allocHost(d * sizeof(int));
 	memset(data, 0, d * sizeof(int));
 	createMem();
 }
 Veci::Veci(Vec vec) {
 	d = vec.d;
-	data = (int*)malloc(d * sizeof(int));
+	data = (int*)FinLin::allocHost(d * sizeof(int));
 	for(int i = 0; i < d; i++) {
 		data[i] = (int)vec.data[i];
 	}
@@ -64,11 +75,15 @@ Veci::Veci(Vec vec) {
 
 // Statics
 Veci Veci::randomUniform(int dim, int min, int max) {
-	int *components = (int*)malloc(dim * sizeof(int));
-	for(int i = 0; i < dim; i++) {
-		components[i] = rand() % (max - min) + min;
-	}
-	return Veci(dim, components);
+	Veci res = Veci(dim, (int*)FinLin::allocHost(dim * sizeof(int)));
+	if(dim == 0) return res;
+	FinLin::randomArgs(FinLin::randomInt, res.clmem, dim);
+	FinLin::setArg(FinLin::randomInt, 7, min);
+	FinLin::setArg(FinLin::randomInt, 8, (int)((unsigned int)max - min));
+	FinLin::execKernel(FinLin::randomInt, 0, (dim + 1) / 2, 0);
+	FinLin::readBuffer(res.clmem, 0, dim * sizeof(int), res.data);
+	res.dirty = false;
+	return res;
 }
 
 // Accessors
@@ -190,9 +205,9 @@ Veci Veci::operator%(int modulus) const {
 	dividend /= modulus;
 	return dividend;
 }
-int Veci::operator^(int exponent) const {
-	int sqrMag = (*this * *this);
-	int res = 1;
+int64_t Veci::operator^(int exponent) const {
+	int64_t sqrMag = (*this * *this);
+	int64_t res = 1;
 	for(int i = 0; i < exponent / 2; i++) {
 		res *= sqrMag;
 	}
@@ -217,40 +232,23 @@ Veci Veci::operator&(Veci multiplier) const {
 	multiplicand &= multiplier;
 	return multiplicand;
 }
-int Veci::operator*(Veci multiplier) const {
-	if(d == 0 || multiplier.d == 0) return 0;
+int64_t Veci::operator*(Veci multiplier) const {
+	ensureSameVeciDim(d, multiplier.d, "multiply");
+	if(d == 0) return 0;
 
-	Veci hdm = *this & multiplier; // hdm is for Hadamard
+	sync();
+	multiplier.update();
 
-	return hdm.sum();
+	return FinLin::totall(FinLin::dotPartiali, clmem, multiplier.clmem, d);
 }
 
 // Unary operations
-int Veci::sum() const {
-	Vec mutated = copy();
-	mutated.update();
-
-	int len = d; // Is cut in half until down to 1.
-
-	FinLin::setArg(FinLin::reducei, 0, mutated.clmem);
-
-	while(len != 1) {
-		// Include the last element in the event of an odd length
-		if(len % 2 == 1) {
-			mutated.data[0] += mutated.data[len - 1]; // Add it to the first component
-			FinLin::writeBuffer(mutated.clmem, 0, sizeof(int), mutated.data);
-		}
-
-		len /= 2;
-		FinLin::setArg(FinLin::reducei, 1, len);
-
-		FinLin::execKernel(FinLin::reducei, 0, len, 0);
-	}
+int64_t Veci::sum() const {
+	if(d == 0) return 0;
 
-	// Only the first element is read. It should equal the result.
-	FinLin::readBuffer(mutated.clmem, 0, sizeof(int), mutated.data);
+	sync();
 
-	return mutated.data[0];
+	return FinLin::totall(FinLin::sumPartiali, clmem, NULL, d);
 }
 Veci Veci::operator~() const {
 	Veci negated = copy();
@@ -0,0 +1,282 @@
+// Copyright (c) 2021 Thomas Kaldahl
+
+#include "finlin.hpp"
+
+// Helper functions
+void ensureSameVeclDim(int d1, int d2, const char *operation) {
+	if(d1 != d2) {
+		fprintf(
+			stderr,
+			"Dimension mismatch. Cannot %s vectors of length %d and %d.\n",
+			operation,
+			d1,
+			d2
+		);
+		exit(1);
+	}
+}
+
+// Technical methods
+void Vecl::createMem() {
+	clmem = clCreateBuffer(
+		FinLin::context,
+		CL_MEM_READ_WRITE,
+		d * sizeof(int64_t),
+		NULL,
+		&FinLin::err
+	);
+	FinLin::checkErr();
+	dirty = true;
+}
+
+Vecl Vecl::copy() const {
+	Vecl res = Vecl(d);
+	memcpy(res.data, data, d * sizeof(int64_t));
+	// Copied on the GPU too rather than uploading again, and always while
+	// capturing, so that replays copy inputs that have been rebound
+	if(!dirty || FinLin::capturing != NULL) {
+		sync();
+		FinLin::copyBuffer(clmem, res.clmem, 0, 0, d * sizeof(int64_t));
+		res.dirty = false;
+	}
+	return res;
+}
+void Vecl::sync() const {
+	if(!dirty) return;
+	FinLin::writeBuffer(clmem, 0, d*sizeof(int64_t), data);
+	dirty = false;
+}
+bool Vecl::update() {
+	if(!dirty) return false;
+	sync();
+	return true;
+}
+
+// Constructors
+Vecl::Vecl(int dimension, int64_t *components) {
+	d = dimension;
+	data = components;
+	createMem();
+}
+Vecl::Vecl(int dimension) {
+	d = dimension;
+	data = (int64_t*)FinLin::allocHost(d * sizeof(int64_t));
+	memset(data, 0, d * sizeof(int64_t));
+	createMem();
+}
+Vecl::Vecl(int dimension, int64_t value) {
+	d = dimension;
+	data = (int64_t*)FinLin::allocHost(d * sizeof(int64_t));
+	for(int i = 0; i < d; i++) {
+		data[i] = value;
+	}
+	createMem();
+}
+Vecl::Vecl(Veci vec) {
+	d = vec.d;
+	data = (int64_t*)FinLin::allocHost(d * sizeof(int64_t));
+	for(int i = 0; i < d; i++) {
+		data[i] = vec.data[i];
+	}
+	createMem();
+}
+
+// Statics
+Vecl Vecl::randomUniform(int dim, int64_t min, int64_t max) {
+	Vecl res = Vecl(dim, (int64_t*)FinLin::allocHost(dim * sizeof(int64_t)));
+	if(dim == 0) return res;
+	FinLin::randomArgs(FinLin::randomLong, res.clmem, dim);
+	FinLin::setArg(FinLin::randomLong, 7, min);
+	FinLin::setArg(FinLin::randomLong, 8, (int64_t)((uint64_t)max - min));
+	FinLin::execKernel(FinLin::randomLong, 0, (dim + 1) / 2, 0);
+	FinLin::readBuffer(res.clmem, 0, dim * sizeof(int64_t), res.data);
+	res.dirty = false;
+	return res;
+}
+
+// Accessors
+int Vecl::dim() const {
+	return d;
+}
+
+int64_t Vecl::comp(int index) const {
+	return data[index];
+}
+
+char *Vecl::string() const {
+	const int MAXLEN = 23;
+	char *res = (char*)malloc(MAXLEN * d * sizeof(char) + 3);
+	snprintf(res, 3, "< ");
+	char *resp = res + strlen(res);
+	for(int i = 0; i < d; i++) {
+		snprintf(resp, MAXLEN, "%lld, ", (long long)data[i]);
+		resp += strlen(resp);
+	}
+	resp -= strlen(", ");
+	snprintf(resp, 3, " >");
+	return res;
+}
+
+// In-place operations
+Vecl Vecl::operator*=(int64_t scalar) {
+	update();
+
+	FinLin::setArg(FinLin::scalel, 0, clmem);
+	FinLin::setArg(FinLin::scalel, 1, scalar);
+	FinLin::execKernel(FinLin::scalel, 0, d, 0);
+	FinLin::readBuffer(clmem, 0, d*sizeof(int64_t), data);
+
+	return *this;
+}
+
+Vecl Vecl::operator/=(int64_t divisor) {
+	update();
+
+	FinLin::setArg(FinLin::dividel, 0, clmem);
+	FinLin::setArg(FinLin::dividel, 1, divisor);
+	FinLin::execKernel(FinLin::dividel, 0, d, 0);
+	FinLin::readBuffer(clmem, 0, d*sizeof(int64_t), data);
+
+	return *this;
+}
+
+Vecl Vecl::operator%=(int64_t modulus) {
+	update();
+
+	FinLin::setArg(FinLin::modulol, 0, clmem);
+	FinLin::setArg(FinLin::modulol, 1, modulus);
+	FinLin::execKernel(FinLin::modulol, 0, d, 0);
+	FinLin::readBuffer(clmem, 0, d*sizeof(int64_t), data);
+
+	return *this;
+}
+
+Vecl Vecl::operator+=(Vecl addend) {
+	ensureSameVeclDim(d, addend.d, "add");
+
+	update();
+	addend.update();
+
+	FinLin::setArg(FinLin::addl, 0, clmem);
+	FinLin::setArg(FinLin::addl, 1, addend.clmem);
+	FinLin::execKernel(FinLin::addl, 0, d, 0);
+	FinLin::readBuffer(clmem, 0, d*sizeof(int64_t), data);
+
+	return *this;
+}
+
+Vecl Vecl::operator-=(Vecl subtrahend) {
+	ensureSameVeclDim(d, subtrahend.d, "subtract");
+
+	update();
+	subtrahend.update();
+
+	FinLin::setArg(FinLin::addScaledl, 0, clmem);
+	FinLin::setArg(FinLin::addScaledl, 1, subtrahend.clmem);
+	FinLin::setArg(FinLin::addScaledl, 2, (int64_t)-1);
+	FinLin::execKernel(FinLin::addScaledl, 0, d, 0);
+
+	FinLin::readBuffer(clmem, 0, d*sizeof(int64_t), data);
+
+	return *this;
+}
+
+Vecl Vecl::operator&=(Vecl multiplier) {
+	ensureSameVeclDim(d, multiplier.d, "multiply");
+	update();
+	multiplier.update();
+
+	FinLin::setArg(FinLin::hadamardl, 0, clmem);
+	FinLin::setArg(FinLin::hadamardl, 1, multiplier.clmem);
+	FinLin::execKernel(FinLin::hadamardl, 0, d, 0);
+	FinLin::readBuffer(clmem, 0, d*sizeof(int64_t), data);
+
+	return *this;
+}
+
+// Binary operations
+Vecl Vecl::operator*(int64_t scalar) const {
+	Vecl vector = copy();
+	vector *= scalar;
+	return vector;
+}
+Vecl operator*(int64_t scalar, Vecl vector) {
+	return vector * scalar;
+}
+Vecl Vecl::operator/(int64_t divisor) const {
+	Vecl dividend = copy();
+	dividend /= divisor;
+	return dividend;
+}
+Vecl Vecl::operator%(int64_t modulus) const {
+	Vecl dividend = copy();
+	dividend %= modulus;
+	return dividend;
+}
+int64_t Vecl::operator^(int exponent) const {
+	int64_t sqrMag = (*this * *this);
+	int64_t res = 1;
+	for(int i = 0; i < exponent / 2; i++) {
+		res *= sqrMag;
+	}
+	return res;
+}
+
+Vecl Vecl::operator+(Vecl addend) const {
+	ensureSameVeclDim(d, addend.d, "add");
+	Vecl augend = copy();
+	augend += addend;
+	return augend;
+}
+Vecl Vecl::operator-(Vecl subtrahend) const {
+	ensureSameVeclDim(d, subtrahend.d, "subtract");
+	Vecl minuend = copy();
+	minuend -= subtrahend;
+	return minuend;
+}
+Vecl Vecl::operator&(Vecl multiplier) const {
+	ensureSameVeclDim(d, multiplier.d, "multiply");
+	Vecl multiplicand = copy();
+	multiplicand &= multiplier;
+	return multiplicand;
+}
+int64_t Vecl::operator*(Vecl multiplier) const {
+	ensureSameVeclDim(d, multiplier.d, "multiply");
+	if(d == 0) return 0;
+
+	sync();
+	multiplier.update();
+
+	return FinLin::totall(FinLin::dotPartiall, clmem, multiplier.clmem, d);
+}
+
+// Unary operations
+int64_t Vecl::sum() const {
+	if(d == 0) return 0;
+
+	sync();
+
+	return FinLin::totall(FinLin::sumPartiall, clmem, NULL, d);
+}
+Vecl Vecl::operator~() const {
+	Vecl negated = copy();
+	negated.update();
+
+	FinLin::setArg(FinLin::compNotl, 0, negated.clmem);
+	FinLin::execKernel(FinLin::compNotl, 0, d, 0);
+	FinLin::readBuffer(negated.clmem, 0, d*sizeof(int64_t), negated.data);
+
+	return negated;
+}
+
+Vecl Vecl::operator-() const {
+	return (int64_t)-1 * *this;
+}
+
+// Mutators
+int64_t Vecl::setComp(int index, int64_t value) {
+	int64_t prev = data[index];
+	data[index] = value;
+	dirty = true;
+	return prev;
+}